@@ -56,6 +56,8 @@ void setup()
   mySerial.begin(9600); //serial port to radio
   Serial.println("Startup");
 
+  //print the module type, version and join results of the library
+  myLora.setDebugOutput(&Serial);
   initialize_radio();
 
   //transmit a startup message
@@ -55,6 +55,8 @@ void setup()
   mySerial.begin(9600); //serial port to radio
   Serial.println("Startup");
 
+  //print the module type, version and join results of the library
+  myLora.setDebugOutput(&Serial);
   initialize_radio();
 
   //transmit a startup message
@@ -136,9 +138,10 @@ void loop()
       }
       case TX_WITH_RX:
       {
-        String received = myLora.getRx();
-        received = myLora.base16decode(received);
-        Serial.print("Received downlink: " + received);
+        Serial.print("Received downlink on port ");
+        Serial.print(myLora.getRxPort());
+        Serial.print(": ");
+        Serial.println(myLora.getRx());
         break;
       }
       default:
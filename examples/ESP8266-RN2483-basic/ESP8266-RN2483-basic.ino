@@ -48,6 +48,8 @@ void setup() {
 
   Serial.println("Startup");
 
+  //print the module type, version and join results of the library
+  myLora.setDebugOutput(&Serial);
   initialize_radio();
 
   //transmit a startup message
@@ -55,6 +55,8 @@ void setup()
 
     // initialize GPS
     sodaq_gps.init(GPS_ENABLE);
+    // Get binary UBX NAV-PVT from the GPS instead of NMEA text
+    sodaq_gps.setUbx(true);
 
     // myLora.setDR(0); //set the datarate at which we measure. DR7 is the best.
     pinMode(LED_BLUE, OUTPUT);
@@ -93,6 +93,8 @@ void setup()
 
     // initialize GPS
     sodaq_gps.init(GPS_ENABLE);
+    // Get binary UBX NAV-PVT from the GPS instead of NMEA text
+    sodaq_gps.setUbx(true);
 
     // Set the datarate/spreading factor at which we communicate.
     // DR5 is the fastest and best to use. DR0 is the slowest.
@@ -30,8 +30,30 @@
 #define debugPrint(...)
 #endif
 
-static const size_t INPUT_BUFFER_SIZE = 128;    // TODO Check UBlox manual ReceiverDescProtSpec
 static const uint8_t UBlox_I2C_addr = 0x42;
+// DDC registers, see section 10.3 of u-blox 7, Receiver Description
+static const uint8_t UBlox_bytes_avail_reg = 0xFD;  // 0xFD (high), 0xFE (low)
+
+// UBX framing and messages, see section 31 of u-blox 7, Receiver Description
+static const uint8_t UBX_sync1 = 0xB5;
+static const uint8_t UBX_sync2 = 0x62;
+static const size_t UBX_overhead = 8;       // sync, class, id, length, checksum
+static const uint8_t UBX_NAV = 0x01;
+static const uint8_t UBX_NAV_DOP = 0x04;
+static const uint8_t UBX_NAV_PVT = 0x07;
+static const uint8_t UBX_ACK = 0x05;
+static const uint8_t UBX_ACK_ACK = 0x01;
+static const uint8_t UBX_CFG = 0x06;
+static const uint8_t UBX_CFG_PRT = 0x00;
+static const uint8_t UBX_CFG_MSG = 0x01;
+static const uint8_t UBX_CFG_RATE = 0x08;
+static const uint8_t UBX_CFG_RXM = 0x11;
+static const uint8_t UBX_CFG_PM2 = 0x3B;
+static const uint8_t UBX_NMEA = 0xF0;      // Standard NMEA messages: GGA 0x00 .. VTG 0x05
+static const uint8_t UBX_NMEA_GGA = 0x00;
+static const uint8_t UBX_NMEA_RMC = 0x04;
+static const uint8_t UBX_NMEA_VTG = 0x05;
+static const uint8_t UBX_NMEA_TXT = 0x41;
 
 #define GPS_ENABLE_ON   HIGH
 #define GPS_ENABLE_OFF  LOW
@@ -57,9 +79,19 @@ Sodaq_UBlox_GPS::Sodaq_UBlox_GPS()
 
     resetValues();
 
-    _trans_active = false;
-    _inputBuffer = static_cast<char*>(malloc(INPUT_BUFFER_SIZE));
-    _inputBufferSize = INPUT_BUFFER_SIZE;
+    _pending = 0;
+    _chunkIndex = 0;
+    _chunkLength = 0;
+    _inputLength = 0;
+    _inputBuffer[0] = '\0';
+
+    _configured = false;
+    _ubx = false;
+    _ubxActive = false;
+    _ubxErrors = 0;
+    _navRate = 1000;
+    _powerMode = POWER_CONTINUOUS;
+    _updatePeriod = 1000;
 }
 
 void Sodaq_UBlox_GPS::resetValues()
@@ -67,8 +99,10 @@ void Sodaq_UBlox_GPS::resetValues()
     _seenLatLon = false;
     _seenAlt = false;
     _numSatellites = 0;
-    _lat = 0;
-    _lon = 0;
+    _latE7 = 0;
+    _lonE7 = 0;
+    _altCm = 0;
+    _hdop100 = 0;
 
     _seenTime = false;
     _hh = 0;
@@ -100,13 +134,28 @@ bool Sodaq_UBlox_GPS::scan(bool leave_on, uint32_t timeout)
     on();
     delay(500);         // TODO Is this needed?
 
+    if (!_configured) {
+        _configured = configure();
+        if (!_configured) {
+            debugPrintLn("[scan] could not configure the receiver");
+        }
+    }
+
     size_t fix_count = 0;
     while (!is_timedout(start, timeout)) {
-        if (!readLine()) {
-            // TODO Maybe quit?
-            continue;
+        if (_ubxActive) {
+            size_t size = readUbx();
+            if (size == 0) {
+                continue;
+            }
+            parseUbx((const uint8_t *)_inputBuffer, size);
+        } else {
+            if (!readLine()) {
+                // TODO Maybe quit?
+                continue;
+            }
+            parseLine(_inputBuffer);
         }
-        parseLine(_inputBuffer);
 
         // Which conditions are required to quit the scan?
         if (_seenLatLon
@@ -122,14 +171,18 @@ bool Sodaq_UBlox_GPS::scan(bool leave_on, uint32_t timeout)
     }
 
     if (_numSatellites > 0) {
-        debugPrintLn(String("[scan] num sats = ") + _numSatellites);
+        debugPrint("[scan] num sats = ");
+        debugPrintLn(_numSatellites);
     }
     if (_seenTime) {
-        debugPrintLn(String("[scan] datetime = ") + getDateTimeString());
+        debugPrint("[scan] datetime = ");
+        debugPrintLn(getDateTimeString());
     }
     if (_seenLatLon) {
-        debugPrintLn(String("[scan] lat = ") + String(_lat, 7));
-        debugPrintLn(String("[scan] lon = ") + String(_lon, 7));
+        debugPrint("[scan] lat = ");
+        debugPrintLn(getLat(), 7);
+        debugPrint("[scan] lon = ");
+        debugPrintLn(getLon(), 7);
     }
 
     if (!leave_on) {
@@ -140,15 +193,13 @@ bool Sodaq_UBlox_GPS::scan(bool leave_on, uint32_t timeout)
 
 String Sodaq_UBlox_GPS::getDateTimeString()
 {
-    return num2String(getYear(), 4)
-            + num2String(getMonth(), 2)
-            + num2String(getDay(), 2)
-            + num2String(getHour(), 2)
-            + num2String(getMinute(), 2)
-            + num2String(getSecond(), 2);
+    char s[20];
+    snprintf(s, sizeof(s), "%04u%02u%02u%02u%02u%02u", getYear(), getMonth(), getDay(),
+             getHour(), getMinute(), getSecond());
+    return String(s);
 }
 
-bool Sodaq_UBlox_GPS::parseLine(const char * line)
+bool Sodaq_UBlox_GPS::parseLine(char * line)
 {
     //debugPrintLn(String("= ") + line);
     if (!computeCrc(line, false)) {
@@ -156,38 +207,52 @@ bool Sodaq_UBlox_GPS::parseLine(const char * line)
         computeCrc(line, true);
         return false;
     }
-    String data = line + 1;
-    data.remove(data.length() - 3, 3);  // Strip checksum *<hex><hex>
+    debugPrint(">> ");
+    debugPrintLn(line);
+
+    // Strip checksum *<hex><hex> and split the rest in place
+    line[strlen(line) - 3] = '\0';
+    const char * fields[_maxFields];
+    uint8_t count = splitFields(line + 1, fields, _maxFields);
+
+    const char * name = fields[0];
+    if (strncmp(name, "GP", 2) != 0 || strlen(name) != 5) {
+        debugPrint("?? >> ");
+        debugPrintLn(name);
+        return false;
+    }
+    name += 2;
 
-    if (data.startsWith("GPGGA")) {
-        return parseGPGGA(data);
+    if (strcmp(name, "GGA") == 0) {
+        return parseGPGGA(fields, count);
     }
 
-    if (data.startsWith("GPGSA")) {
-        return parseGPGSA(data);
+    if (strcmp(name, "GSA") == 0) {
+        return parseGPGSA(fields, count);
     }
 
-    if (data.startsWith("GPRMC")) {
-        return parseGPRMC(data);
+    if (strcmp(name, "RMC") == 0) {
+        return parseGPRMC(fields, count);
     }
 
-    if (data.startsWith("GPGSV")) {
-        return parseGPGSV(data);
+    if (strcmp(name, "GSV") == 0) {
+        return parseGPGSV(fields, count);
     }
 
-    if (data.startsWith("GPGLL")) {
-        return parseGPGLL(data);
+    if (strcmp(name, "GLL") == 0) {
+        return parseGPGLL(fields, count);
     }
 
-    if (data.startsWith("GPVTG")) {
-        return parseGPVTG(data);
+    if (strcmp(name, "VTG") == 0) {
+        return parseGPVTG(fields, count);
     }
 
-    if (data.startsWith("GPTXT")) {
-        return parseGPTXT(data);
+    if (strcmp(name, "TXT") == 0) {
+        return parseGPTXT(fields, count);
     }
 
-    debugPrintLn(String("?? >> ") + line);
+    debugPrint("?? >> ");
+    debugPrintLn(fields[0]);
     return false;
 }
 
@@ -218,29 +283,28 @@ bool Sodaq_UBlox_GPS::parseLine(const char * line)
  * 14   diffStation     num             ID of station providing differential corrections
  * 15   checksum        2 hex digits
  */
-bool Sodaq_UBlox_GPS::parseGPGGA(const String & line)
+bool Sodaq_UBlox_GPS::parseGPGGA(const char * const * fields, uint8_t count)
 {
     debugPrintLn("parseGPGGA");
-    debugPrintLn(String(">> ") + line);
-    if (getField(line, 6) != "0") {
-        _lat = convertDegMinToDecDeg(getField(line, 2));
-        if (getField(line, 3) == "S") {
-            _lat = -_lat;
+    if (strcmp(getField(fields, count, 6), "0") != 0) {
+        _latE7 = convertDegMinToDegE7(getField(fields, count, 2));
+        if (strcmp(getField(fields, count, 3), "S") == 0) {
+            _latE7 = -_latE7;
         }
-        _lon = convertDegMinToDecDeg(getField(line, 4));
-        if (getField(line, 5) == "W") {
-            _lon = -_lon;
+        _lonE7 = convertDegMinToDegE7(getField(fields, count, 4));
+        if (strcmp(getField(fields, count, 5), "W") == 0) {
+            _lonE7 = -_lonE7;
         }
         _seenLatLon = true;
 
-        _hdop = getField(line, 8).toFloat();
-        if(getField(line, 10) == "M") {
-          _alt = getField(line, 9).toFloat();
+        _hdop100 = parseFixed(getField(fields, count, 8), 2);
+        if(strcmp(getField(fields, count, 10), "M") == 0) {
+          _altCm = parseFixed(getField(fields, count, 9), 2);
           _seenAlt = true;
         }
     }
 
-    _numSatellites = getField(line, 7).toInt();
+    _numSatellites = atoi(getField(fields, count, 7));
     return true;
 }
 
@@ -248,11 +312,10 @@ bool Sodaq_UBlox_GPS::parseGPGGA(const String & line)
  * Parse GPGSA line
  * GNSS DOP and Active Satellites
  */
-bool Sodaq_UBlox_GPS::parseGPGSA(const String & line)
+bool Sodaq_UBlox_GPS::parseGPGSA(const char * const * fields, uint8_t count)
 {
     // Not (yet) used
     debugPrintLn("parseGPGSA");
-    debugPrintLn(String(">> ") + line);
     return false;
 }
 
@@ -275,26 +338,23 @@ bool Sodaq_UBlox_GPS::parseGPGSA(const String & line)
  * 12   posMode         char            Mode Indicator: 'N' No Fix, 'E' Estimate, 'A' Auto GNSS, 'D' Diff GNSS
  * 13   checksum        2 hex digits    Checksum
  */
-bool Sodaq_UBlox_GPS::parseGPRMC(const String & line)
+bool Sodaq_UBlox_GPS::parseGPRMC(const char * const * fields, uint8_t count)
 {
     debugPrintLn("parseGPRMC");
-    debugPrintLn(String(">> ") + line);
 
-    if (getField(line, 2) == "A" && getField(line, 12) != "N") {
-        _lat = convertDegMinToDecDeg(getField(line, 3));
-        if (getField(line, 4) == "S") {
-            _lat = -_lat;
+    if (strcmp(getField(fields, count, 2), "A") == 0 && strcmp(getField(fields, count, 12), "N") != 0) {
+        _latE7 = convertDegMinToDegE7(getField(fields, count, 3));
+        if (strcmp(getField(fields, count, 4), "S") == 0) {
+            _latE7 = -_latE7;
         }
-        _lon = convertDegMinToDecDeg(getField(line, 5));
-        if (getField(line, 6) == "W") {
-            _lon = -_lon;
+        _lonE7 = convertDegMinToDegE7(getField(fields, count, 5));
+        if (strcmp(getField(fields, count, 6), "W") == 0) {
+            _lonE7 = -_lonE7;
         }
         _seenLatLon = true;
     }
 
-    String time = getField(line, 1);
-    String date = getField(line, 9);
-    setDateTime(date, time);
+    setDateTime(getField(fields, count, 9), getField(fields, count, 1));
 
     return true;
 }
@@ -315,14 +375,13 @@ bool Sodaq_UBlox_GPS::parseGPRMC(const String & line)
  *
  * fields 4..7 are repeated for each satellite in this message
  */
-bool Sodaq_UBlox_GPS::parseGPGSV(const String & line)
+bool Sodaq_UBlox_GPS::parseGPGSV(const char * const * fields, uint8_t count)
 {
     debugPrintLn("parseGPGSV");
-    debugPrintLn(String(">> ") + line);
 
     // We could/should only use msgNum == 1. However, all messages should have
     // the same numSV.
-    _numSatellites = getField(line, 3).toInt();
+    _numSatellites = atoi(getField(fields, count, 3));
 
     return true;
 }
@@ -331,11 +390,10 @@ bool Sodaq_UBlox_GPS::parseGPGSV(const String & line)
  * Parse GPGLL line
  * Latitude and longitude, with time of position fix and status
  */
-bool Sodaq_UBlox_GPS::parseGPGLL(const String & line)
+bool Sodaq_UBlox_GPS::parseGPGLL(const char * const * fields, uint8_t count)
 {
     // Not (yet) used
     debugPrintLn("parseGPGLL");
-    debugPrintLn(String(">> ") + line);
     return false;
 }
 
@@ -343,11 +401,10 @@ bool Sodaq_UBlox_GPS::parseGPGLL(const String & line)
  * Parse GPVTG line
  * Course over ground and Ground speed
  */
-bool Sodaq_UBlox_GPS::parseGPVTG(const String & line)
+bool Sodaq_UBlox_GPS::parseGPVTG(const char * const * fields, uint8_t count)
 {
     // Not (yet) used
     debugPrintLn("parseGPVTG");
-    debugPrintLn(String(">> ") + line);
     return false;
 }
 
@@ -365,11 +422,12 @@ bool Sodaq_UBlox_GPS::parseGPVTG(const String & line)
  * 4    text            string          Any ASCII text
  * 13   checksum        2 hex digits    Checksum
  */
-bool Sodaq_UBlox_GPS::parseGPTXT(const String & line)
+bool Sodaq_UBlox_GPS::parseGPTXT(const char * const * fields, uint8_t count)
 {
     //debugPrintLn("parseGPTXT");
-    //debugPrintLn(String(">> ") + line);
-    debugPrintLn(String("TXT: \"") + getField(line, 4) + "\"");
+    debugPrint("TXT: \"");
+    debugPrint(getField(fields, count, 4));
+    debugPrintLn("\"");
     return true;
 }
 
@@ -449,38 +507,60 @@ uint8_t Sodaq_UBlox_GPS::getHex2(const char * s, size_t index)
     return val;
 }
 
-String Sodaq_UBlox_GPS::num2String(int num, size_t width)
+/*!
+ * Split the fields of a sentence in one pass, by putting a NUL over
+ * every separator. fields[0] is the sentence name. Fields past max are
+ * left in the last one. Returns the number of fields.
+ */
+uint8_t Sodaq_UBlox_GPS::splitFields(char * data, const char ** fields, uint8_t max)
 {
-    String out;
-    out = num;
-    while (out.length() < width) {
-        out = String("0") + out;
+    uint8_t count = 0;
+    fields[count++] = data;
+    for (char * p = data; *p != '\0' && count < max; ++p) {
+        if (*p == _fieldSep) {
+            *p = '\0';
+            fields[count++] = p + 1;
+        }
     }
-    return out;
+    return count;
 }
 
-String Sodaq_UBlox_GPS::getField(const String & data, int index)
+/*!
+ * A field by index, or an empty string if the sentence is shorter
+ */
+const char * Sodaq_UBlox_GPS::getField(const char * const * fields, uint8_t count, uint8_t index)
 {
-    int found = 0;
-    int strIndex[] = { 0, -1 };
-    int maxIndex = data.length() - 1;
+    return index < count ? fields[index] : "";
+}
 
-    for (int i = 0; i <= maxIndex && found <= index; i++) {
-        if (data.charAt(i) == _fieldSep || i == maxIndex) {
-            found++;
-            strIndex[0] = strIndex[1] + 1;
-            strIndex[1] = (i == maxIndex) ? i + 1 : i;
+/*!
+ * Parse a decimal number like "-12.34" into an integer scaled by
+ * 10^decimals, e.g. -1234 for 2 decimals. Extra digits are dropped.
+ */
+int32_t Sodaq_UBlox_GPS::parseFixed(const char * s, uint8_t decimals)
+{
+    bool negative = *s == '-';
+    if (negative) {
+        ++s;
+    }
+    int32_t value = 0;
+    while (*s >= '0' && *s <= '9') {
+        value = value * 10 + (*s++ - '0');
+    }
+    if (*s == '.') {
+        ++s;
+    }
+    for (uint8_t i = 0; i < decimals; ++i) {
+        value *= 10;
+        if (*s >= '0' && *s <= '9') {
+            value += *s++ - '0';
         }
     }
-
-    return found > index ? data.substring(strIndex[0], strIndex[1]) : "";
+    return negative ? -value : value;
 }
 
 /*
- * Convert lat/long degree-minute format to decimal-degrees
- *
- * This code is from
- *   http://arduinodev.woofex.net/2013/02/06/adafruit_gps_forma/
+ * Convert lat/long degree-minute format to degrees times 10^7
  *
  * According to the NMEA Standard, Latitude and Longitude are output in the format Degrees, Minutes and
  * (Decimal) Fractions of Minutes. To convert to Degrees and Fractions of Degrees, or Degrees, Minutes, Seconds
@@ -494,32 +574,48 @@ String Sodaq_UBlox_GPS::getField(const String & data, int index)
  * or
  *   Latitude 47.28521118 Degrees
  *   Longitude 8.56524738 Degrees
+ *
+ * The minutes are taken to 6 decimals, so one millionth of a minute is
+ * 1/6 of the result's unit, and all of it fits in 32 bits.
  */
-double Sodaq_UBlox_GPS::convertDegMinToDecDeg(const String & data)
+int32_t Sodaq_UBlox_GPS::convertDegMinToDegE7(const char * s)
 {
-    double degMin = data.toFloat();
-    double min = 0.0;
-    double decDeg = 0.0;
-
-    //get the minutes, fmod() requires double
-    min = fmod((double) degMin, 100.0);
+    int32_t degMin = 0;
+    while (*s >= '0' && *s <= '9') {
+        degMin = degMin * 10 + (*s++ - '0');
+    }
+    // dddmm.mmmmmm * 10^6 would not fit, so only the minutes are scaled
+    int32_t minutes = degMin % 100;
+    if (*s == '.') {
+        ++s;
+    }
+    for (uint8_t i = 0; i < 6; ++i) {
+        minutes *= 10;
+        if (*s >= '0' && *s <= '9') {
+            minutes += *s++ - '0';
+        }
+    }
 
-    //rebuild coordinates in decimal degrees
-    degMin = (int) (degMin / 100);
-    decDeg = degMin + (min / 60);
+    return (degMin / 100) * 10000000L + (minutes + 3) / 6;
+}
 
-    return decDeg;
+/*!
+ * Two decimal digits, e.g. of "hhmmss"
+ */
+uint8_t Sodaq_UBlox_GPS::parse2(const char * s)
+{
+    return (s[0] - '0') * 10 + (s[1] - '0');
 }
 
-void Sodaq_UBlox_GPS::setDateTime(const String & date, const String & time)
+void Sodaq_UBlox_GPS::setDateTime(const char * date, const char * time)
 {
-    if (time.length() == 9 && date.length() == 6) {
-        _hh = time.substring(0, 2).toInt();
-        _mm = time.substring(2, 4).toInt();
-        _ss = time.substring(4, 6).toInt();
-        _dd = date.substring(0, 2).toInt();
-        _MM = date.substring(2, 4).toInt();
-        _yy = date.substring(4, 6).toInt();
+    if (strlen(time) == 9 && strlen(date) == 6) {
+        _hh = parse2(time);
+        _mm = parse2(time + 2);
+        _ss = parse2(time + 4);
+        _dd = parse2(date);
+        _MM = parse2(date + 2);
+        _yy = parse2(date + 4);
         _seenTime = true;
     }
 }
@@ -529,80 +625,410 @@ void Sodaq_UBlox_GPS::setDateTime(const String & date, const String & time)
  */
 bool Sodaq_UBlox_GPS::readLine(uint32_t timeout)
 {
-    if (!_inputBuffer) {
+    uint32_t start = millis();
+    while (!is_timedout(start, timeout)) {
+        int c = read();
+        if (c < 0) {
+            delay(_pollInterval);
+            continue;
+        }
+        if (assembleLine(c)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*!
+ * Add one byte to the frame in _inputBuffer
+ *
+ * A frame starts with '$', also when the line end of the previous one was
+ * lost, and ends with '\n'. Returns true when a frame is complete.
+ */
+bool Sodaq_UBlox_GPS::assembleLine(char c)
+{
+    if (c == '$') {
+        _inputLength = 0;
+    } else if (_inputLength == 0 || c == '\r') {
         return false;
+    } else if (c == '\n') {
+        _inputBuffer[_inputLength] = '\0';
+        _inputLength = 0;
+        return true;
+    }
+    if (_inputLength < _inputBufferSize - 1) {
+        _inputBuffer[_inputLength++] = c;
     }
+    return false;
+}
 
+/*!
+ * Read one UBX frame into _inputBuffer, returns its size or 0
+ */
+size_t Sodaq_UBlox_GPS::readUbx(uint32_t timeout)
+{
     uint32_t start = millis();
-    char c;
-    char *ptr = _inputBuffer;
-    size_t cnt = 0;
-    *ptr = '\0';
-
-    c = 0;
     while (!is_timedout(start, timeout)) {
-        c = (char)read();
-        if (c == '$') {
-            break;
+        int c = read();
+        if (c < 0) {
+            delay(_pollInterval);
+            continue;
+        }
+        if (assembleUbx(c)) {
+            return UBX_overhead + getU2((const uint8_t *)_inputBuffer + 4);
+        }
+    }
+    return 0;
+}
+
+/*!
+ * Add one byte to the UBX frame in _inputBuffer
+ *
+ * Anything before the sync chars, like NMEA sent before the switch to
+ * UBX, is skipped. Returns true when a frame of the length in its header
+ * is complete, the checksum is left to checkUbx().
+ */
+bool Sodaq_UBlox_GPS::assembleUbx(uint8_t c)
+{
+    uint8_t * frame = (uint8_t *)_inputBuffer;
+    if (_inputLength == 1 && c != UBX_sync2) {
+        _inputLength = 0;
+    }
+    if (_inputLength == 0 && c != UBX_sync1) {
+        return false;
+    }
+    frame[_inputLength++] = c;
+    if (_inputLength < 6) {
+        return false;
+    }
+    size_t size = UBX_overhead + getU2(frame + 4);
+    if (size > _inputBufferSize) {
+        debugPrint("UBX frame too long: ");
+        debugPrintLn(size);
+        ++_ubxErrors;
+        _inputLength = 0;
+        return false;
+    }
+    if (_inputLength < size) {
+        return false;
+    }
+    _inputLength = 0;
+    return true;
+}
+
+/*!
+ * Verify the framing and the checksum of a UBX frame
+ */
+bool Sodaq_UBlox_GPS::checkUbx(const uint8_t * frame, size_t size)
+{
+    if (size < UBX_overhead || frame[0] != UBX_sync1 || frame[1] != UBX_sync2
+            || size != UBX_overhead + getU2(frame + 4)) {
+        debugPrintLn("UBX invalid frame");
+        ++_ubxErrors;
+        return false;
+    }
+    uint8_t ckA;
+    uint8_t ckB;
+    ubxChecksum(frame + 2, size - 4, ckA, ckB);
+    if (ckA != frame[size - 2] || ckB != frame[size - 1]) {
+        debugPrintLn("UBX INVALID CRC");
+        ++_ubxErrors;
+        return false;
+    }
+    return true;
+}
+
+bool Sodaq_UBlox_GPS::parseUbx(const uint8_t * frame, size_t size)
+{
+    if (!checkUbx(frame, size)) {
+        return false;
+    }
+    uint8_t msgClass = frame[2];
+    uint8_t msgId = frame[3];
+    const uint8_t * payload = frame + 6;
+    uint16_t length = size - UBX_overhead;
+
+    if (msgClass == UBX_NAV && msgId == UBX_NAV_PVT) {
+        return parseNavPvt(payload, length);
+    }
+    if (msgClass == UBX_NAV && msgId == UBX_NAV_DOP) {
+        return parseNavDop(payload, length);
+    }
+    if (msgClass == UBX_ACK) {
+        return true;
+    }
+
+    debugPrint("?? UBX ");
+    debugPrint(msgClass, HEX);
+    debugPrint(" ");
+    debugPrintLn(msgId, HEX);
+    return false;
+}
+
+/*!
+ * Read the position and time from UBX-NAV-PVT
+ * See also section 31.17.14 of u-blox 7, Receiver Description.
+ * u-blox 8 appends 8 bytes to the 84 of u-blox 7.
+ *
+ * 0    iTOW            U4      ms      GPS time of week
+ * 4    year            U2              UTC
+ * 6    month           U1
+ * 7    day             U1
+ * 8    hour            U1
+ * 9    min             U1
+ * 10   sec             U1
+ * 11   valid           X1              1 validDate, 2 validTime
+ * 20   fixType         U1              0 no fix, 2 2D, 3 3D, 4 GNSS + dead reckoning
+ * 21   flags           X1              1 gnssFixOK
+ * 23   numSV           U1              Number of satellites used
+ * 24   lon             I4      1e-7 deg
+ * 28   lat             I4      1e-7 deg
+ * 36   hMSL            I4      mm      Height above mean sea level
+ * 76   pDOP            U2      0.01
+ */
+bool Sodaq_UBlox_GPS::parseNavPvt(const uint8_t * payload, uint16_t length)
+{
+    debugPrintLn("parseNavPvt");
+    if (length < 84) {
+        return false;
+    }
+
+    uint8_t fixType = payload[20];
+    if ((payload[21] & 0x01) && fixType >= 2 && fixType <= 4) {
+        _lonE7 = getI4(payload + 24);
+        _latE7 = getI4(payload + 28);
+        _seenLatLon = true;
+        if (fixType != 2) {
+            _altCm = getI4(payload + 36) / 10;
+            _seenAlt = true;
         }
     }
-    if (c != '$') {
+
+    if ((payload[11] & 0x03) == 0x03) {
+        _yy = getU2(payload + 4) - 2000;
+        _MM = payload[6];
+        _dd = payload[7];
+        _hh = payload[8];
+        _mm = payload[9];
+        _ss = payload[10];
+        _seenTime = true;
+    }
+
+    _numSatellites = payload[23];
+    return true;
+}
+
+/*!
+ * Read the HDOP from UBX-NAV-DOP, which comes before NAV-PVT in an epoch
+ * See also section 31.17.5 of u-blox 7, Receiver Description.
+ *
+ * 0    iTOW            U4      ms      GPS time of week
+ * 12   hDOP            U2      0.01    Horizontal DOP
+ */
+bool Sodaq_UBlox_GPS::parseNavDop(const uint8_t * payload, uint16_t length)
+{
+    debugPrintLn("parseNavDop");
+    if (length < 18) {
         return false;
     }
-    *ptr++ = c;
-    ++cnt;
+    _hdop100 = getU2(payload + 12);
+    return true;
+}
 
-    c = 0;
+/*!
+ * Send a UBX message and wait for its acknowledgement
+ */
+bool Sodaq_UBlox_GPS::sendUbx(uint8_t msgClass, uint8_t msgId, const uint8_t * payload, uint16_t length,
+                              uint32_t timeout)
+{
+    uint8_t header[6] = { UBX_sync1, UBX_sync2, msgClass, msgId, (uint8_t)length, (uint8_t)(length >> 8) };
+    uint8_t ckA;
+    uint8_t ckB;
+    ubxChecksum(header + 2, 4, ckA, ckB);
+    for (uint16_t i = 0; i < length; ++i) {
+        ckA += payload[i];
+        ckB += ckA;
+    }
+
+    Wire.beginTransmission(_addr);
+    Wire.write(header, sizeof(header));
+    Wire.write(payload, length);
+    Wire.write(ckA);
+    Wire.write(ckB);
+    if (Wire.endTransmission() != 0) {
+        return false;
+    }
+
+    uint32_t start = millis();
     while (!is_timedout(start, timeout)) {
-        c = (char)read();
-        if (c == '\r') {
+        size_t size = readUbx(timeout - (millis() - start));
+        const uint8_t * frame = (const uint8_t *)_inputBuffer;
+        if (size == 0 || !checkUbx(frame, size)) {
             continue;
         }
-        if (c == '\n') {
-            break;
+        if (frame[2] == UBX_ACK && size >= 10 && frame[6] == msgClass && frame[7] == msgId) {
+            return frame[3] == UBX_ACK_ACK;
         }
-        if (cnt < _inputBufferSize - 1) {
-            *ptr++ = c;
-            ++cnt;
+    }
+    return false;
+}
+
+/*!
+ * Configure the receiver: the protocol and messages on the DDC port, the
+ * navigation rate and the power mode
+ *
+ * With NMEA only GGA and RMC are left on, with UBX only NAV-DOP and
+ * NAV-PVT. The input takes both protocols.
+ */
+bool Sodaq_UBlox_GPS::configure()
+{
+    // Drop the partial NMEA frame
+    _inputLength = 0;
+
+    // UBX-CFG-PRT for DDC: portID 0, mode is the slave address
+    uint8_t prt[20] = { 0 };
+    prt[4] = _addr << 1;
+    prt[12] = 0x03;                 // inProtoMask: UBX, NMEA
+    // outProtoMask: UBX, plus NMEA in NMEA mode. UBX stays on for the
+    // acknowledgements of this and the following messages.
+    prt[14] = _ubx ? 0x01 : 0x03;
+    if (!sendUbx(UBX_CFG, UBX_CFG_PRT, prt, sizeof(prt))) {
+        return false;
+    }
+    _ubxActive = _ubx;
+
+    // UBX-CFG-MSG: class, id and rate on this port
+    if (_ubx) {
+        const uint8_t dop[3] = { UBX_NAV, UBX_NAV_DOP, 1 };
+        const uint8_t pvt[3] = { UBX_NAV, UBX_NAV_PVT, 1 };
+        if (!sendUbx(UBX_CFG, UBX_CFG_MSG, dop, sizeof(dop))
+                || !sendUbx(UBX_CFG, UBX_CFG_MSG, pvt, sizeof(pvt))) {
+            return false;
+        }
+    } else {
+        for (uint8_t id = UBX_NMEA_GGA; id <= UBX_NMEA_VTG; ++id) {
+            uint8_t msg[3] = { UBX_NMEA, id, id == UBX_NMEA_GGA || id == UBX_NMEA_RMC };
+            if (!sendUbx(UBX_CFG, UBX_CFG_MSG, msg, sizeof(msg))) {
+                return false;
+            }
+        }
+        // GPTXT, the antenna status and other notices
+        const uint8_t txt[3] = { UBX_NMEA, UBX_NMEA_TXT, 0 };
+        if (!sendUbx(UBX_CFG, UBX_CFG_MSG, txt, sizeof(txt))) {
+            return false;
         }
     }
-    *ptr = '\0';
-    if (c != '\n') {
+
+    // UBX-CFG-RATE: measRate in ms, navRate 1 cycle, timeRef GPS
+    const uint8_t rate[6] = { (uint8_t)_navRate, (uint8_t)(_navRate >> 8), 1, 0, 1, 0 };
+    if (!sendUbx(UBX_CFG, UBX_CFG_RATE, rate, sizeof(rate))) {
         return false;
     }
-    endTransmission();
-    return true;
+
+    /*
+     * UBX-CFG-PM2, before power save mode is entered with UBX-CFG-RXM
+     * See also section 31.11.20 of u-blox 7, Receiver Description.
+     *
+     * 0    version         U1              1
+     * 4    flags           X4              bit 12 updateEPH, bits 17..18 mode: 0 ON/OFF, 1 cyclic tracking
+     * 8    updatePeriod    U4      ms      Time between fixes
+     * 12   searchPeriod    U4      ms      Time between acquisition retries without a fix
+     * 20   onTime          U2      s       Time to stay in tracking after a fix
+     */
+    if (_powerMode != POWER_CONTINUOUS) {
+        uint8_t pm2[44] = { 0 };
+        uint32_t flags = 1UL << 12;
+        if (_powerMode == POWER_CYCLIC) {
+            flags |= 1UL << 17;
+        }
+        const uint32_t searchPeriod = 10000;
+        pm2[0] = 1;
+        for (uint8_t i = 0; i < 4; ++i) {
+            pm2[4 + i] = flags >> (8 * i);
+            pm2[8 + i] = _updatePeriod >> (8 * i);
+            pm2[12 + i] = searchPeriod >> (8 * i);
+        }
+        if (!sendUbx(UBX_CFG, UBX_CFG_PM2, pm2, sizeof(pm2))) {
+            return false;
+        }
+    }
+
+    // UBX-CFG-RXM: reserved 8, lpMode 0 continuous or 1 power save
+    const uint8_t rxm[2] = { 8, _powerMode != POWER_CONTINUOUS };
+    return sendUbx(UBX_CFG, UBX_CFG_RXM, rxm, sizeof(rxm));
+}
+
+/*!
+ * The 8-bit Fletcher checksum of UBX, over class, id, length and payload
+ */
+void Sodaq_UBlox_GPS::ubxChecksum(const uint8_t * data, size_t length, uint8_t & ckA, uint8_t & ckB)
+{
+    ckA = 0;
+    ckB = 0;
+    for (size_t i = 0; i < length; ++i) {
+        ckA += data[i];
+        ckB += ckA;
+    }
 }
 
-uint8_t Sodaq_UBlox_GPS::read()
+uint16_t Sodaq_UBlox_GPS::getU2(const uint8_t * p)
 {
-    beginTransmission();
+    return p[0] | (uint16_t)p[1] << 8;
+}
 
-    uint8_t b = 0xFF;
-    uint8_t nr_bytes;
-    nr_bytes = Wire.requestFrom(_addr, 1, false);
-    if (nr_bytes == 1) {
-        b = Wire.read();
-    }
-    return b;
+int32_t Sodaq_UBlox_GPS::getI4(const uint8_t * p)
+{
+    return (int32_t)(p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
 }
 
-void Sodaq_UBlox_GPS::beginTransmission()
+/*!
+ * Read one byte of the DDC stream, or -1 if there is nothing
+ *
+ * The stream is read in bursts of what the receiver says it has, up to
+ * the size of _chunk. As no more is read than that, the 0xFF it sends
+ * when its buffer is empty never gets in.
+ */
+int Sodaq_UBlox_GPS::read()
 {
-    if (_trans_active) {
-        return;
+    while (_chunkIndex >= _chunkLength) {
+        if (_pending == 0) {
+            _pending = available();
+            if (_pending == 0) {
+                return -1;
+            }
+        }
+        size_t size = _pending < _burstSize ? _pending : _burstSize;
+        _chunkLength = Wire.requestFrom(_addr, size);
+        for (uint8_t i = 0; i < _chunkLength; ++i) {
+            _chunk[i] = Wire.read();
+        }
+        _chunkIndex = 0;
+        if (_chunkLength == 0) {
+            _pending = 0;
+            return -1;
+        }
+        _pending -= _chunkLength;
     }
-    Wire.beginTransmission(_addr);
-    _trans_active = true;
+    return _chunk[_chunkIndex++];
 }
 
-void Sodaq_UBlox_GPS::endTransmission()
+/*!
+ * The number of bytes the receiver has for us, from the bytes available
+ * registers. Reading them leaves the register address at the stream.
+ */
+uint16_t Sodaq_UBlox_GPS::available()
 {
-    if (!_trans_active) {
-        return;
+    Wire.beginTransmission(_addr);
+    Wire.write(UBlox_bytes_avail_reg);
+    if (Wire.endTransmission(false) != 0) {
+        return 0;
     }
-    Wire.endTransmission();
-    _trans_active = false;
+    if (Wire.requestFrom(_addr, (size_t)2) != 2) {
+        return 0;
+    }
+    uint16_t count = Wire.read() << 8;
+    count |= Wire.read();
+    return count;
 }
 
 void Sodaq_UBlox_GPS::on()
@@ -613,4 +1039,12 @@ void Sodaq_UBlox_GPS::on()
 void Sodaq_UBlox_GPS::off()
 {
     digitalWrite(_enablePin, GPS_ENABLE_OFF);
+
+    // Whatever the receiver had is gone, and it starts with its defaults
+    _configured = false;
+    _ubxActive = false;
+    _pending = 0;
+    _chunkIndex = 0;
+    _chunkLength = 0;
+    _inputLength = 0;
 }
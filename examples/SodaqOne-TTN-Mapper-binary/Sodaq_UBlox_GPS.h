@@ -31,10 +31,13 @@ public:
     void init(int8_t enable_pin);
     bool scan(bool leave_on=false, uint32_t timeout=20000);
     String getDateTimeString();
-    double getLat() { return _lat; }
-    double getLon() { return _lon; }
-    double getAlt() { return _alt; }
-    double getHDOP() { return _hdop; }
+    double getLat() { return _latE7 / 1e7; }
+    double getLon() { return _lonE7 / 1e7; }
+    double getAlt() { return _altCm / 100.0; }
+    double getHDOP() { return _hdop100 / 100.0; }
+    // Degrees times 10^7, without going through floating point
+    int32_t getLatE7() { return _latE7; }
+    int32_t getLonE7() { return _lonE7; }
     uint8_t getNumberOfSatellites() { return _numSatellites; }
     uint16_t getYear() { return (uint16_t)_yy + 2000; }         // 2016..
     uint8_t getMonth() { return _MM; }         // 1..
@@ -49,35 +52,79 @@ public:
     // The minimum number of satellites to satisfy scan
     void setMinNumSatellites(size_t num) { _minNumSatellites = num; }
 
+    // scan() configures the receiver when a setting changed or after it
+    // was switched off. With NMEA only GGA and RMC are enabled.
+
+    // Use the UBX protocol, NAV-PVT and NAV-DOP, instead of NMEA.
+    void setUbx(bool ubx) { _ubx = ubx; _configured = false; }
+
+    // Time between navigation solutions in ms, 1000 by default
+    void setNavRate(uint16_t ms) { _navRate = ms; _configured = false; }
+
+    // Power save mode, see UBX-CFG-RXM and UBX-CFG-PM2. updatePeriod is
+    // the time between fixes in ms in the power save modes.
+    enum PowerMode {
+        POWER_CONTINUOUS,       // the default
+        POWER_CYCLIC,           // cyclic tracking, for update periods up to about 10 s
+        POWER_ON_OFF,           // off between fixes, for longer update periods
+    };
+    void setPowerMode(PowerMode mode, uint32_t updatePeriod = 1000)
+    {
+        _powerMode = mode;
+        _updatePeriod = updatePeriod;
+        _configured = false;
+    }
+
     // Sets the optional "Diagnostics and Debug" stream.
     void setDiag(Stream &stream) { _diagStream = &stream; }
     void setDiag(Stream *stream) { _diagStream = stream; }
 
+    // Parse one NMEA sentence, "$...*<hex><hex>" without the line end.
+    // The fields are split in place, so the sentence is modified.
+    bool parseLine(char * line);
+
+    // Parse one UBX frame, from the sync chars to the checksum.
+    bool parseUbx(const uint8_t * frame, size_t size);
+
+    // The number of UBX frames dropped for a bad length or checksum
+    uint16_t getUbxErrors() { return _ubxErrors; }
+
 private:
     void on();
     void off();
 
-    // Read one byte
-    uint8_t read();
+    // Read one byte, -1 if there is none
+    int read();
+    uint16_t available();
     bool readLine(uint32_t timeout = 10000);
-    bool parseLine(const char * line);
-    bool parseGPGGA(const String & line);
-    bool parseGPGSA(const String & line);
-    bool parseGPRMC(const String & line);
-    bool parseGPGSV(const String & line);
-    bool parseGPGLL(const String & line);
-    bool parseGPVTG(const String & line);
-    bool parseGPTXT(const String & line);
+    bool assembleLine(char c);
+    size_t readUbx(uint32_t timeout = 10000);
+    bool assembleUbx(uint8_t c);
+    bool checkUbx(const uint8_t * frame, size_t size);
+    bool sendUbx(uint8_t msgClass, uint8_t msgId, const uint8_t * payload, uint16_t length,
+                 uint32_t timeout = 1000);
+    bool configure();
+    bool parseNavPvt(const uint8_t * payload, uint16_t length);
+    bool parseNavDop(const uint8_t * payload, uint16_t length);
+    static void ubxChecksum(const uint8_t * data, size_t length, uint8_t & ckA, uint8_t & ckB);
+    static uint16_t getU2(const uint8_t * p);
+    static int32_t getI4(const uint8_t * p);
+    bool parseGPGGA(const char * const * fields, uint8_t count);
+    bool parseGPGSA(const char * const * fields, uint8_t count);
+    bool parseGPRMC(const char * const * fields, uint8_t count);
+    bool parseGPGSV(const char * const * fields, uint8_t count);
+    bool parseGPGLL(const char * const * fields, uint8_t count);
+    bool parseGPVTG(const char * const * fields, uint8_t count);
+    bool parseGPTXT(const char * const * fields, uint8_t count);
     bool computeCrc(const char * line, bool do_logging=false);
     uint8_t getHex2(const char * s, size_t index);
-    String num2String(int num, size_t width);
-    String getField(const String & data, int index);
-    double convertDegMinToDecDeg(const String & data);
-
-    void setDateTime(const String & date, const String & time);
+    uint8_t splitFields(char * data, const char ** fields, uint8_t max);
+    static const char * getField(const char * const * fields, uint8_t count, uint8_t index);
+    static int32_t parseFixed(const char * s, uint8_t decimals);
+    static int32_t convertDegMinToDegE7(const char * s);
+    static uint8_t parse2(const char * s);
 
-    void beginTransmission();
-    void endTransmission();
+    void setDateTime(const char * date, const char * time);
 
     void resetValues();
 
@@ -96,10 +143,10 @@ private:
     bool        _seenLatLon;
     bool        _seenAlt;
     uint8_t     _numSatellites;
-    double      _lat;
-    double      _lon;
-    double      _alt;
-    double      _hdop;
+    int32_t     _latE7;         // degrees * 10^7
+    int32_t     _lonE7;
+    int32_t     _altCm;         // centimeters above mean sea level
+    uint16_t    _hdop100;       // HDOP * 100
 
     bool        _seenTime;
     uint8_t     _yy;
@@ -109,11 +156,28 @@ private:
     uint8_t     _mm;
     uint8_t     _ss;
 
-    bool        _trans_active;
+    // What is left of the last bytes available count, and the last burst
+    static const uint8_t _burstSize = 64;       // fits the SAMD Wire buffer
+    static const uint8_t _pollInterval = 10;    // ms, while the receiver has nothing
+    uint16_t    _pending;
+    uint8_t     _chunk[_burstSize];
+    uint8_t     _chunkIndex;
+    uint8_t     _chunkLength;
 
     static const char _fieldSep;
-    char *      _inputBuffer;
-    size_t      _inputBufferSize;
+    // GPGSV has the most: the sentence name, 3 fields and 4 satellites of 4
+    static const uint8_t _maxFields = 20;
+    static const size_t _inputBufferSize = 128;    // TODO Check UBlox manual ReceiverDescProtSpec
+    char        _inputBuffer[_inputBufferSize];
+    size_t      _inputLength;
+
+    bool        _configured;        // the receiver has the settings below
+    bool        _ubx;
+    bool        _ubxActive;         // the receiver sends UBX
+    uint16_t    _navRate;
+    PowerMode   _powerMode;
+    uint32_t    _updatePeriod;
+    uint16_t    _ubxErrors;
 };
 
 extern Sodaq_UBlox_GPS sodaq_gps;
@@ -0,0 +1,56 @@
+/*
+ * Packs the coordinates TinyGPS++ parsed into the 24-bit latitude and
+ * longitude fields of the TTN Mapper payload, without going through
+ * floating point.
+ *
+ * The fields are ((lat + 90) / 180) * 16777215 and ((lng + 180) / 360) *
+ * 16777215, rounded down, which the javascript decoder in the sketch turns
+ * back into degrees. The AVR only has 32-bit float, whose 24-bit mantissa
+ * cannot hold lat + 90 to the resolution of the field, and every step of it
+ * is a soft-float library call. Here the RawDegrees (whole degrees plus
+ * billionths) are scaled exactly with integer multiplications and shifts, no
+ * division.
+ */
+
+#ifndef MapperPayload_h
+#define MapperPayload_h
+
+#include "TinyGPS++.h"
+
+/*
+ * floor(m * 16777215 / 360e9) for 0 <= m <= 360e9, m in billionths of a
+ * degree. 16777215 / 360e9 reduces to 372827 / 8e9. The estimate multiplies by
+ * 372827 / 8e9 rounded down in 39 fractional bits, which is less than 0.25
+ * low, so the exact result is the estimate or one more.
+ */
+inline uint32_t scaleToBinary(uint64_t m)
+{
+  uint32_t value = (uint32_t)((m * 25620476) >> 39);
+  if (m * 372827 >= (value + 1) * 8000000000ULL)
+    value++;
+  return value;
+}
+
+/*
+ * billionths of a degree above -offset, limited to 0 .. 2 * offset
+ */
+inline uint64_t billionthsAbove(const RawDegrees &raw, uint16_t offset)
+{
+  uint64_t degrees = raw.deg * 1000000000ULL + raw.billionths;
+  uint64_t half = offset * 1000000000ULL;
+  if (degrees > half)
+    degrees = half;
+  return raw.negative ? half - degrees : half + degrees;
+}
+
+inline uint32_t latitudeBinary(const RawDegrees &lat)
+{
+  return scaleToBinary(2 * billionthsAbove(lat, 90));
+}
+
+inline uint32_t longitudeBinary(const RawDegrees &lng)
+{
+  return scaleToBinary(billionthsAbove(lng, 180));
+}
+
+#endif
@@ -68,6 +68,7 @@ function Decoder(bytes, port) {
  *
  */
 #include "TinyGPS++.h"
+#include "MapperPayload.h"
 #include <SoftwareSerial.h>
 #include <rn2xx3.h>
 
@@ -103,6 +104,8 @@ void setup() {
   Serial.println("TTN UNO + GPS shield startup");
 
   //set up RN2xx3
+  //print the module type, version and join results of the library
+  myLora.setDebugOutput(&Serial);
   initialize_radio();
   //transmit a startup message
   myLora.tx("TTN Mapper on TTN Uno with GPS");
@@ -177,8 +180,8 @@ void loop() {
 
 void build_packet()
 {
-  LatitudeBinary = ((gps.location.lat() + 90) / 180.0) * 16777215;
-  LongitudeBinary = ((gps.location.lng() + 180) / 360.0) * 16777215;
+  LatitudeBinary = latitudeBinary(gps.location.rawLat());
+  LongitudeBinary = longitudeBinary(gps.location.rawLng());
 
   txBuffer[0] = ( LatitudeBinary >> 16 ) & 0xFF;
   txBuffer[1] = ( LatitudeBinary >> 8 ) & 0xFF;
@@ -0,0 +1,151 @@
+/*
+ * Minimal Arduino core for building the rn2xx3 library on a Linux host.
+ */
+
+#include "Arduino.h"
+
+#include <ctype.h>
+#include <time.h>
+
+HostConsole Serial;
+
+static uint64_t monotonicMicros()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static const uint64_t startMicros = monotonicMicros();
+static bool simulatedTime = false;
+static uint64_t skippedMicros = 0;
+
+void setSimulatedTime(bool on)
+{
+  simulatedTime = on;
+}
+
+unsigned long micros()
+{
+  return monotonicMicros() - startMicros + skippedMicros;
+}
+
+unsigned long millis()
+{
+  return micros() / 1000;
+}
+
+void delay(unsigned long ms)
+{
+  if ( simulatedTime ) {
+      skippedMicros += (uint64_t)ms * 1000;
+      return;
+  }
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000L;
+  nanosleep( &ts, NULL );
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  if ( simulatedTime ) {
+      skippedMicros += us;
+      return;
+  }
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (us % 1000000) * 1000L;
+  nanosleep( &ts, NULL );
+}
+
+void init()
+{
+}
+
+void pinMode(uint8_t, uint8_t)
+{
+}
+
+void digitalWrite(uint8_t, uint8_t)
+{
+}
+
+void String::trim()
+{
+  size_t begin = 0;
+  size_t end = _s.size();
+  while ( begin < end && isspace( (unsigned char)_s[begin] ) ) {
+      begin++;
+  }
+  while ( end > begin && isspace( (unsigned char)_s[end - 1] ) ) {
+      end--;
+  }
+  _s = _s.substr( begin, end - begin );
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while ( size-- ) {
+      n += write( *buffer++ );
+  }
+  return n;
+}
+
+size_t Print::print(long n, int base)
+{
+  char b[24];
+  if ( base == HEX ) {
+      snprintf( b, sizeof( b ), "%lX", (unsigned long)n );
+  } else {
+      snprintf( b, sizeof( b ), "%ld", n );
+  }
+  return write( b );
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  char b[24];
+  snprintf( b, sizeof( b ), base == HEX ? "%lX" : "%lu", n );
+  return write( b );
+}
+
+size_t Print::print(double n, int digits)
+{
+  char b[48];
+  snprintf( b, sizeof( b ), "%.*f", digits, n );
+  return write( b );
+}
+
+String Stream::readStringUntil(char terminator)
+{
+  std::string s;
+  unsigned long start = millis();
+  while ( millis() - start < _timeout ) {
+      int c = read();
+      if ( c < 0 ) {
+          continue;
+      }
+      if ( c == terminator ) {
+          break;
+      }
+      s += (char)c;
+  }
+  return String( s.c_str() );
+}
+
+size_t HostConsole::write(uint8_t c)
+{
+  if ( _out == NULL ) {
+      return 1;
+  }
+  return fputc( c, _out ) == EOF ? 0 : 1;
+}
+
+void HostConsole::flush()
+{
+  if ( _out != NULL ) {
+      fflush( _out );
+  }
+}
@@ -0,0 +1,137 @@
+/*
+ * Minimal Arduino core for building the rn2xx3 library on a Linux host.
+ *
+ * Only the parts the library and the host tools use are provided:
+ * Print, Stream, a small String, F()/PROGMEM, the timing functions, pins
+ * that go nowhere and the math macros.
+ */
+
+#ifndef host_Arduino_h
+#define host_Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+
+typedef uint8_t byte;
+
+/*
+ * Flash strings are ordinary strings on the host.
+ */
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+#define PROGMEM
+#define PSTR(s) (s)
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define pgm_read_ptr(p) (*(void * const *)(p))
+#define strlen_P strlen
+#define strncmp_P strncmp
+#define strcmp_P strcmp
+#define memcpy_P memcpy
+
+#define DEC 10
+#define HEX 16
+
+#define LOW 0
+#define HIGH 1
+#define INPUT 0
+#define OUTPUT 1
+
+#define PI 3.1415926535897932384626433832795
+#define TWO_PI 6.283185307179586476925286766559
+#define radians(deg) ((deg) * (PI / 180.0))
+#define degrees(rad) ((rad) * (180.0 / PI))
+#define sq(x) ((x) * (x))
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+/*
+ * With simulated time on, delay() and delayMicroseconds() move millis()
+ * and micros() forward instead of sleeping.
+ */
+void setSimulatedTime(bool on);
+void init();
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+class String
+{
+  public:
+    String(const char *s = "") : _s(s ? s : "") {}
+    const char *c_str() const { return _s.c_str(); }
+    unsigned int length() const { return _s.length(); }
+    long toInt() const { return atol(_s.c_str()); }
+    bool startsWith(const char *prefix) const { return _s.compare(0, strlen(prefix), prefix) == 0; }
+    void trim();
+
+  private:
+    std::string _s;
+};
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    virtual void flush() {}
+
+    size_t print(const __FlashStringHelper *s) { return write((const char *)s); }
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(double n, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+    template <typename T> size_t println(T v, int f) { size_t n = print(v, f); return n + println(); }
+};
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+
+    void setTimeout(unsigned long timeout) { _timeout = timeout; }
+    String readStringUntil(char terminator);
+
+  protected:
+    unsigned long _timeout = 1000;
+};
+
+/*
+ * The console. Writes to stdout, or nowhere after setOutput(NULL).
+ */
+class HostConsole : public Print
+{
+  public:
+    void begin(unsigned long) {}
+    void setOutput(FILE *out) { _out = out; }
+    size_t write(uint8_t c);
+    void flush();
+
+  private:
+    FILE *_out = stdout;
+};
+
+extern HostConsole Serial;
+
+#endif
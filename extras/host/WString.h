@@ -0,0 +1,5 @@
+/*
+ * String lives in Arduino.h on the host.
+ */
+
+#include "Arduino.h"
@@ -0,0 +1,71 @@
+/*
+ * Host stand-in for the Arduino Wire (I2C) library.
+ */
+
+#include "Wire.h"
+
+TwoWire Wire;
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  _txAddress = address & 0x7F;
+  _txLength = 0;
+}
+
+/*
+ * Returns 0 on success or 2 for a NACK on the address, like Wire does.
+ */
+uint8_t TwoWire::endTransmission(bool stopBit)
+{
+  (void)stopBit;
+  transfer( _txLength );
+  TwoWireDevice *device = _devices[_txAddress];
+  if ( device == NULL ) {
+      return 2;
+  }
+  if ( _txLength > 0 ) {
+      device->receive( _txBuffer, _txLength );
+  }
+  _txLength = 0;
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, size_t quantity, bool stopBit)
+{
+  (void)stopBit;
+  _rxIndex = 0;
+  _rxLength = 0;
+  TwoWireDevice *device = _devices[address & 0x7F];
+  if ( device == NULL ) {
+      transfer( 0 );
+      return 0;
+  }
+  if ( quantity > BUFFER_LENGTH ) {
+      quantity = BUFFER_LENGTH;
+  }
+  _rxLength = device->request( _rxBuffer, quantity );
+  transfer( _rxLength );
+  return _rxLength;
+}
+
+size_t TwoWire::write(uint8_t c)
+{
+  if ( _txLength >= BUFFER_LENGTH ) {
+      return 0;
+  }
+  _txBuffer[_txLength++] = c;
+  return 1;
+}
+
+/*
+ * A start, the address and the data bytes, each with its acknowledge bit,
+ * and a stop
+ */
+void TwoWire::transfer(size_t bytes)
+{
+  unsigned long bits = 1 + 9 * (1 + bytes) + 1;
+  unsigned long us = (bits * 1000000UL + _frequency - 1) / _frequency;
+  _transactions++;
+  _busMicros += us;
+  delayMicroseconds( us );
+}
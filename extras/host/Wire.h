@@ -0,0 +1,73 @@
+/*
+ * Host stand-in for the Arduino Wire (I2C) library.
+ *
+ * There is no bus: devices are objects attached at an address, which
+ * see what the master writes and answer its reads. Every transaction is
+ * counted and takes the time it would on the bus, through
+ * delayMicroseconds().
+ */
+
+#ifndef host_Wire_h
+#define host_Wire_h
+
+#include "Arduino.h"
+
+/*
+ * A device on the bus. receive() gets the bytes of one write transaction,
+ * request() fills a read transaction of up to size bytes and returns how
+ * many there are.
+ */
+class TwoWireDevice
+{
+  public:
+    virtual ~TwoWireDevice() {}
+
+    virtual void receive(const uint8_t *data, size_t size) { (void)data; (void)size; }
+    virtual size_t request(uint8_t *data, size_t size) = 0;
+};
+
+class TwoWire : public Stream
+{
+  public:
+    // The size of the SAMD core's buffers
+    static const size_t BUFFER_LENGTH = 256;
+
+    void begin() {}
+    void setClock(uint32_t frequency) { _frequency = frequency; }
+    void attach(uint8_t address, TwoWireDevice *device) { _devices[address & 0x7F] = device; }
+
+    void beginTransmission(uint8_t address);
+    uint8_t endTransmission(bool stopBit = true);
+    uint8_t requestFrom(uint8_t address, size_t quantity, bool stopBit = true);
+
+    size_t write(uint8_t c);
+    using Print::write;
+    int available() { return _rxLength - _rxIndex; }
+    int read() { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex++] : -1; }
+    int peek() { return _rxIndex < _rxLength ? _rxBuffer[_rxIndex] : -1; }
+
+    // Transactions so far and the bus time they took
+    unsigned long transactions() const { return _transactions; }
+    unsigned long busMicros() const { return _busMicros; }
+
+  private:
+    void transfer(size_t bytes);
+
+    uint32_t _frequency = 100000;
+    unsigned long _transactions = 0;
+    unsigned long _busMicros = 0;
+
+    TwoWireDevice *_devices[128] = {};
+
+    uint8_t _txAddress = 0;
+    uint8_t _txBuffer[BUFFER_LENGTH];
+    size_t _txLength = 0;
+
+    uint8_t _rxBuffer[BUFFER_LENGTH];
+    size_t _rxLength = 0;
+    size_t _rxIndex = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,262 @@
+/*
+ * Accuracy and cycle count of the TheThingsUno mapper's coordinate
+ * encoding, MapperPayload.h against the float formula it replaced.
+ *
+ * Usage: mapper_payload_bench [log]
+ *   log  NMEA output of a receiver (default nmea/ublox7.nmea)
+ *
+ * The positions TinyGPS++ parses from the log, the ends of the ranges,
+ * random positions and the positions on either side of every step of both
+ * fields are encoded three ways: integer only, the
+ * old formula in float, which is what double is on the AVR, and the old
+ * formula in double. Each is checked against the exact value, and the
+ * exact value against the javascript decoder.
+ *
+ * Cycles are counted with the time stamp counter where there is one. They
+ * are host cycles: the float formula runs on the FPU here, where the AVR
+ * calls the soft-float library for each operation.
+ */
+
+#include "Arduino.h"
+#include "TinyGPS++.h"
+#include "MapperPayload.h"
+
+#include <string>
+#include <vector>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CYCLES "cycles"
+#else
+#define CYCLES "ns"
+#endif
+
+static const uint32_t fieldMax = 16777215;
+
+static uint64_t cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/*
+ * A coordinate and its range, 90 for latitude and 180 for longitude
+ */
+struct coordinate
+{
+  RawDegrees raw;
+  uint16_t offset;
+};
+
+static coordinate fromBillionths(uint64_t above, uint16_t offset)
+{
+  coordinate c;
+  uint64_t half = offset * 1000000000ULL;
+  uint64_t degrees = above >= half ? above - half : half - above;
+  c.raw.negative = above < half;
+  c.raw.deg = degrees / 1000000000;
+  c.raw.billionths = degrees % 1000000000;
+  c.offset = offset;
+  return c;
+}
+
+static uint32_t encodeInteger(const coordinate &c)
+{
+  return c.offset == 90 ? latitudeBinary( c.raw ) : longitudeBinary( c.raw );
+}
+
+/*
+ * The old build_packet(), on TinyGPSLocation::lat() and lng()
+ */
+static uint32_t encodeFloat(const coordinate &c)
+{
+  float degrees = c.raw.deg + c.raw.billionths / 1000000000.0f;
+  if ( c.raw.negative ) {
+      degrees = -degrees;
+  }
+  return ( ( degrees + c.offset ) / ( 2 * c.offset ) ) * 16777215.0f;
+}
+
+static uint32_t encodeDouble(const coordinate &c)
+{
+  double degrees = c.raw.deg + c.raw.billionths / 1000000000.0;
+  if ( c.raw.negative ) {
+      degrees = -degrees;
+  }
+  return ( ( degrees + c.offset ) / ( 2 * c.offset ) ) * 16777215.0;
+}
+
+static uint32_t encodeExact(const coordinate &c)
+{
+  unsigned __int128 above = billionthsAbove( c.raw, c.offset );
+  return above * fieldMax / ( 2 * c.offset * 1000000000ULL );
+}
+
+/*
+ * decoded.lat = (decoded.lat / 16777215.0 * 180) - 90 and the same for
+ * lon, the value must decode to within one step below the position. The
+ * margin is a tenth of the billionths TinyGPS++ resolves, far above the
+ * rounding of the doubles.
+ */
+static bool decodes(const coordinate &c, uint32_t value)
+{
+  double position = (double)billionthsAbove( c.raw, c.offset ) / 1000000000.0 - c.offset;
+  double decoded = ( value / 16777215.0 * ( 2 * c.offset ) ) - c.offset;
+  double step = 2.0 * c.offset / fieldMax;
+  double margin = 1e-10;
+  return decoded <= position + margin && ( value == fieldMax || position < decoded + step + margin );
+}
+
+/*
+ * Positions from the log, parsed by TinyGPS++ as in the sketch
+ */
+static void logPositions(const char *path, std::vector<coordinate> &out)
+{
+  FILE *f = fopen( path, "rb" );
+  if ( f == NULL ) {
+      perror( path );
+      exit( 2 );
+  }
+  TinyGPSPlus gps;
+  int ch;
+  while ( ( ch = fgetc( f ) ) != EOF ) {
+      if ( gps.encode( ch ) && gps.location.isUpdated() && gps.location.isValid() ) {
+          coordinate c;
+          c.raw = gps.location.rawLat();
+          c.offset = 90;
+          out.push_back( c );
+          c.raw = gps.location.rawLng();
+          c.offset = 180;
+          out.push_back( c );
+      }
+  }
+  fclose( f );
+}
+
+static uint64_t xorshift(uint64_t &state)
+{
+  state ^= state << 13;
+  state ^= state >> 7;
+  state ^= state << 17;
+  return state;
+}
+
+struct check
+{
+  size_t integer, floating, doubles, decoder;
+  uint32_t floatWorst;
+
+  check() : integer( 0 ), floating( 0 ), doubles( 0 ), decoder( 0 ), floatWorst( 0 ) {}
+
+  void add(const coordinate &c)
+  {
+    uint32_t exact = encodeExact( c );
+    uint32_t f = encodeFloat( c );
+    integer += encodeInteger( c ) != exact;
+    floating += f != exact;
+    doubles += encodeDouble( c ) != exact;
+    decoder += !decodes( c, exact );
+    uint32_t error = f > exact ? f - exact : exact - f;
+    if ( error > floatWorst ) {
+        floatWorst = error;
+    }
+  }
+};
+
+static void printCheck(const char *name, size_t count, const check &r)
+{
+  printf( "%-22s %9zu %9zu %9zu %9zu %7u %9zu\n", name, count, r.integer, r.floating, r.doubles,
+          r.floatWorst, r.decoder );
+}
+
+template<class encoder>
+static double cyclesPer(const std::vector<coordinate> &in, encoder encode)
+{
+  volatile uint32_t sink = 0;
+  uint64_t best = ~0ULL;
+  for ( int round = 0; round < 5; round++ ) {
+      uint32_t sum = 0;
+      uint64_t start = cycles();
+      for ( size_t i = 0; i < in.size(); i++ ) {
+          sum += encode( in[i] );
+      }
+      uint64_t spent = cycles() - start;
+      sink = sink + sum;
+      if ( spent < best ) {
+          best = spent;
+      }
+  }
+  return (double)best / in.size();
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = argc > 1 ? argv[1] : "nmea/ublox7.nmea";
+
+  std::vector<coordinate> logged;
+  logPositions( path, logged );
+
+  std::vector<coordinate> ends;
+  uint16_t offsets[] = { 90, 180 };
+  for ( int i = 0; i < 2; i++ ) {
+      uint64_t span = 2 * offsets[i] * 1000000000ULL;
+      uint64_t points[] = { 0, 1, span / 2 - 1, span / 2, span / 2 + 1, span - 1, span };
+      for ( size_t j = 0; j < sizeof( points ) / sizeof( points[0] ); j++ ) {
+          ends.push_back( fromBillionths( points[j], offsets[i] ) );
+      }
+  }
+
+  uint64_t state = 0x2545F4914F6CDD1DULL;
+  std::vector<coordinate> random;
+  for ( int i = 0; i < 1000000; i++ ) {
+      uint16_t offset = offsets[i & 1];
+      random.push_back( fromBillionths( xorshift( state ) % ( 2 * offset * 1000000000ULL + 1 ), offset ) );
+  }
+
+  printf( "%s: %zu positions\n\n", path, logged.size() / 2 );
+  printf( "coordinates that differ from the exact field value:\n" );
+  printf( "%-22s %9s %9s %9s %9s %7s %9s\n", "", "count", "integer", "float", "double", "worst",
+          "decoder" );
+  check l, e, r, s;
+  for ( size_t i = 0; i < logged.size(); i++ ) {
+      l.add( logged[i] );
+  }
+  for ( size_t i = 0; i < ends.size(); i++ ) {
+      e.add( ends[i] );
+  }
+  for ( size_t i = 0; i < random.size(); i++ ) {
+      r.add( random[i] );
+  }
+  // the first position of each value and the last one of the value before
+  for ( int i = 0; i < 2; i++ ) {
+      uint64_t span = 2 * offsets[i] * 1000000000ULL;
+      for ( uint64_t value = 1; value <= fieldMax; value++ ) {
+          uint64_t first = ( value * span + fieldMax - 1 ) / fieldMax;
+          s.add( fromBillionths( first - 1, offsets[i] ) );
+          s.add( fromBillionths( first, offsets[i] ) );
+      }
+  }
+  printCheck( "log", logged.size(), l );
+  printCheck( "ends of the range", ends.size(), e );
+  printCheck( "random", random.size(), r );
+  printCheck( "either side of a step", 4 * (size_t)fieldMax, s );
+  printf( "(worst: largest float error in steps of the field, decoder: exact values the javascript\n"
+          " decoder does not turn back into the position)\n" );
+
+  printf( "\n" CYCLES " per coordinate:\n" );
+  double fc = cyclesPer( random, encodeFloat );
+  double dc = cyclesPer( random, encodeDouble );
+  double ic = cyclesPer( random, encodeInteger );
+  printf( "%-22s %8.1f\n", "float formula", fc );
+  printf( "%-22s %8.1f\n", "double formula", dc );
+  printf( "%-22s %8.1f\n", "integer", ic );
+  printf( "host FPU; on the AVR each float operation is a soft-float call\n" );
+
+  return l.integer + e.integer + r.integer + s.integer + l.decoder + e.decoder + r.decoder + s.decoder
+         ? 1 : 0;
+}
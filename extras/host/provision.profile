@@ -0,0 +1,5 @@
+# Settings for rn2xx3_provision, see the top of rn2xx3_provision.cpp
+appeui=70B3D57ED00001A6
+appkey=random
+deveui=hweui
+plan=TTN_EU
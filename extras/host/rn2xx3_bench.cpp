@@ -0,0 +1,738 @@
+/*
+ * Latency benchmark of the rn2xx3 library against the module emulator.
+ *
+ * Usage: rn2xx3_bench [-v] [-r]
+ *   -v  show the library's debug output
+ *   -r  run on the wall clock instead of the simulated clock
+ *
+ * Every line reports the time as seen by the library (simulated or real)
+ * and the wall time it took to get there.
+ */
+
+#include "Arduino.h"
+#include "rn2xx3.h"
+#include "rn2xx3_emulator.h"
+#include "rn2xx3_sim_clock.h"
+
+#include <algorithm>
+#include <new>
+#include <vector>
+
+static bool realTime = false;
+static bool verbose = false;
+// Checks that printed FAILED, for the exit status
+static int failures = 0;
+
+/*
+ * " (FAILED)" and one failure more, or "" if the check passed
+ */
+static const char *failedIf(bool failed)
+{
+  failures += failed;
+  return failed ? " (FAILED)" : "";
+}
+
+struct bench
+{
+  rn2xx3_sim_clock simClock;
+  rn2xx3_clock wallClock;
+  rn2xx3_clock *clock;
+  rn2xx3_emulator module;
+  rn2xx3 lora;
+
+  unsigned long start;
+  unsigned long wallStart;
+
+  bench(RN2xx3_t type = RN2483)
+    : clock(realTime ? &wallClock : &simClock),
+      module(type, 57600, clock),
+      lora(&module, clock)
+  {
+    if ( verbose ) {
+        lora.setDebugOutput( &Serial );
+    }
+  }
+
+  void begin()
+  {
+    start = clock->micros();
+    wallStart = ::micros();
+  }
+
+  void report(const char *name)
+  {
+    failures += strstr( name, "FAILED" ) != NULL;
+    printf( "%-40s %10.1f ms %10.3f ms wall\n", name,
+            ( clock->micros() - start ) / 1000.0, ( ::micros() - wallStart ) / 1000.0 );
+  }
+};
+
+static const char *outcome(TX_RETURN_TYPE rv)
+{
+  switch ( rv ) {
+    case TX_SUCCESS: return "TX_SUCCESS";
+    case TX_WITH_RX: return "TX_WITH_RX";
+    case TX_NO_FREE_CH: return "TX_NO_FREE_CH";
+    default: return "TX_FAIL";
+  }
+}
+
+static void benchFrequencyPlan(unsigned long gap)
+{
+  bench b;
+  b.lora.setCommandGap( gap );
+
+  b.begin();
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  b.lora.setFrequencyPlan( TTN_EU );
+  char name[48];
+  snprintf( name, sizeof( name ), "initOTAA + TTN_EU plan, %lums gap", gap );
+  b.report( name );
+}
+
+static void benchRetryStorm(const char *reply, unsigned count)
+{
+  bench b;
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  b.module.failNextTx( reply, count );
+
+  b.begin();
+  TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+  char name[48];
+  snprintf( name, sizeof( name ), "%u x %s -> %s", count, reply, outcome( rv ) );
+  b.report( name );
+}
+
+// The network moves the module to another data rate with a MAC command;
+// setDR() must not take the old one as still in effect
+static void benchNetworkDr()
+{
+  bench b;
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  b.lora.setDR( 5 );
+  b.module.queueLinkAdr( 0 );
+  b.lora.txUncnf( "Hello" );
+
+  b.begin();
+  b.lora.setDR( 5 );
+  b.report( b.module.dr() == 5 ? "setDR(5) after LinkADRReq to DR0" : "setDR(5) after LinkADRReq to DR0 (FAILED)" );
+}
+
+// A raw mac tx from commandBegin(), as the fleet sends them, gets the
+// retries and the duty cycle booking of txBegin()
+static void benchRawTx()
+{
+  bench b;
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  b.module.failNextTx( "busy", 2 );
+
+  b.begin();
+  int done = 0;
+  for ( int i = 0; i < 3; i++ ) {
+      b.lora.commandBegin( "mac tx uncnf 1 48656C6C6F" );
+      while ( b.lora.poll() != TX_DONE ) {
+          b.clock->idle();
+      }
+      done += b.lora.txResult() == TX_SUCCESS && strcmp( b.lora.reply(), "mac_tx_ok" ) == 0;
+  }
+  unsigned long wait = b.lora.nextTxAllowedAt() - b.clock->millis();
+  b.report( done == 3 && wait > 0 ? "3 x commandBegin(mac tx), 2 x busy" : "3 x commandBegin(mac tx), 2 x busy (FAILED)" );
+  printf( "%-40s %7lu ms\n", "  duty cycle wait", wait );
+}
+
+static void benchWarmStart()
+{
+  bench b;
+  // Let the power-on banner arrive before the library drains the port
+  b.clock->delay( 100 );
+
+  b.begin();
+  bool ok = b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+  b.report( ok && rv == TX_SUCCESS ? "cold boot to first uplink" : "cold boot to first uplink (FAILED)" );
+  unsigned long saves = b.module.saveCount();
+
+  // Only the host restarts, the module stays joined
+  b.begin();
+  ok = b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  rv = b.lora.txUncnf( "Hello" );
+  b.report( ok && rv == TX_SUCCESS ? "host reset to first uplink" : "host reset to first uplink (FAILED)" );
+
+  // Both restart, the module restores its EEPROM
+  b.module.reset();
+  b.clock->delay( 100 );
+  b.begin();
+  ok = b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  rv = b.lora.txUncnf( "Hello" );
+  b.report( ok && rv == TX_SUCCESS && b.module.replayCount() == 0 ? "power cycle to first uplink"
+                                                                 : "power cycle to first uplink (FAILED)" );
+
+  // Power cycle again after uplinks that were never saved
+  for ( int i = 0; i < 5; i++ ) {
+      b.lora.txUncnf( "Hello" );
+  }
+  b.module.reset();
+  b.clock->delay( 100 );
+  b.begin();
+  ok = b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  rv = b.lora.txUncnf( "Hello" );
+  b.report( ok && rv == TX_SUCCESS && b.module.replayCount() == 0 ? "power cycle, 5 unsaved uplinks"
+                                                                 : "power cycle, 5 unsaved uplinks (FAILED)" );
+
+  printf( "%-40s %10lu\n", "  mac save on warm boots", b.module.saveCount() - saves );
+  printf( "%-40s %10lu\n", "  uplinks dropped as replays", b.module.replayCount() );
+
+  // Reflashed with a new AppKey: the saved session must not be used
+  unsigned long joins = b.module.joinCount();
+  b.module.reset();
+  b.clock->delay( 100 );
+  b.begin();
+  ok = b.lora.initOTAA( "70B3D57ED00001A6", "B23C96EE13804963F8C2BD6285448198" );
+  b.report( ok && b.module.joinCount() > joins ? "power cycle, new AppKey, join"
+                                               : "power cycle, new AppKey, join (FAILED)" );
+}
+
+static void benchABP()
+{
+  bench b;
+  // Let the power-on banner arrive before the library drains the port
+  b.clock->delay( 100 );
+
+  b.begin();
+  bool ok = b.lora.initABP( "02017201", "8D7FFEF938589D95AAD928C2E2E7E48F", "AE17E567AECC8787F749A62F5541D522" );
+  b.report( ok ? "initABP" : "initABP (FAILED)" );
+  printf( "%-40s %10lu\n", "  commands sent", b.module.commandCount() );
+
+  b.begin();
+  TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+  b.report( rv == TX_SUCCESS ? "first uplink after initABP" : "first uplink after initABP (FAILED)" );
+
+  // Both restart after uplinks that were never saved
+  for ( int i = 0; i < 5; i++ ) {
+      b.lora.txUncnf( "Hello" );
+  }
+  unsigned long saves = b.module.saveCount();
+  b.module.reset();
+  b.clock->delay( 100 );
+  b.begin();
+  rn2xx3 host( &b.module, b.clock );
+  ok = host.initABP( "02017201", "8D7FFEF938589D95AAD928C2E2E7E48F", "AE17E567AECC8787F749A62F5541D522" );
+  rv = host.txUncnf( "Hello" );
+  b.report( ok && rv == TX_SUCCESS && b.module.replayCount() == 0
+            ? "initABP after power cycle, first uplink" : "initABP after power cycle (FAILED)" );
+  printf( "%-40s %10lu\n", "  mac save", b.module.saveCount() - saves );
+  printf( "%-40s %10lu\n", "  uplinks dropped as replays", b.module.replayCount() );
+
+  // The duty cycle ledger must be set up for the module on a resume too:
+  // the three default channels are in their off-time now
+  host.txUncnf( "Hello" );
+  host.txUncnf( "Hello" );
+  unsigned long wait = host.nextTxAllowedAt() - b.clock->millis();
+  printf( "%-40s %7lu ms%s\n", "  duty cycle wait after 3 uplinks", wait, failedIf( wait == 0 ) );
+}
+
+// Time to ready of autobaud() right after power-on, for boot times
+// spread evenly over 0..maxBoot ms
+static void benchAutobaud(RN2xx3_t type, unsigned long maxBoot)
+{
+  const int trials = 51;
+  std::vector<double> ms;
+  int failed = 0;
+
+  for ( int i = 0; i < trials; i++ ) {
+      bench b( type );
+      b.module.reset( maxBoot * i / ( trials - 1 ) );
+      b.begin();
+      if ( !b.lora.autobaud() || b.lora.moduleType() != type ) {
+          failed++;
+      }
+      ms.push_back( ( b.clock->micros() - b.start ) / 1000.0 );
+  }
+  std::sort( ms.begin(), ms.end() );
+
+  char name[48];
+  snprintf( name, sizeof( name ), "autobaud %s, boot 0-%lums", type == RN2903 ? "RN2903" : "RN2483", maxBoot );
+  printf( "%-40s %7.1f / %.1f / %.1f / %.1f ms (min/median/p90/max)%s\n", name,
+          ms[0], ms[trials / 2], ms[trials * 9 / 10], ms[trials - 1], failedIf( failed > 0 ) );
+}
+
+static void benchWake()
+{
+  bench b;
+  b.clock->delay( 100 );
+  b.lora.autobaud();
+
+  b.lora.sleep( 60000 );
+  b.clock->delay( 1000 );
+  b.begin();
+  bool ok = b.lora.autobaud();
+  b.report( ok ? "autobaud to wake from sleep()" : "autobaud to wake from sleep() (FAILED)" );
+}
+
+static rn2xx3_emulator *baudModule;
+
+static void emulatorBaud(unsigned long baud)
+{
+  baudModule->setHostBaud( baud );
+}
+
+// Configuration and tx-path timings after moving the UART from one rate
+// to baud
+static void benchBaud(unsigned long from, unsigned long baud, unsigned long maxBaud)
+{
+  bench b;
+  b.clock->delay( 100 );
+  b.module.setHostBaud( from );
+  b.lora.autobaud();
+  b.module.setMaxBaud( maxBaud );
+  baudModule = &b.module;
+
+  char name[48];
+  b.begin();
+  bool ok = baud == from || b.lora.setBaud( from, baud, emulatorBaud );
+  snprintf( name, sizeof( name ), "setBaud %lu->%lu, module max %lu", from, baud, maxBaud );
+  b.report( ok == ( baud <= maxBaud ) ? name : strcat( name, " (FAILED)" ) );
+  printf( "%-40s %10lu / %lu%s\n", "  library / module baud", b.lora.baud(), b.module.baud(),
+          failedIf( b.lora.baud() != b.module.baud() || b.module.baud() != ( ok ? baud : from ) ) );
+
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+
+  b.begin();
+  ok = b.lora.setFrequencyPlan( TTN_EU );
+  snprintf( name, sizeof( name ), "  setFrequencyPlan(TTN_EU) at %lu", b.lora.baud() );
+  b.report( ok ? name : strcat( name, " (FAILED)" ) );
+
+  byte payload[51];
+  memset( payload, 0xA5, sizeof( payload ) );
+  b.begin();
+  b.lora.txBegin( "mac tx uncnf 1 ", payload, sizeof( payload ), false );
+  TX_STATE state;
+  while ( ( state = b.lora.poll() ) == TX_WAIT_AR || state == TX_WAIT_OK ) {
+      b.clock->idle();
+  }
+  snprintf( name, sizeof( name ), "  51-byte mac tx until ok at %lu", b.lora.baud() );
+  b.report( state == TX_WAIT_UPLINK ? name : strcat( name, " (FAILED)" ) );
+  while ( b.lora.poll() != TX_DONE ) {
+      b.clock->idle();
+  }
+}
+
+static void printStats(const rn2xx3_stats &stats)
+{
+  static const char *classes[RN_CMD_CLASS_COUNT] = { "sys", "mac set", "mac tx", "join", "other" };
+  static const char *replies[RN_RESPONSE_COUNT] = {
+    "unknown", "ok", "accepted", "denied", "busy", "invalid_param", "invalid_data_len",
+    "keys_not_init", "not_joined", "no_free_ch", "silent", "frame_counter_err",
+    "mac_tx_ok", "mac_rx", "mac_err", "mac_paused", "radio_tx_ok", "radio_rx",
+    "radio_err", "timeout"
+  };
+
+  printf( "%-10s %6s %10s %10s  histogram (ms:", "command", "count", "avg ms", "max ms" );
+  for ( uint8_t b = 0; b < RN2XX3_LATENCY_BUCKETS; b++ ) {
+      unsigned long limit = rn2xx3_stats::bucketLimit( b );
+      if ( limit ) {
+          printf( " <%lu", limit );
+      } else {
+          printf( " more" );
+      }
+  }
+  printf( ")\n" );
+  for ( uint8_t c = 0; c < RN_CMD_CLASS_COUNT; c++ ) {
+      const rn2xx3_command_stats &s = stats.commands( (RN_COMMAND_CLASS)c );
+      printf( "%-10s %6u %10.1f %10lu ", classes[c], s.count,
+              s.count ? (double)s.totalMillis / s.count : 0.0, (unsigned long)s.maxMillis );
+      for ( uint8_t b = 0; b < RN2XX3_LATENCY_BUCKETS; b++ ) {
+          printf( " %u", s.histogram[b] );
+      }
+      printf( "\n" );
+  }
+  printf( "replies:" );
+  for ( uint8_t r = 0; r < RN_RESPONSE_COUNT; r++ ) {
+      if ( stats.replies( (RN_RESPONSE)r ) ) {
+          printf( " %s %u", replies[r], stats.replies( (RN_RESPONSE)r ) );
+      }
+  }
+  printf( "\n" );
+}
+
+/*
+ * A hardware serial console at 57600 baud with the 64 byte transmit buffer
+ * of the AVR core: a write blocks the caller once the buffer is full.
+ * The output itself is dropped.
+ */
+class console_port : public Print
+{
+  public:
+    console_port(rn2xx3_sim_clock &clock) : _clock(clock), _freeAt(0) {}
+
+    size_t write(uint8_t)
+    {
+      const uint64_t byteMicros = 10 * 1000000ULL / 57600;
+      uint64_t now = _clock.micros();
+      if ( _freeAt < now ) {
+          _freeAt = now;
+      }
+      if ( _freeAt - now >= 64 * byteMicros ) {
+          _clock.advance( _freeAt - now - 63 * byteMicros );
+      }
+      _freeAt += byteMicros;
+      return 1;
+    }
+
+  private:
+    rn2xx3_sim_clock &_clock;
+    uint64_t _freeAt;
+};
+
+// What printing the tracing to a console costs the caller
+static void benchDebugOutput(bool console)
+{
+  bench b;
+  console_port port( b.simClock );
+  if ( console ) {
+      b.lora.setDebugOutput( &port );
+  }
+  const char *how = console ? "console" : "no output";
+  char name[48];
+
+  b.begin();
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  b.lora.setFrequencyPlan( TTN_EU );
+  snprintf( name, sizeof( name ), "initOTAA + TTN_EU plan, %s", how );
+  b.report( name );
+
+  b.begin();
+  b.lora.txUncnf( "Hello" );
+  snprintf( name, sizeof( name ), "txUncnf 5 bytes, %s", how );
+  b.report( name );
+}
+
+// Uplinks at SF12 back to back, or paced by nextTxAllowedAt()
+static void benchDutyCycle(bool paced)
+{
+  bench b;
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  b.lora.setFrequencyPlan( TTN_EU );
+  b.lora.setDR( 0 );
+
+  unsigned sent = 0;
+  unsigned refused = 0;
+  b.begin();
+  while ( sent < 10 ) {
+      if ( paced ) {
+          unsigned long at = b.lora.nextTxAllowedAt();
+          while ( (long)( at - b.clock->millis() ) > 0 ) {
+              b.clock->idle();
+          }
+      }
+      TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+      if ( rv == TX_SUCCESS ) {
+          sent++;
+      } else {
+          refused++;
+      }
+  }
+  char name[48];
+  snprintf( name, sizeof( name ), "10 uplinks at SF12, %s", paced ? "paced" : "back to back" );
+  b.report( name );
+  printf( "%-40s %10u\n", "  refused with no_free_ch", refused );
+}
+
+static rn2xx3_clock *handlerClock;
+static unsigned long handlerMicros;
+static uint8_t handlerLength;
+
+static void downlinkHandler(uint8_t port, const byte *data, uint8_t length)
+{
+  handlerMicros = handlerClock->micros();
+  handlerLength = length;
+}
+
+// From the end of the mac_rx line on the UART to the port handler, on the
+// wall clock only
+static void benchDownlink(uint8_t length)
+{
+  bench b;
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  handlerClock = b.clock;
+  handlerLength = 0;
+  b.lora.onReceive( 2, downlinkHandler );
+
+  std::string hex;
+  for ( uint8_t i = 0; i < length; i++ ) {
+      char digits[3];
+      snprintf( digits, sizeof( digits ), "%02X", i );
+      hex += digits;
+  }
+  b.module.queueDownlink( 2, hex.c_str() );
+
+  TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+  char name[48];
+  snprintf( name, sizeof( name ), "downlink %u bytes, line to handler", length );
+  printf( "%-40s %10.1f us%s\n", name, (double)( handlerMicros - b.module.lineEndAt() ),
+          failedIf( rv != TX_WITH_RX || handlerLength != length ) );
+}
+
+// A downlink longer than the line buffer holds must be dropped, not cut
+// short, whatever buffer it is decoded into
+static void benchLongDownlink(uint8_t port, uint8_t length, uint8_t bufferSize)
+{
+  bench b;
+  b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  handlerClock = b.clock;
+  handlerLength = 0;
+  b.lora.onReceive( 0, downlinkHandler );
+  byte buffer[255];
+  if ( bufferSize != RN2XX3_MAX_DOWNLINK ) {
+      b.lora.setRxBuffer( buffer, bufferSize );
+  }
+
+  std::string hex( 2 * length, 'A' );
+  b.module.queueDownlink( port, hex.c_str() );
+
+  b.begin();
+  TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+  char name[48];
+  snprintf( name, sizeof( name ), "downlink of %u, port %u, buffer %u", length, port, bufferSize );
+  b.report( rv == TX_WITH_RX && b.lora.getRxLength() == 0 && handlerLength == 0 ? name
+                                                                                  : strcat( name, " (FAILED)" ) );
+}
+
+// A downlink that fills the internal buffer is still NUL terminated for
+// getRx(), in an instance made on memory that was not zeroed
+static void benchFullDownlink()
+{
+  bench b;
+  static unsigned char storage[sizeof( rn2xx3 )] __attribute__(( aligned( 8 ) ));
+  memset( storage, 'x', sizeof( storage ) );
+  rn2xx3 *lora = new ( storage ) rn2xx3( &b.module, b.clock );
+  lora->initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+
+  std::string hex;
+  for ( uint8_t i = 0; i < RN2XX3_MAX_DOWNLINK; i++ ) {
+      hex += "41";
+  }
+  b.module.queueDownlink( 1, hex.c_str() );
+
+  b.begin();
+  TX_RETURN_TYPE rv = lora->txUncnf( "Hello" );
+  char name[48];
+  snprintf( name, sizeof( name ), "downlink of %u, getRx()", RN2XX3_MAX_DOWNLINK );
+  b.report( rv == TX_WITH_RX && strlen( lora->getRx() ) == RN2XX3_MAX_DOWNLINK ? name : strcat( name, " (FAILED)" ) );
+  lora->~rn2xx3();
+}
+
+static void benchHexDecoder()
+{
+  const char *line = "000102030405060708090A0B0C0D0E0F101112131415161718191A1B1C1D1E1F";
+  byte payload[32];
+  const long rounds = 1000000;
+  volatile int sink = 0;
+
+  unsigned long start = ::micros();
+  for ( long r = 0; r < rounds; r++ ) {
+      sink += rn2xx3_read_hex( line, payload, sizeof( payload ) );
+  }
+  unsigned long elapsed = ::micros() - start;
+
+  printf( "%-40s %10.1f ns/byte\n", "hex decode, rn2xx3_read_hex()",
+          elapsed * 1000.0 / rounds / sizeof( payload ) );
+}
+
+// The strncmp() chain txCommand() used before rn2xx3_classify()
+static int legacyClassify(const char *r)
+{
+  if ( strncmp( r, "ok", 2 ) == 0 ) return 1;
+  if ( strncmp( r, "invalid_param", 13 ) == 0 ) return 2;
+  if ( strncmp( r, "not_joined", 10 ) == 0 ) return 3;
+  if ( strncmp( r, "no_free_ch", 10 ) == 0 ) return 4;
+  if ( strncmp( r, "silent", 6 ) == 0 ) return 5;
+  if ( strncmp( r, "frame_counter_err_rejoin_needed", 31 ) == 0 ) return 6;
+  if ( strncmp( r, "busy", 4 ) == 0 ) return 7;
+  if ( strncmp( r, "mac_paused", 10 ) == 0 ) return 8;
+  if ( strncmp( r, "invalid_data_len", 16 ) == 0 ) return 9;
+  if ( strncmp( r, "mac_tx_ok", 9 ) == 0 ) return 10;
+  if ( strncmp( r, "mac_rx", 6 ) == 0 ) return 11;
+  if ( strncmp( r, "mac_err", 7 ) == 0 ) return 12;
+  if ( strncmp( r, "radio_tx_ok", 11 ) == 0 ) return 13;
+  if ( strncmp( r, "radio_err", 9 ) == 0 ) return 14;
+  return 0;
+}
+
+static void benchClassifier()
+{
+  static const char *lines[] = {
+    "ok", "mac_tx_ok", "mac_rx 1 0102", "busy", "no_free_ch", "mac_err",
+    "invalid_param", "radio_err", "frame_counter_err_rejoin_needed", "RN2483 1.0.4"
+  };
+  const int n = sizeof( lines ) / sizeof( lines[0] );
+  const long rounds = 1000000;
+  volatile int sink = 0;
+
+  unsigned long start = ::micros();
+  for ( long r = 0; r < rounds; r++ ) {
+      sink += legacyClassify( lines[r % n] );
+  }
+  unsigned long legacy = ::micros() - start;
+
+  start = ::micros();
+  for ( long r = 0; r < rounds; r++ ) {
+      sink += rn2xx3_classify( lines[r % n] );
+  }
+  unsigned long table = ::micros() - start;
+
+  printf( "%-40s %10.1f ns/line\n", "classify, strncmp chain", legacy * 1000.0 / rounds );
+  printf( "%-40s %10.1f ns/line\n", "classify, rn2xx3_classify()", table * 1000.0 / rounds );
+}
+
+// Counts what would have gone out on the serial port
+class null_port : public Print
+{
+  public:
+    size_t count = 0;
+    size_t write(uint8_t) { count++; return 1; }
+    size_t write(const uint8_t *, size_t size) { count += size; return size; }
+};
+
+// The sprintf() loop txBytes() used before rn2xx3_write_hex()
+static void legacyHex(Print &out, const byte *data, uint8_t size)
+{
+  char msgBuffer[size*2 + 1];
+  char buffer[3];
+  for (unsigned i=0; i<size; i++)
+  {
+    sprintf(buffer, "%02X", data[i]);
+    memcpy(&msgBuffer[i*2], &buffer, sizeof(buffer));
+  }
+  out.print(msgBuffer);
+}
+
+static void benchHexEncoder()
+{
+  byte payload[51];
+  for ( unsigned i = 0; i < sizeof( payload ); i++ ) {
+      payload[i] = i * 37;
+  }
+  const long rounds = 200000;
+  null_port port;
+
+  unsigned long start = ::micros();
+  for ( long r = 0; r < rounds; r++ ) {
+      legacyHex( port, payload, sizeof( payload ) );
+  }
+  unsigned long legacy = ::micros() - start;
+
+  start = ::micros();
+  for ( long r = 0; r < rounds; r++ ) {
+      rn2xx3_write_hex( port, payload, sizeof( payload ) );
+  }
+  unsigned long table = ::micros() - start;
+
+  printf( "%-40s %10.1f ns/byte\n", "hex encode, sprintf()",
+          legacy * 1000.0 / rounds / sizeof( payload ) );
+  printf( "%-40s %10.1f ns/byte\n", "hex encode, rn2xx3_write_hex()",
+          table * 1000.0 / rounds / sizeof( payload ) );
+}
+
+int main(int argc, char **argv)
+{
+  for ( int i = 1; i < argc; i++ ) {
+      if ( strcmp( argv[i], "-v" ) == 0 ) {
+          verbose = true;
+      } else if ( strcmp( argv[i], "-r" ) == 0 ) {
+          realTime = true;
+      }
+  }
+  bench b;
+
+  b.begin();
+  bool ok = b.lora.autobaud();
+  b.report( ok ? "autobaud" : "autobaud (FAILED)" );
+
+  b.begin();
+  ok = b.lora.initOTAA( "70B3D57ED00001A6", "A23C96EE13804963F8C2BD6285448198" );
+  b.report( ok ? "initOTAA (join)" : "initOTAA (join FAILED)" );
+
+  b.begin();
+  b.lora.setFrequencyPlan( TTN_EU );
+  b.report( "setFrequencyPlan(TTN_EU)" );
+
+  unsigned long commands = b.module.commandCount();
+  b.begin();
+  b.lora.setFrequencyPlan( TTN_EU );
+  b.report( "setFrequencyPlan(TTN_EU) again, cached" );
+  printf( "%-40s %10lu\n", "  commands sent", b.module.commandCount() - commands );
+
+  for ( int i = 0; i < 3; i++ ) {
+      b.begin();
+      TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+      b.report( rv == TX_SUCCESS ? "txUncnf 5 bytes" : "txUncnf 5 bytes (FAILED)" );
+  }
+
+  b.module.queueDownlink( 1, "0102" );
+  b.begin();
+  TX_RETURN_TYPE rv = b.lora.txUncnf( "Hello" );
+  b.report( rv == TX_WITH_RX ? "txUncnf with downlink" : "txUncnf with downlink (FAILED)" );
+
+  printf( "%-40s %10lu\n", "commands seen by the module", b.module.commandCount() );
+  printStats( b.lora.stats() );
+
+  benchFrequencyPlan( 100 );
+  benchFrequencyPlan( 0 );
+
+  benchNetworkDr();
+  benchRawTx();
+  benchWarmStart();
+
+  if ( !realTime ) {
+      benchAutobaud( RN2483, 0 );
+      benchAutobaud( RN2483, 500 );
+      benchAutobaud( RN2903, 500 );
+  }
+  benchWake();
+
+  benchBaud( 57600, 57600, 230400 );
+  benchBaud( 57600, 115200, 230400 );
+  benchBaud( 57600, 230400, 230400 );
+  benchBaud( 57600, 230400, 115200 );
+  benchBaud( 9600, 230400, 115200 );
+  benchABP();
+
+  benchRetryStorm( "busy", 9 );
+  benchRetryStorm( "busy", 11 );
+  benchRetryStorm( "no_free_ch", 10 );
+
+  printf( "%-40s %10.1f ms\n", "airtime of 5 bytes at DR5",
+          b.lora.airtime( 5 ) / 1000.0 );
+  if ( !realTime ) {
+      // Over half an hour of waiting on the wall clock
+      benchDutyCycle( false );
+      benchDutyCycle( true );
+  }
+
+  if ( !realTime ) {
+      benchDebugOutput( false );
+      benchDebugOutput( true );
+  }
+
+  benchFullDownlink();
+  benchLongDownlink( 223, RN2XX3_MAX_DOWNLINK + 1, RN2XX3_MAX_DOWNLINK );
+  benchLongDownlink( 1, RN2XX3_MAX_DOWNLINK + 8, 255 );
+
+  if ( realTime ) {
+      // The simulated clock does not move while the library decodes
+      benchDownlink( 4 );
+      benchDownlink( RN2XX3_MAX_DOWNLINK );
+  }
+
+  benchClassifier();
+  benchHexEncoder();
+  benchHexDecoder();
+
+  if ( failures > 0 ) {
+      fflush( stdout );
+      fprintf( stderr, "%d checks FAILED\n", failures );
+      return 1;
+  }
+  return 0;
+}
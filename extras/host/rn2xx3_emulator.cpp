@@ -0,0 +1,854 @@
+/*
+ * Host-side emulator of a Microchip RN2483/RN2903 module.
+ */
+
+#include "rn2xx3_emulator.h"
+#include "rn2xx3_airtime.h"
+
+#include <climits>
+#include <vector>
+
+// Time the firmware takes to parse a command before it starts replying
+static const uint64_t PROCESSING_MICROS = 1000;
+
+// LoRaWAN MHDR + FHDR + FPort + MIC
+static const uint8_t LORAWAN_OVERHEAD = 13;
+static const uint8_t JOIN_REQUEST_LENGTH = 23;
+static const uint8_t JOIN_ACCEPT_LENGTH = 17;
+
+static const uint64_t RECEIVE_DELAY1 = 1000000;
+static const uint64_t RECEIVE_DELAY2 = 2000000;
+static const uint64_t JOIN_ACCEPT_DELAY1 = 5000000;
+
+static bool isHex(const std::string &s, size_t length)
+{
+  if ( s.size() != length ) {
+      return false;
+  }
+  for ( size_t i = 0; i < s.size(); i++ ) {
+      if ( !isxdigit( (unsigned char)s[i] ) ) {
+          return false;
+      }
+  }
+  return true;
+}
+
+static bool parseNumber(const std::string &s, unsigned long max, unsigned long &value)
+{
+  if ( s.empty() || s.size() > 10 ) {
+      return false;
+  }
+  char *end;
+  value = strtoul( s.c_str(), &end, 10 );
+  return *end == '\0' && value <= max;
+}
+
+static bool parseOnOff(const std::string &s, bool &value)
+{
+  if ( s == "on" ) {
+      value = true;
+      return true;
+  }
+  if ( s == "off" ) {
+      value = false;
+      return true;
+  }
+  return false;
+}
+
+static std::vector<std::string> split(const std::string &line)
+{
+  std::vector<std::string> words;
+  size_t pos = 0;
+  while ( pos < line.size() ) {
+      size_t next = line.find( ' ', pos );
+      if ( next == std::string::npos ) {
+          next = line.size();
+      }
+      if ( next > pos ) {
+          words.push_back( line.substr( pos, next - pos ) );
+      }
+      pos = next + 1;
+  }
+  return words;
+}
+
+static std::string format(const char *fmt, unsigned long value)
+{
+  char b[24];
+  snprintf( b, sizeof( b ), fmt, value );
+  return b;
+}
+
+static rn2xx3_clock wallClock;
+
+rn2xx3_emulator::rn2xx3_emulator(RN2xx3_t type, unsigned long baud, rn2xx3_clock *clock)
+  : _clock(clock != NULL ? clock : &wallClock), _type(type),
+    _hweui(type == RN2903 ? "0004A30B001B7C5D" : "0004A30B001A2B3C"), _baud(baud),
+    _hostBaud(baud), _maxBaud(ULONG_MAX)
+{
+  rn2xx3_sim_clock *sim = dynamic_cast<rn2xx3_sim_clock *>( _clock );
+  if ( sim != NULL ) {
+      sim->addSource( this );
+  }
+
+  _joinAccept = true;
+  _snr = 7;
+  _txFailCount = 0;
+  _commandCount = 0;
+  _saveCount = 0;
+  _uplinkCount = 0;
+  _joinCount = 0;
+  _replayCount = 0;
+
+  memset( _nvm, 0xFF, sizeof( _nvm ) );
+  resetMac();
+  _eeprom = _mac;
+  reset();
+}
+
+uint64_t rn2xx3_emulator::now() const
+{
+  return _clock->micros();
+}
+
+uint64_t rn2xx3_emulator::nextEvent()
+{
+  pump();
+  uint64_t next = UINT64_MAX;
+  if ( !_bytes.empty() ) {
+      next = _bytes.front().first;
+  }
+  if ( !_lines.empty() && _lines.begin()->first < next ) {
+      next = _lines.begin()->first;
+  }
+  return next;
+}
+
+void rn2xx3_emulator::reset(unsigned long bootMillis)
+{
+  _cmd.clear();
+  _lines.clear();
+  _bytes.clear();
+  _downlinks.clear();
+  _linkAdrDr = -1;
+  _inFreeAt = 0;
+  _outFreeAt = 0;
+  // 8N1: a start bit, 8 data bits and a stop bit per character
+  _moduleBaud = _baud;
+  _byteMicros = 10000000ULL / _baud;
+  _lineEndAt = 0;
+  _autobaud = false;
+
+  _mac = _eeprom;
+  for ( uint8_t i = 0; i < _channelCount; i++ ) {
+      _mac.channels[i].blockedUntil = 0;
+  }
+  _nextChannel = 0;
+  _joined = false;
+  _joinPending = false;
+  _busyUntil = 0;
+  _sleepUntil = 0;
+  _bootUntil = now() + (uint64_t)bootMillis * 1000;
+  _paused = false;
+
+  reply( _type == RN2903 ? "RN2903 1.0.3 Aug  8 2017 15:11:09"
+                         : "RN2483 1.0.4 Oct 12 2017 14:59:25", _bootUntil );
+}
+
+void rn2xx3_emulator::resetMac()
+{
+  _mac.adr = false;
+  _mac.ar = false;
+  _mac.upctr = 0;
+  _mac.dnctr = 0;
+  _mac.deveui = hweui();
+  _mac.appeui.clear();
+  _mac.appkey.clear();
+  _mac.devaddr.clear();
+  _mac.nwkskey.clear();
+  _mac.appskey.clear();
+  memset( _mac.channels, 0, sizeof( _mac.channels ) );
+
+  if ( _type == RN2903 ) {
+      _mac.dr = 0;
+      _mac.pwridx = 5;
+      _mac.rx2Dr = 8;
+      _mac.rx2Freq = 923300000;
+      _channelCount = 72;
+      for ( uint8_t i = 0; i < 64; i++ ) {
+          Channel &ch = _mac.channels[i];
+          ch.freq = 902300000 + 200000UL * i;
+          ch.drMax = 3;
+          ch.on = true;
+      }
+      for ( uint8_t i = 64; i < 72; i++ ) {
+          Channel &ch = _mac.channels[i];
+          ch.freq = 903000000 + 1600000UL * ( i - 64 );
+          ch.drMin = 4;
+          ch.drMax = 4;
+          ch.on = true;
+      }
+  } else {
+      _mac.dr = 5;
+      _mac.pwridx = 1;
+      _mac.rx2Dr = 0;
+      _mac.rx2Freq = 869525000;
+      _channelCount = 16;
+      for ( uint8_t i = 0; i < 16; i++ ) {
+          Channel &ch = _mac.channels[i];
+          ch.freq = i < 3 ? 868100000 + 200000UL * i : 0;
+          ch.dcycle = 302;
+          ch.drMax = 5;
+          ch.on = i < 3;
+      }
+  }
+}
+
+std::string rn2xx3_emulator::hweui() const
+{
+  return _hweui;
+}
+
+void rn2xx3_emulator::setHweui(const char *hweui)
+{
+  _hweui = hweui;
+  resetMac();
+  _eeprom = _mac;
+}
+
+void rn2xx3_emulator::queueDownlink(uint8_t port, const char *payload)
+{
+  _downlinks.push_back( std::make_pair( port, std::string( payload ) ) );
+}
+
+void rn2xx3_emulator::queueLinkAdr(uint8_t dr)
+{
+  _linkAdrDr = dr;
+}
+
+void rn2xx3_emulator::setJoinAccept(bool accept)
+{
+  _joinAccept = accept;
+}
+
+void rn2xx3_emulator::failNextTx(const char *reply, unsigned count)
+{
+  _txFailReply = reply;
+  _txFailCount = count;
+}
+
+void rn2xx3_emulator::setHostBaud(unsigned long baud)
+{
+  _hostBaud = baud;
+}
+
+void rn2xx3_emulator::setSnr(int snr)
+{
+  _snr = snr;
+}
+
+uint64_t rn2xx3_emulator::airtime(uint8_t sf, unsigned long bandwidth, uint8_t phyLength)
+{
+  // Same formula the library books its duty cycle with
+  return rn2xx3_airtime_us( sf, bandwidth / 1000, phyLength );
+}
+
+void rn2xx3_emulator::drToModulation(uint8_t dr, uint8_t &sf, unsigned long &bandwidth) const
+{
+  if ( _type == RN2903 ) {
+      if ( dr >= 4 ) {
+          sf = 8;
+          bandwidth = 500000;
+      } else {
+          sf = 10 - dr;
+          bandwidth = 125000;
+      }
+  } else {
+      if ( dr >= 6 ) {
+          sf = 7;
+          bandwidth = 250000;
+      } else {
+          sf = 12 - dr;
+          bandwidth = 125000;
+      }
+  }
+}
+
+uint16_t rn2xx3_emulator::maxPayload(uint8_t dr) const
+{
+  if ( _type == RN2903 ) {
+      static const uint16_t max[] = { 11, 53, 125, 242, 242 };
+      return max[dr > 4 ? 4 : dr];
+  }
+  static const uint16_t max[] = { 51, 51, 51, 115, 222, 222, 222, 222 };
+  return max[dr > 7 ? 7 : dr];
+}
+
+/**
+ * Apply the outcome of a join whose accept window has passed.
+ */
+void rn2xx3_emulator::settle(uint64_t at)
+{
+  if ( _joinPending && at >= _joinAt ) {
+      _joinPending = false;
+      if ( _joinResult ) {
+          _joined = true;
+          _mac.devaddr = "260B" + _mac.deveui.substr( 12, 4 );
+          _mac.nwkskey = "2B7E151628AED2A6ABF7158809CF4F3C";
+          _mac.appskey = "3C4FCF098815F7ABA6D2AE2816157E2B";
+          _mac.upctr = 0;
+          _mac.dnctr = 0;
+          _network.erase( _mac.devaddr );
+      }
+  }
+}
+
+uint32_t rn2xx3_emulator::status(uint64_t at)
+{
+  settle( at );
+  uint32_t s = 0;
+  if ( _joined ) {
+      s |= 0x01;
+  }
+  if ( at < _busyUntil ) {
+      // MAC state: transmission occurring
+      s |= 0x01 << 1;
+  }
+  // bit 4 is automatic reply, bit 6 silent immediately
+  if ( _mac.adr ) {
+      s |= 0x01 << 5;
+  }
+  if ( _paused ) {
+      s |= 0x01 << 7;
+  }
+  return s;
+}
+
+/**
+ * Round-robin over the enabled channels that allow the current data
+ * rate and are not blocked by their duty cycle.
+ */
+bool rn2xx3_emulator::pickChannel(uint64_t at, uint8_t &channel)
+{
+  for ( uint8_t i = 0; i < _channelCount; i++ ) {
+      uint8_t c = ( _nextChannel + i ) % _channelCount;
+      const Channel &ch = _mac.channels[c];
+      if ( ch.on && ch.freq != 0 && _mac.dr >= ch.drMin && _mac.dr <= ch.drMax
+           && ch.blockedUntil <= at ) {
+          channel = c;
+          _nextChannel = ( c + 1 ) % _channelCount;
+          return true;
+      }
+  }
+  return false;
+}
+
+void rn2xx3_emulator::reply(const std::string &line, uint64_t at)
+{
+  _lines.insert( std::make_pair( at, line + "\r\n" ) );
+}
+
+/**
+ * Turn the queued lines that are due into bytes, one character time apart.
+ */
+void rn2xx3_emulator::pump()
+{
+  uint64_t t = now();
+  while ( !_lines.empty() && _lines.begin()->first <= t ) {
+      uint64_t start = _lines.begin()->first;
+      if ( start < _outFreeAt ) {
+          start = _outFreeAt;
+      }
+      const std::string &line = _lines.begin()->second;
+      for ( size_t i = 0; i < line.size(); i++ ) {
+          start += _byteMicros;
+          // At the wrong rate the host sees framing errors
+          _bytes.push_back( std::make_pair( start, _hostBaud == _moduleBaud ? line[i] : '?' ) );
+      }
+      _outFreeAt = start;
+      _lines.erase( _lines.begin() );
+  }
+}
+
+int rn2xx3_emulator::available()
+{
+  pump();
+  uint64_t t = now();
+  int n = 0;
+  for ( std::deque<std::pair<uint64_t, char> >::const_iterator it = _bytes.begin();
+        it != _bytes.end() && it->first <= t; ++it ) {
+      n++;
+  }
+  return n;
+}
+
+int rn2xx3_emulator::peek()
+{
+  pump();
+  if ( _bytes.empty() || _bytes.front().first > now() ) {
+      return -1;
+  }
+  return (uint8_t)_bytes.front().second;
+}
+
+int rn2xx3_emulator::read()
+{
+  int c = peek();
+  if ( c >= 0 ) {
+      if ( c == '\n' ) {
+          _lineEndAt = _bytes.front().first;
+      }
+      _bytes.pop_front();
+  }
+  return c;
+}
+
+size_t rn2xx3_emulator::write(uint8_t c)
+{
+  uint64_t t = now();
+  uint64_t at = ( _inFreeAt > t ? _inFreeAt : t ) + 10000000ULL / _hostBaud;
+  _inFreeAt = at;
+
+  if ( at < _bootUntil ) {
+      return 1;
+  }
+
+  if ( _hostBaud != _moduleBaud ) {
+      // Only a break, which is long at any rate, and the 0x55 that
+      // follows it get through
+      if ( c == 0x00 ) {
+          _autobaud = true;
+          _cmd.clear();
+      } else if ( c == 0x55 && _autobaud && _hostBaud <= _maxBaud ) {
+          _autobaud = false;
+          _moduleBaud = _hostBaud;
+          _byteMicros = 10000000ULL / _hostBaud;
+      }
+      return 1;
+  }
+
+  if ( at < _sleepUntil ) {
+      // Only a break wakes the module up
+      if ( c == 0x00 ) {
+          _sleepUntil = 0;
+          _autobaud = true;
+          _cmd.clear();
+          reply( "ok", at );
+      }
+      return 1;
+  }
+
+  if ( c == 0x00 ) {
+      // Break condition: the next 0x55 is used to measure the baud rate
+      _autobaud = true;
+      _cmd.clear();
+  } else if ( c == 0x55 && _autobaud ) {
+      _autobaud = false;
+  } else if ( c == '\n' ) {
+      if ( !_cmd.empty() && _cmd[_cmd.size() - 1] == '\r' ) {
+          _cmd.erase( _cmd.size() - 1 );
+      }
+      if ( !_cmd.empty() ) {
+          execute( _cmd, at );
+      }
+      _cmd.clear();
+  } else {
+      _cmd += (char)c;
+  }
+  return 1;
+}
+
+void rn2xx3_emulator::execute(const std::string &line, uint64_t at)
+{
+  _commandCount++;
+  _lastCommand = line;
+  settle( at );
+
+  std::vector<std::string> w = split( line );
+  uint64_t done = at + PROCESSING_MICROS;
+
+  if ( w.size() >= 2 && w[0] == "sys" ) {
+      if ( w[1] == "get" && w.size() == 3 && w[2] == "ver" ) {
+          reply( _type == RN2903 ? "RN2903 1.0.3 Aug  8 2017 15:11:09"
+                                 : "RN2483 1.0.4 Oct 12 2017 14:59:25", done );
+      } else if ( w[1] == "get" && w.size() == 3 && w[2] == "hweui" ) {
+          reply( hweui(), done );
+      } else if ( w[1] == "get" && w.size() == 3 && w[2] == "vdd" ) {
+          reply( "3300", done );
+      } else if ( w[1] == "sleep" && w.size() == 3 ) {
+          unsigned long msec;
+          if ( parseNumber( w[2], 4294967295UL, msec ) && msec >= 100 ) {
+              _sleepUntil = done + (uint64_t)msec * 1000;
+              reply( "ok", _sleepUntil );
+          } else {
+              reply( "invalid_param", done );
+          }
+      } else if ( w[1] == "reset" && w.size() == 2 ) {
+          reset();
+      } else if ( w[1] == "get" && w.size() == 4 && w[2] == "nvm" ) {
+          unsigned long address = strtoul( w[3].c_str(), NULL, 16 );
+          if ( isHex( w[3], w[3].size() ) && address >= 0x300 && address <= 0x3FF ) {
+              reply( format( "%02lX", (unsigned long)_nvm[address - 0x300] ), done );
+          } else {
+              reply( "invalid_param", done );
+          }
+      } else if ( w[1] == "set" && w.size() == 5 && w[2] == "nvm" ) {
+          unsigned long address = strtoul( w[3].c_str(), NULL, 16 );
+          if ( isHex( w[3], w[3].size() ) && address >= 0x300 && address <= 0x3FF && isHex( w[4], 2 ) ) {
+              _nvm[address - 0x300] = strtoul( w[4].c_str(), NULL, 16 );
+              reply( "ok", done );
+          } else {
+              reply( "invalid_param", done );
+          }
+      } else if ( w[1] == "factoryRESET" && w.size() == 2 ) {
+          // The user EEPROM goes back to its defaults too
+          memset( _nvm, 0xFF, sizeof( _nvm ) );
+          resetMac();
+          _eeprom = _mac;
+          reset();
+      } else {
+          reply( "invalid_param", done );
+      }
+      return;
+  }
+
+  if ( w.size() >= 2 && w[0] == "radio" ) {
+      if ( w[1] == "get" && w.size() == 3 && w[2] == "snr" ) {
+          char snr[8];
+          snprintf( snr, sizeof( snr ), "%d", _snr );
+          reply( snr, done );
+      } else if ( w[1] == "get" && w.size() == 3 && w[2] == "pwr" ) {
+          reply( "1", done );
+      } else if ( w[1] == "set" && w.size() == 4 && w[2] == "pwr" ) {
+          reply( "ok", done );
+      } else {
+          reply( "invalid_param", done );
+      }
+      return;
+  }
+
+  if ( w.size() >= 2 && w[0] == "mac" ) {
+      bool busy = done < _busyUntil;
+      if ( w[1] == "reset" && w.size() <= 3 ) {
+          resetMac();
+          _joined = false;
+          reply( "ok", done );
+      } else if ( w[1] == "set" ) {
+          if ( busy ) {
+              reply( "busy", done );
+          } else {
+              macSet( line.substr( 8 ), done );
+          }
+      } else if ( w[1] == "get" ) {
+          macGet( line.substr( 8 ), done );
+      } else if ( w[1] == "save" && w.size() == 2 ) {
+          _saveCount++;
+          _eeprom = _mac;
+          // Writing the EEPROM takes a while
+          reply( "ok", done + 100000 );
+      } else if ( w[1] == "join" && w.size() == 3 ) {
+          if ( busy ) {
+              reply( "busy", done );
+          } else {
+              macJoin( w[2], done );
+          }
+      } else if ( w[1] == "tx" ) {
+          if ( busy ) {
+              reply( "busy", done );
+          } else {
+              macTx( line.substr( 7 ), done );
+          }
+      } else if ( w[1] == "pause" && w.size() == 2 ) {
+          _paused = true;
+          reply( "4294967245", done );
+      } else if ( w[1] == "resume" && w.size() == 2 ) {
+          _paused = false;
+          reply( "ok", done );
+      } else {
+          reply( "invalid_param", done );
+      }
+      return;
+  }
+
+  reply( "invalid_param", done );
+}
+
+void rn2xx3_emulator::macSet(const std::string &args, uint64_t at)
+{
+  std::vector<std::string> w = split( args );
+  bool ok = false;
+  unsigned long v;
+
+  if ( w.size() == 2 ) {
+      const std::string &name = w[0];
+      const std::string &value = w[1];
+      if ( name == "deveui" || name == "appeui" ) {
+          ok = isHex( value, 16 );
+          if ( ok ) {
+              ( name == "deveui" ? _mac.deveui : _mac.appeui ) = value;
+          }
+      } else if ( name == "appkey" || name == "nwkskey" || name == "appskey" ) {
+          ok = isHex( value, 32 );
+          if ( ok ) {
+              ( name == "appkey" ? _mac.appkey : name == "nwkskey" ? _mac.nwkskey : _mac.appskey ) = value;
+          }
+      } else if ( name == "devaddr" ) {
+          ok = isHex( value, 8 );
+          if ( ok ) {
+              _mac.devaddr = value;
+          }
+      } else if ( name == "pwridx" ) {
+          ok = parseNumber( value, 10, v );
+          if ( ok ) {
+              _mac.pwridx = v;
+          }
+      } else if ( name == "dr" ) {
+          ok = parseNumber( value, _type == RN2903 ? 4 : 7, v );
+          if ( ok ) {
+              _mac.dr = v;
+          }
+      } else if ( name == "adr" ) {
+          ok = parseOnOff( value, _mac.adr );
+      } else if ( name == "ar" ) {
+          ok = parseOnOff( value, _mac.ar );
+      } else if ( name == "upctr" || name == "dnctr" ) {
+          ok = parseNumber( value, 4294967295UL, v );
+          if ( ok ) {
+              ( name == "upctr" ? _mac.upctr : _mac.dnctr ) = v;
+          }
+      } else if ( name == "retx" || name == "linkchk" || name == "rxdelay1" ) {
+          ok = parseNumber( value, 65535, v );
+      }
+  } else if ( w.size() == 3 && w[0] == "rx2" ) {
+      unsigned long dr;
+      ok = parseNumber( w[1], 15, dr ) && parseNumber( w[2], 1020000000UL, v );
+      if ( ok ) {
+          _mac.rx2Dr = dr;
+          _mac.rx2Freq = v;
+      }
+  } else if ( w.size() >= 4 && w[0] == "ch" ) {
+      unsigned long c;
+      if ( parseNumber( w[2], _channelCount - 1, c ) ) {
+          Channel &ch = _mac.channels[c];
+          if ( w[1] == "status" && w.size() == 4 ) {
+              ok = parseOnOff( w[3], ch.on );
+          } else if ( w[1] == "freq" && w.size() == 4 && _type == RN2483 ) {
+              // The three default channels can not be moved
+              ok = c >= 3 && parseNumber( w[3], 870000000UL, v ) && v >= 863000000UL;
+              if ( ok ) {
+                  ch.freq = v;
+              }
+          } else if ( w[1] == "dcycle" && w.size() == 4 && _type == RN2483 ) {
+              ok = parseNumber( w[3], 65535, v );
+              if ( ok ) {
+                  ch.dcycle = v;
+              }
+          } else if ( w[1] == "drrange" && w.size() == 5 ) {
+              unsigned long lo;
+              ok = parseNumber( w[3], 7, lo ) && parseNumber( w[4], 7, v ) && lo <= v;
+              if ( ok ) {
+                  ch.drMin = lo;
+                  ch.drMax = v;
+              }
+          }
+      }
+  }
+
+  reply( ok ? "ok" : "invalid_param", at );
+}
+
+void rn2xx3_emulator::macGet(const std::string &args, uint64_t at)
+{
+  std::vector<std::string> w = split( args );
+
+  if ( w.size() == 1 ) {
+      const std::string &name = w[0];
+      if ( name == "status" ) {
+          // RN2483 1.0.4 reports 32 status bits, older firmware 16
+          reply( format( _type == RN2903 ? "%04lX" : "%08lX", status( at ) ), at );
+      } else if ( name == "deveui" ) {
+          reply( _mac.deveui, at );
+      } else if ( name == "appeui" ) {
+          reply( _mac.appeui.empty() ? "0000000000000000" : _mac.appeui, at );
+      } else if ( name == "devaddr" ) {
+          reply( _mac.devaddr.empty() ? "00000000" : _mac.devaddr, at );
+      } else if ( name == "dr" ) {
+          reply( format( "%lu", _mac.dr ), at );
+      } else if ( name == "pwridx" ) {
+          reply( format( "%lu", _mac.pwridx ), at );
+      } else if ( name == "adr" ) {
+          reply( _mac.adr ? "on" : "off", at );
+      } else if ( name == "ar" ) {
+          reply( _mac.ar ? "on" : "off", at );
+      } else if ( name == "upctr" ) {
+          reply( format( "%lu", _mac.upctr ), at );
+      } else if ( name == "dnctr" ) {
+          reply( format( "%lu", _mac.dnctr ), at );
+      } else if ( name == "rx2" ) {
+          reply( format( "%lu ", _mac.rx2Dr ) + format( "%lu", _mac.rx2Freq ), at );
+      } else {
+          reply( "invalid_param", at );
+      }
+      return;
+  }
+
+  unsigned long c;
+  if ( w.size() == 3 && w[0] == "ch" && parseNumber( w[2], _channelCount - 1, c ) ) {
+      const Channel &ch = _mac.channels[c];
+      if ( w[1] == "freq" ) {
+          reply( format( "%lu", ch.freq ), at );
+          return;
+      } else if ( w[1] == "dcycle" ) {
+          reply( format( "%lu", ch.dcycle ), at );
+          return;
+      } else if ( w[1] == "drrange" ) {
+          reply( format( "%lu ", ch.drMin ) + format( "%lu", ch.drMax ), at );
+          return;
+      } else if ( w[1] == "status" ) {
+          reply( ch.on ? "on" : "off", at );
+          return;
+      }
+  }
+
+  reply( "invalid_param", at );
+}
+
+void rn2xx3_emulator::macJoin(const std::string &mode, uint64_t at)
+{
+  if ( _paused ) {
+      reply( "mac_paused", at );
+      return;
+  }
+
+  if ( mode == "abp" ) {
+      if ( _mac.devaddr.empty() || _mac.nwkskey.empty() || _mac.appskey.empty() ) {
+          reply( "keys_not_init", at );
+          return;
+      }
+      reply( "ok", at );
+      reply( "accepted", at + PROCESSING_MICROS );
+      _joined = true;
+      return;
+  }
+
+  if ( mode != "otaa" ) {
+      reply( "invalid_param", at );
+      return;
+  }
+  if ( _mac.deveui.empty() || _mac.appeui.empty() || _mac.appkey.empty() ) {
+      reply( "keys_not_init", at );
+      return;
+  }
+
+  uint8_t channel;
+  if ( !pickChannel( at, channel ) ) {
+      reply( "no_free_ch", at );
+      return;
+  }
+
+  uint8_t sf;
+  unsigned long bandwidth;
+  drToModulation( _mac.dr, sf, bandwidth );
+  uint64_t txEnd = at + airtime( sf, bandwidth, JOIN_REQUEST_LENGTH );
+  Channel &ch = _mac.channels[channel];
+  ch.blockedUntil = txEnd + ( txEnd - at ) * ch.dcycle;
+
+  _joined = false;
+  _joinPending = true;
+  _joinCount++;
+  _joinResult = _joinAccept;
+  _joinAt = txEnd + JOIN_ACCEPT_DELAY1 + airtime( sf, bandwidth, JOIN_ACCEPT_LENGTH );
+  _busyUntil = _joinAt;
+
+  reply( "ok", at );
+  reply( _joinAccept ? "accepted" : "denied", _joinAt );
+}
+
+void rn2xx3_emulator::macTx(const std::string &args, uint64_t at)
+{
+  std::vector<std::string> w = split( args );
+  unsigned long port;
+
+  if ( w.size() != 3 || ( w[0] != "cnf" && w[0] != "uncnf" )
+       || !parseNumber( w[1], 223, port ) || port < 1 ) {
+      reply( "invalid_param", at );
+      return;
+  }
+  const std::string &payload = w[2];
+  if ( payload.size() % 2 != 0 || !isHex( payload, payload.size() ) ) {
+      reply( "invalid_param", at );
+      return;
+  }
+  if ( _txFailCount > 0 ) {
+      _txFailCount--;
+      reply( _txFailReply, at );
+      return;
+  }
+  if ( !_joined ) {
+      reply( "not_joined", at );
+      return;
+  }
+  if ( _paused ) {
+      reply( "mac_paused", at );
+      return;
+  }
+  if ( payload.size() / 2 > maxPayload( _mac.dr ) ) {
+      reply( "invalid_data_len", at );
+      return;
+  }
+
+  uint8_t channel;
+  if ( !pickChannel( at, channel ) ) {
+      reply( "no_free_ch", at );
+      return;
+  }
+
+  uint8_t sf;
+  unsigned long bandwidth;
+  drToModulation( _mac.dr, sf, bandwidth );
+  uint64_t txEnd = at + airtime( sf, bandwidth, LORAWAN_OVERHEAD + payload.size() / 2 );
+  Channel &ch = _mac.channels[channel];
+  ch.blockedUntil = txEnd + ( txEnd - at ) * ch.dcycle;
+
+  _uplinkCount++;
+  std::map<std::string, uint32_t>::iterator last = _network.find( _mac.devaddr );
+  bool replay = last != _network.end() && _mac.upctr <= last->second;
+  if ( replay ) {
+      _replayCount++;
+  } else {
+      _network[_mac.devaddr] = _mac.upctr;
+  }
+  _mac.upctr++;
+  reply( "ok", at );
+
+  // The network ignores a replay: no downlink and no ack
+  uint64_t result;
+  if ( !replay && !_downlinks.empty() ) {
+      const std::pair<uint8_t, std::string> &dl = _downlinks.front();
+      result = txEnd + RECEIVE_DELAY1
+             + airtime( sf, bandwidth, LORAWAN_OVERHEAD + dl.second.size() / 2 );
+      reply( format( "mac_rx %lu ", dl.first ) + dl.second, result );
+      _mac.dnctr++;
+      _downlinks.pop_front();
+  } else if ( !replay && _linkAdrDr >= 0 ) {
+      // LinkADRReq in FOpts, 5 bytes
+      result = txEnd + RECEIVE_DELAY1 + airtime( sf, bandwidth, LORAWAN_OVERHEAD + 5 );
+      reply( "mac_tx_ok", result );
+      _mac.dnctr++;
+      _mac.dr = _linkAdrDr;
+      _linkAdrDr = -1;
+  } else if ( w[0] == "cnf" && !replay ) {
+      // The ack arrives in RX1
+      result = txEnd + RECEIVE_DELAY1 + airtime( sf, bandwidth, LORAWAN_OVERHEAD - 1 );
+      reply( "mac_tx_ok", result );
+  } else {
+      // Nothing in either window: RX2 closes after its preamble timeout
+      uint8_t rx2Sf;
+      unsigned long rx2Bandwidth;
+      drToModulation( _mac.rx2Dr, rx2Sf, rx2Bandwidth );
+      result = txEnd + RECEIVE_DELAY2 + airtime( rx2Sf, rx2Bandwidth, 0 );
+      reply( w[0] == "cnf" ? "mac_err" : "mac_tx_ok", result );
+  }
+  _busyUntil = result;
+}
@@ -0,0 +1,224 @@
+/*
+ * Host-side emulator of a Microchip RN2483/RN2903 module.
+ *
+ * Implements Stream, so an rn2xx3 instance can talk to it exactly like it
+ * talks to a (Software)Serial port. It speaks the subset of the RN2xx3 ASCII
+ * command set used by the library, delays every reply byte by the UART
+ * character time at the configured baud rate and delays mac tx / mac join
+ * results by the LoRa time-on-air plus the LoRaWAN receive windows.
+ */
+
+#ifndef rn2xx3_emulator_h
+#define rn2xx3_emulator_h
+
+#include "Arduino.h"
+#include "rn2xx3.h"
+#include "rn2xx3_sim_clock.h"
+
+#include <deque>
+#include <map>
+#include <string>
+
+class rn2xx3_emulator : public Stream, public rn2xx3_sim_clock::source
+{
+  public:
+    /*
+     * type: the module to emulate, RN2483 or RN2903.
+     * baud: the UART rate the module starts at after power-on, and the
+     *       host's rate until setHostBaud().
+     * clock: the time base, NULL for the wall clock. Pass the same clock to
+     *        the rn2xx3 instance. A rn2xx3_sim_clock is told about this
+     *        emulator so it can skip ahead to its replies.
+     */
+    rn2xx3_emulator(RN2xx3_t type = RN2483, unsigned long baud = 57600, rn2xx3_clock *clock = NULL);
+
+    // Stream
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    using Print::write;
+
+    // rn2xx3_sim_clock::source
+    uint64_t nextEvent();
+
+    /*
+     * Power cycle the module: all volatile MAC state is lost and the
+     * firmware banner is sent, like after a reset pin pulse. Until the
+     * firmware is up after bootMillis, whatever the host sends is lost.
+     */
+    void reset(unsigned long bootMillis = 0);
+
+    /*
+     * The downlink to deliver in the receive window of the next uplink.
+     * payload is a HEX string.
+     */
+    void queueDownlink(uint8_t port, const char *payload);
+
+    /*
+     * A LinkADRReq to dr in the receive window of the next uplink, without
+     * a payload, so the module reports mac_tx_ok and moves to dr.
+     */
+    void queueLinkAdr(uint8_t dr);
+
+    /*
+     * Whether join requests get answered with accepted or denied.
+     */
+    void setJoinAccept(bool accept);
+
+    /*
+     * Answer the next count mac tx commands with reply instead of
+     * transmitting, e.g. "busy" or "no_free_ch".
+     */
+    void failNextTx(const char *reply, unsigned count);
+
+    /*
+     * The value returned by "radio get snr".
+     */
+    void setSnr(int snr);
+
+    /*
+     * The rate the host's UART now runs at. While it differs from the
+     * module's, the module drops what it receives and the host reads
+     * garbage, until a break and 0x55 at the new rate move the module
+     * along. It only follows up to maxBaud.
+     */
+    void setHostBaud(unsigned long baud);
+    void setMaxBaud(unsigned long baud) { _maxBaud = baud; }
+    unsigned long baud() const { return _moduleBaud; }
+    uint8_t dr() const { return _mac.dr; }
+
+    /*
+     * The EUI returned by "sys get hweui", which is also the default
+     * deveui. Set it before talking to the module; it wipes the MAC state.
+     */
+    void setHweui(const char *hweui);
+
+    /*
+     * Counters for checking what the library sent.
+     */
+    unsigned long commandCount() const { return _commandCount; }
+    unsigned long saveCount() const { return _saveCount; }
+    unsigned long uplinkCount() const { return _uplinkCount; }
+    unsigned long joinCount() const { return _joinCount; }
+
+    /*
+     * Uplinks the network dropped as replays: their frame counter was not
+     * above the last one it took from the devaddr. The network outlives
+     * reset(); only a new join starts the counters over.
+     */
+    unsigned long replayCount() const { return _replayCount; }
+    const char *lastCommand() const { return _lastCommand.c_str(); }
+
+    /*
+     * When the end of the last line read by the host arrived, in clock
+     * microseconds.
+     */
+    uint64_t lineEndAt() const { return _lineEndAt; }
+
+    /*
+     * LoRa time-on-air in microseconds of a PHY payload of the given length.
+     */
+    static uint64_t airtime(uint8_t sf, unsigned long bandwidth, uint8_t phyLength);
+
+  private:
+    struct Channel {
+      uint32_t freq;
+      uint16_t dcycle;
+      uint8_t drMin;
+      uint8_t drMax;
+      bool on;
+      uint64_t blockedUntil;
+    };
+
+    rn2xx3_clock *_clock;
+    RN2xx3_t _type;
+    std::string _hweui;
+    unsigned long _baud;
+    unsigned long _moduleBaud;
+    unsigned long _hostBaud;
+    unsigned long _maxBaud;
+    uint64_t _byteMicros;
+
+    // Host -> module
+    std::string _cmd;
+    uint64_t _inFreeAt;
+    bool _autobaud;
+
+    // Module -> host. Lines are queued by the time they start and turned
+    // into timed bytes as the clock passes them.
+    std::multimap<uint64_t, std::string> _lines;
+    std::deque<std::pair<uint64_t, char> > _bytes;
+    uint64_t _outFreeAt;
+    uint64_t _lineEndAt;
+
+    // The MAC parameters, both the working copy and the one "mac save"
+    // writes to EEPROM and a reset restores.
+    struct MacState {
+      bool adr;
+      bool ar;
+      uint8_t dr;
+      uint8_t pwridx;
+      uint8_t rx2Dr;
+      uint32_t rx2Freq;
+      uint32_t upctr;
+      uint32_t dnctr;
+      std::string deveui;
+      std::string appeui;
+      std::string appkey;
+      std::string devaddr;
+      std::string nwkskey;
+      std::string appskey;
+      Channel channels[72];
+    };
+
+    MacState _mac;
+    MacState _eeprom;
+    // The user EEPROM of "sys set nvm", 0x300 to 0x3FF
+    uint8_t _nvm[256];
+    uint8_t _channelCount;
+    uint8_t _nextChannel;
+
+    bool _joined;
+    bool _joinPending;
+    bool _joinResult;
+    uint64_t _joinAt;
+    bool _joinAccept;
+    uint64_t _busyUntil;
+    uint64_t _sleepUntil;
+    uint64_t _bootUntil;
+    bool _paused;
+    int _snr;
+    std::string _txFailReply;
+    unsigned _txFailCount;
+
+    std::deque<std::pair<uint8_t, std::string> > _downlinks;
+    int _linkAdrDr;
+
+    unsigned long _commandCount;
+    unsigned long _saveCount;
+    unsigned long _uplinkCount;
+    unsigned long _joinCount;
+    unsigned long _replayCount;
+    // The last uplink counter the network took, by devaddr
+    std::map<std::string, uint32_t> _network;
+    std::string _lastCommand;
+
+    uint64_t now() const;
+    void pump();
+    void reply(const std::string &line, uint64_t at);
+    void resetMac();
+    void settle(uint64_t at);
+    bool pickChannel(uint64_t at, uint8_t &channel);
+    void execute(const std::string &line, uint64_t at);
+    void macSet(const std::string &args, uint64_t at);
+    void macGet(const std::string &args, uint64_t at);
+    void macJoin(const std::string &mode, uint64_t at);
+    void macTx(const std::string &args, uint64_t at);
+    void drToModulation(uint8_t dr, uint8_t &sf, unsigned long &bandwidth) const;
+    uint32_t status(uint64_t at);
+    uint16_t maxPayload(uint8_t dr) const;
+    std::string hweui() const;
+};
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * Drives many RN2xx3 modules from one Linux thread.
+ */
+
+#include "rn2xx3_fleet.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+// How often modules without new bytes are polled for their timeouts
+#define SWEEP_INTERVAL 10
+
+rn2xx3_fleet::rn2xx3_fleet()
+  : _epoll(epoll_create1( EPOLL_CLOEXEC )), _lastSweep(0),
+    _callback(NULL), _context(NULL),
+    _commandsDone(0), _uplinksDone(0), _failures(0)
+{
+}
+
+rn2xx3_fleet::~rn2xx3_fleet()
+{
+  for ( size_t i = 0; i < _modules.size(); i++ ) {
+      delete _modules[i];
+  }
+  if ( _epoll >= 0 ) {
+      close( _epoll );
+  }
+}
+
+int rn2xx3_fleet::add(session *s)
+{
+  struct epoll_event ev;
+  ev.events = EPOLLIN;
+  ev.data.u64 = _modules.size();
+  if ( epoll_ctl( _epoll, EPOLL_CTL_ADD, s->port.fd(), &ev ) < 0 ) {
+      delete s;
+      return -1;
+  }
+  _modules.push_back( s );
+  return _modules.size() - 1;
+}
+
+int rn2xx3_fleet::open(const char *device, unsigned long baud)
+{
+  session *s = new session;
+  if ( !s->port.open( device, baud ) ) {
+      delete s;
+      return -1;
+  }
+  return add( s );
+}
+
+int rn2xx3_fleet::attach(int fd, unsigned long baud)
+{
+  session *s = new session;
+  if ( !s->port.attach( fd, baud ) ) {
+      delete s;
+      return -1;
+  }
+  return add( s );
+}
+
+void rn2xx3_fleet::command(size_t module, const char *command)
+{
+  job j;
+  j.uplink = false;
+  j.confirmed = false;
+  j.text = command;
+  _modules[module]->jobs.push_back( j );
+}
+
+void rn2xx3_fleet::uplink(size_t module, const char *payload, bool confirmed)
+{
+  uplink( module, (const byte *)payload, strlen( payload ), confirmed );
+}
+
+void rn2xx3_fleet::uplink(size_t module, const byte *payload, uint8_t length, bool confirmed)
+{
+  job j;
+  j.uplink = true;
+  j.confirmed = confirmed;
+  j.text.assign( (const char *)payload, length );
+  _modules[module]->jobs.push_back( j );
+}
+
+void rn2xx3_fleet::cancel(size_t module)
+{
+  session *s = _modules[module];
+  s->jobs.erase( s->busy ? s->jobs.begin() + 1 : s->jobs.begin(), s->jobs.end() );
+}
+
+size_t rn2xx3_fleet::queued(size_t module) const
+{
+  const session *s = _modules[module];
+  return s->jobs.size();
+}
+
+/**
+ * Move one module along: finish its current job if the state machine is
+ * done, then start the next one.
+ */
+void rn2xx3_fleet::advance(size_t i)
+{
+  session *s = _modules[i];
+
+  if ( s->busy ) {
+      if ( s->lora.poll() != TX_DONE ) {
+          return;
+      }
+      s->busy = false;
+
+      // Off the queue before the callback, which may queue or cancel jobs
+      job j = s->jobs.front();
+      s->jobs.pop_front();
+      TX_RETURN_TYPE result = s->lora.txResult();
+      if ( result == TX_FAIL || result == TX_NO_FREE_CH ) {
+          _failures++;
+      } else if ( j.uplink ) {
+          _uplinksDone++;
+      } else {
+          _commandsDone++;
+      }
+      if ( _callback ) {
+          _callback( _context, i, j.text.c_str(), result, j.uplink ? NULL : s->lora.reply() );
+      }
+  }
+
+  if ( !s->jobs.empty() ) {
+      const job &j = s->jobs.front();
+      if ( j.uplink ) {
+          s->busy = s->lora.txBegin( j.confirmed ? "mac tx cnf 1 " : "mac tx uncnf 1 ",
+                                     (const byte *)j.text.data(), j.text.size(), j.confirmed );
+      } else {
+          s->busy = s->lora.commandBegin( j.text.c_str() );
+      }
+  }
+
+  // Nothing waits for bytes from an idle module, like a late reply after a
+  // timeout or a banner after a reset. Left in the port, they would wake
+  // the level-triggered epoll_wait() on every call.
+  if ( !s->busy ) {
+      while ( s->port.available() > 0 ) {
+          s->port.read();
+      }
+  }
+}
+
+size_t rn2xx3_fleet::run(int timeout)
+{
+  // Idle modules with queued jobs start right away
+  for ( size_t i = 0; i < _modules.size(); i++ ) {
+      if ( !_modules[i]->busy && !_modules[i]->jobs.empty() ) {
+          advance( i );
+      }
+  }
+
+  unsigned long now = ::millis();
+  unsigned long sweepIn = now - _lastSweep >= SWEEP_INTERVAL ? 0 : SWEEP_INTERVAL - ( now - _lastSweep );
+  if ( timeout < 0 || (unsigned long)timeout > sweepIn ) {
+      timeout = sweepIn;
+  }
+
+  struct epoll_event events[64];
+  int n = epoll_wait( _epoll, events, 64, timeout );
+  for ( int e = 0; e < n; e++ ) {
+      advance( events[e].data.u64 );
+  }
+
+  // The state machines keep their own timeouts and backoffs
+  now = ::millis();
+  if ( now - _lastSweep >= SWEEP_INTERVAL ) {
+      _lastSweep = now;
+      for ( size_t i = 0; i < _modules.size(); i++ ) {
+          if ( _modules[i]->busy ) {
+              advance( i );
+          }
+      }
+  }
+
+  size_t working = 0;
+  for ( size_t i = 0; i < _modules.size(); i++ ) {
+      if ( _modules[i]->busy || !_modules[i]->jobs.empty() ) {
+          working++;
+      }
+  }
+  return working;
+}
+
+bool rn2xx3_fleet::runUntilIdle(unsigned long timeout)
+{
+  unsigned long start = ::millis();
+  while ( run( 10 ) > 0 ) {
+      if ( ::millis() - start >= timeout ) {
+          return false;
+      }
+  }
+  return true;
+}
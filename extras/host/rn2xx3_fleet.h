@@ -0,0 +1,111 @@
+/*
+ * Drives many RN2xx3 modules from one Linux thread.
+ *
+ * Every module gets its own rn2xx3 instance on an rn2xx3_posix_serial and
+ * a queue of jobs: raw commands and uplinks. The fleet waits for bytes on
+ * all ports at once with epoll and advances the non-blocking command/tx
+ * state machine (commandBegin(), txBegin() and poll()) of whichever
+ * module has data. No module ever blocks another.
+ */
+
+#ifndef rn2xx3_fleet_h
+#define rn2xx3_fleet_h
+
+#include "Arduino.h"
+#include "rn2xx3.h"
+#include "rn2xx3_posix_serial.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+class rn2xx3_fleet
+{
+  public:
+    /*
+     * Called when a job is done. reply is the reply to a command, or
+     * NULL for an uplink.
+     */
+    typedef void (*callback)(void *context, size_t module, const char *job,
+                             TX_RETURN_TYPE result, const char *reply);
+
+    rn2xx3_fleet();
+    ~rn2xx3_fleet();
+
+    /*
+     * Add a module on a serial device, or on an open file descriptor
+     * (which the fleet then owns). Returns its index, or -1 on failure.
+     */
+    int open(const char *device, unsigned long baud = 57600);
+    int attach(int fd, unsigned long baud = 57600);
+
+    size_t size() const { return _modules.size(); }
+    rn2xx3 &module(size_t i) { return _modules[i]->lora; }
+
+    /*
+     * Queue a raw command, or an uplink of a text or binary payload.
+     */
+    void command(size_t module, const char *command);
+    void uplink(size_t module, const char *payload, bool confirmed = false);
+    void uplink(size_t module, const byte *payload, uint8_t length, bool confirmed = false);
+
+    /*
+     * Drop the jobs of a module that have not started yet, e.g. from the
+     * callback after a job failed. The one running, if any, finishes.
+     */
+    void cancel(size_t module);
+
+    void onDone(callback cb, void *context) { _callback = cb; _context = context; }
+
+    /*
+     * Wait up to timeout milliseconds for bytes from any module and
+     * advance every module that has some. Bytes from a module without a
+     * job running are discarded. Returns the number of modules that still
+     * have work.
+     */
+    size_t run(int timeout);
+
+    /*
+     * run() until every queue is empty. Returns false if that takes
+     * longer than timeout milliseconds.
+     */
+    bool runUntilIdle(unsigned long timeout);
+
+    /*
+     * Jobs finished, in total and per module.
+     */
+    unsigned long commandsDone() const { return _commandsDone; }
+    unsigned long uplinksDone() const { return _uplinksDone; }
+    unsigned long failures() const { return _failures; }
+    size_t queued(size_t module) const;
+
+  private:
+    struct job {
+      bool uplink;
+      bool confirmed;
+      std::string text;
+    };
+
+    struct session {
+      rn2xx3_posix_serial port;
+      rn2xx3 lora;
+      std::deque<job> jobs;
+      bool busy;
+
+      session() : lora(&port), busy(false) {}
+    };
+
+    std::vector<session *> _modules;
+    int _epoll;
+    unsigned long _lastSweep;
+    callback _callback;
+    void *_context;
+    unsigned long _commandsDone;
+    unsigned long _uplinksDone;
+    unsigned long _failures;
+
+    int add(session *s);
+    void advance(size_t i);
+};
+
+#endif
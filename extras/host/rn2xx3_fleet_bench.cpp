@@ -0,0 +1,129 @@
+/*
+ * Throughput of rn2xx3_fleet against emulated modules on pseudo-terminals.
+ *
+ * Usage: rn2xx3_fleet_bench [-n <max modules>] [-t <seconds per phase>]
+ *
+ * For 1, 2, 4, ... up to the maximum number of modules, every module
+ * joins over OTAA, then answers "mac get status" as fast as it can, then
+ * sends uplinks back to back with the duty cycle lifted. All of it runs on one
+ * thread; the emulators run on a second one.
+ */
+
+#include "Arduino.h"
+#include "rn2xx3_fleet.h"
+#include "rn2xx3_pty_farm.h"
+
+#include <sys/resource.h>
+
+static double cpuSeconds()
+{
+  struct rusage ru;
+  getrusage( RUSAGE_SELF, &ru );
+  return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+         + ( ru.ru_utime.tv_usec + ru.ru_stime.tv_usec ) / 1e6;
+}
+
+// Keep one job queued behind the running one on every module
+static void topUp(rn2xx3_fleet &fleet, bool uplinks)
+{
+  for ( size_t i = 0; i < fleet.size(); i++ ) {
+      if ( fleet.queued( i ) < 2 ) {
+          if ( uplinks ) {
+              fleet.uplink( i, "Hello" );
+          } else {
+              fleet.command( i, "mac get status" );
+          }
+      }
+  }
+}
+
+static void runFor(rn2xx3_fleet &fleet, bool uplinks, unsigned long ms)
+{
+  unsigned long start = ::millis();
+  while ( ::millis() - start < ms ) {
+      topUp( fleet, uplinks );
+      fleet.run( 10 );
+  }
+}
+
+static bool benchFleet(size_t count, unsigned long phase)
+{
+  rn2xx3_pty_farm farm;
+  rn2xx3_fleet fleet;
+  std::vector<std::string> deveuis;
+
+  for ( size_t i = 0; i < count; i++ ) {
+      int fd = farm.add( RN2483 );
+      if ( fd < 0 || fleet.attach( fd ) < 0 ) {
+          perror( "pty" );
+          return false;
+      }
+      char deveui[40];
+      snprintf( deveui, sizeof( deveui ), "mac set deveui 0004A30B00%06X", (unsigned)i );
+      deveuis.push_back( deveui );
+  }
+  if ( !farm.start() ) {
+      perror( "farm" );
+      return false;
+  }
+  // Let the power-on banners arrive, so the first command drains them
+  // instead of taking one for its reply
+  delay( 50 );
+
+  unsigned long start = ::millis();
+  for ( size_t i = 0; i < count; i++ ) {
+      fleet.command( i, "mac reset 868" );
+      fleet.command( i, deveuis[i].c_str() );
+      fleet.command( i, "mac set appeui 70B3D57ED00001A6" );
+      fleet.command( i, "mac set appkey A23C96EE13804963F8C2BD6285448198" );
+      // Emulated modules, so lift the duty cycle to measure the fleet
+      // rather than the regulations
+      fleet.command( i, "mac set ch dcycle 0 0" );
+      fleet.command( i, "mac set ch dcycle 1 0" );
+      fleet.command( i, "mac set ch dcycle 2 0" );
+      fleet.command( i, "mac join otaa" );
+  }
+  bool joined = fleet.runUntilIdle( 60000 ) && fleet.failures() == 0;
+  double joinSeconds = ( ::millis() - start ) / 1000.0;
+
+  unsigned long commands = fleet.commandsDone();
+  double cpu = cpuSeconds();
+  unsigned long wall = ::millis();
+  start = ::millis();
+  runFor( fleet, false, phase );
+  fleet.runUntilIdle( 5000 );
+  double commandRate = ( fleet.commandsDone() - commands ) * 1000.0 / ( ::millis() - start );
+
+  unsigned long uplinks = fleet.uplinksDone();
+  start = ::millis();
+  runFor( fleet, true, phase );
+  fleet.runUntilIdle( 30000 );
+  double elapsed = ::millis() - start;
+  double uplinkRate = ( fleet.uplinksDone() - uplinks ) * 1000.0 / elapsed;
+
+  printf( "%7zu %9.1f%s %12.1f %10.2f %10.1f %9lu\n", count, joinSeconds, joined ? " " : "!",
+          commandRate, uplinkRate, ( cpuSeconds() - cpu ) * 100.0 / ( ( ::millis() - wall ) / 1000.0 ),
+          fleet.failures() );
+  return joined && fleet.failures() == 0;
+}
+
+int main(int argc, char **argv)
+{
+  size_t max = 32;
+  unsigned long phase = 5000;
+  for ( int i = 1; i + 1 < argc; i += 2 ) {
+      if ( strcmp( argv[i], "-n" ) == 0 ) {
+          max = atoi( argv[i + 1] );
+      } else if ( strcmp( argv[i], "-t" ) == 0 ) {
+          phase = atoi( argv[i + 1] ) * 1000UL;
+      }
+  }
+
+  printf( "%7s %10s %12s %10s %10s %9s\n", "modules", "join s", "commands/s", "uplinks/s", "cpu %", "failures" );
+  // Every size runs, a failure in one only decides the exit status
+  bool ok = true;
+  for ( size_t n = 1; n <= max; n *= 2 ) {
+      ok &= benchFleet( n, phase );
+  }
+  return ok ? 0 : 1;
+}
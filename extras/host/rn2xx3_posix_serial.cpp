@@ -0,0 +1,213 @@
+/*
+ * Stream over a POSIX serial port.
+ */
+
+#include "rn2xx3_posix_serial.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+static speed_t baudConstant(unsigned long baud)
+{
+  switch ( baud ) {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+#ifdef B460800
+    case 460800: return B460800;
+#endif
+#ifdef B921600
+    case 921600: return B921600;
+#endif
+    default: return 0;
+  }
+}
+
+rn2xx3_posix_serial::rn2xx3_posix_serial()
+  : _fd(-1), _head(0), _tail(0)
+{
+  // The library does its own timeouts
+  setTimeout( 0 );
+}
+
+rn2xx3_posix_serial::~rn2xx3_posix_serial()
+{
+  close();
+}
+
+bool rn2xx3_posix_serial::open(const char *path, unsigned long baud)
+{
+  int fd = ::open( path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC );
+  if ( fd < 0 ) {
+      return false;
+  }
+  if ( !attach( fd, baud ) ) {
+      int saved = errno;
+      close();
+      errno = saved;
+      return false;
+  }
+  return true;
+}
+
+bool rn2xx3_posix_serial::attach(int fd, unsigned long baud)
+{
+  close();
+  _fd = fd;
+
+  int flags = fcntl( fd, F_GETFL );
+  if ( flags < 0 || fcntl( fd, F_SETFL, flags | O_NONBLOCK ) < 0 ) {
+      return false;
+  }
+
+  struct termios tio;
+  if ( tcgetattr( fd, &tio ) < 0 ) {
+      return false;
+  }
+  cfmakeraw( &tio );
+  tio.c_cflag |= CLOCAL | CREAD;
+  tio.c_cflag &= ~( CSTOPB | CRTSCTS );
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  if ( tcsetattr( fd, TCSANOW, &tio ) < 0 ) {
+      return false;
+  }
+
+  return setBaud( baud );
+}
+
+void rn2xx3_posix_serial::close()
+{
+  if ( _fd >= 0 ) {
+      ::close( _fd );
+      _fd = -1;
+  }
+  _head = _tail = 0;
+}
+
+bool rn2xx3_posix_serial::setBaud(unsigned long baud)
+{
+  speed_t speed = baudConstant( baud );
+  if ( speed == 0 ) {
+      errno = EINVAL;
+      return false;
+  }
+
+  struct termios tio;
+  if ( tcgetattr( _fd, &tio ) < 0 ) {
+      return false;
+  }
+  cfsetispeed( &tio, speed );
+  cfsetospeed( &tio, speed );
+  return tcsetattr( _fd, TCSADRAIN, &tio ) == 0;
+}
+
+bool rn2xx3_posix_serial::fill()
+{
+  if ( _fd < 0 ) {
+      return false;
+  }
+  if ( _head == _tail ) {
+      _head = _tail = 0;
+  }
+  if ( _tail == sizeof( _buf ) ) {
+      // Full; the reader has to catch up first
+      return true;
+  }
+
+  ssize_t n = ::read( _fd, _buf + _tail, sizeof( _buf ) - _tail );
+  if ( n > 0 ) {
+      _tail += n;
+      return true;
+  }
+  if ( n == 0 ) {
+      // A pty whose other side went away
+      return false;
+  }
+  return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+bool rn2xx3_posix_serial::waitReadable(int timeout)
+{
+  if ( _head != _tail ) {
+      return true;
+  }
+  if ( _fd < 0 ) {
+      return false;
+  }
+
+  struct pollfd p;
+  p.fd = _fd;
+  p.events = POLLIN;
+  if ( poll( &p, 1, timeout ) <= 0 ) {
+      return false;
+  }
+  fill();
+  return _head != _tail;
+}
+
+int rn2xx3_posix_serial::available()
+{
+  if ( _head == _tail ) {
+      fill();
+  }
+  return _tail - _head;
+}
+
+int rn2xx3_posix_serial::read()
+{
+  if ( available() == 0 ) {
+      return -1;
+  }
+  return _buf[_head++];
+}
+
+int rn2xx3_posix_serial::peek()
+{
+  if ( available() == 0 ) {
+      return -1;
+  }
+  return _buf[_head];
+}
+
+void rn2xx3_posix_serial::flush()
+{
+  if ( _fd >= 0 ) {
+      tcdrain( _fd );
+  }
+}
+
+size_t rn2xx3_posix_serial::write(uint8_t c)
+{
+  return write( &c, 1 );
+}
+
+size_t rn2xx3_posix_serial::write(const uint8_t *buffer, size_t size)
+{
+  size_t done = 0;
+  while ( _fd >= 0 && done < size ) {
+      ssize_t n = ::write( _fd, buffer + done, size - done );
+      if ( n > 0 ) {
+          done += n;
+      } else if ( n < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) ) {
+          struct pollfd p;
+          p.fd = _fd;
+          p.events = POLLOUT;
+          if ( poll( &p, 1, 1000 ) <= 0 ) {
+              // Nobody is reading the other end
+              break;
+          }
+      } else if ( n < 0 && errno == EINTR ) {
+          continue;
+      } else {
+          break;
+      }
+  }
+  return done;
+}
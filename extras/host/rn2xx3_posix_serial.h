@@ -0,0 +1,91 @@
+/*
+ * Stream over a POSIX serial port, for running the rn2xx3 library on a
+ * Linux host against a USB-UART (/dev/ttyUSB0, /dev/ttyACM0) or one side
+ * of a pseudo-terminal.
+ *
+ * The file descriptor is non-blocking. Bytes are read in chunks into a
+ * small buffer, so a reply line costs one or two read() calls instead of
+ * one per byte, and waiting for data is done with poll().
+ */
+
+#ifndef rn2xx3_posix_serial_h
+#define rn2xx3_posix_serial_h
+
+#include "Arduino.h"
+#include "rn2xx3_clock.h"
+
+class rn2xx3_posix_serial : public Stream
+{
+  public:
+    rn2xx3_posix_serial();
+    ~rn2xx3_posix_serial();
+
+    /*
+     * Open a serial device in raw 8N1 mode at the given baud rate.
+     * Returns false, with errno set, if the device can not be opened or
+     * does not support the rate.
+     */
+    bool open(const char *path, unsigned long baud = 57600);
+
+    /*
+     * Use an already open file descriptor, e.g. the slave side of an
+     * openpty() pair. It is switched to raw, non-blocking mode and closed
+     * by close() or the destructor.
+     */
+    bool attach(int fd, unsigned long baud = 57600);
+
+    void close();
+    int fd() const { return _fd; }
+
+    /*
+     * Change the baud rate of the open port.
+     */
+    bool setBaud(unsigned long baud);
+
+    /*
+     * Wait up to timeout milliseconds for bytes to read.
+     * Returns true if there are some.
+     */
+    bool waitReadable(int timeout);
+
+    /*
+     * Read whatever the kernel has for this port into the buffer, without
+     * waiting. Returns false if the port was closed or failed.
+     */
+    bool fill();
+
+    // Stream
+    int available();
+    int read();
+    int peek();
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    // Waits until everything written is on the wire
+    void flush();
+
+  private:
+    int _fd;
+    uint8_t _buf[256];
+    uint16_t _head;
+    uint16_t _tail;
+};
+
+/*
+ * Wall clock whose idle() sleeps in poll() until the port has data, so a
+ * library waiting for a reply does not spin on the CPU.
+ */
+class rn2xx3_posix_clock : public rn2xx3_clock
+{
+  public:
+    rn2xx3_posix_clock(rn2xx3_posix_serial &port, int idleTimeout = 10)
+      : _port(port), _idleTimeout(idleTimeout) {}
+
+    void idle() { _port.waitReadable( _idleTimeout ); }
+
+  private:
+    rn2xx3_posix_serial &_port;
+    int _idleTimeout;
+};
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * Provision a tray of RN2xx3 modules in parallel from a Linux host.
+ *
+ * Usage: rn2xx3_provision [-p <profile>] [-o <manifest>] <device>...
+ *        rn2xx3_provision [-p <profile>] [-o <manifest>] --pty <count>
+ *   -p     key=value file with the settings to program, see below
+ *   -o     write the manifest there instead of to stdout, as JSON when
+ *          the name ends in .json and as CSV otherwise
+ *   --pty  provision emulated modules behind openpty() pairs
+ *
+ * The profile:
+ *
+ *   appeui=70B3D57ED00001A6
+ *   appkey=random      # or 32 hex digits shared by all modules
+ *   deveui=hweui       # or 16 hex digits, for a single module
+ *   plan=TTN_EU        # SINGLE_CHANNEL_EU, TTN_EU, TTN_US, DEFAULT_EU or none
+ *
+ * Every module reads its hardware EUI, resets its MAC, gets the keys and
+ * the frequency plan, saves them to EEPROM and reads back what can be
+ * read back. All modules run at once on rn2xx3_fleet, so a tray takes
+ * about as long as its slowest module. The manifest has one line per
+ * module with its keys, the result and the time it took.
+ */
+
+#include "Arduino.h"
+#include "rn2xx3_fleet.h"
+#include "rn2xx3_freqplan.h"
+#include "rn2xx3_pty_farm.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+struct profile {
+  std::string appeui;
+  std::string appkey;
+  std::string deveui;
+  const rn2xx3_plan *plan;
+  RN2xx3_t module;
+
+  profile() : appkey("random"), deveui("hweui"), plan(NULL), module(RN2483) {}
+};
+
+struct unit {
+  std::string device;
+  std::string hweui;
+  std::string deveui;
+  std::string appkey;
+  // The reply expected to each queued command, empty for any
+  std::deque<std::string> expect;
+  std::string error;
+  unsigned long start;
+  unsigned long done;
+};
+
+struct provisioner {
+  rn2xx3_fleet fleet;
+  profile prof;
+  std::vector<unit> units;
+};
+
+static bool isHex(const std::string &s, size_t length)
+{
+  if ( s.size() != length ) {
+      return false;
+  }
+  for ( size_t i = 0; i < s.size(); i++ ) {
+      if ( !isxdigit( (unsigned char)s[i] ) ) {
+          return false;
+      }
+  }
+  return true;
+}
+
+static std::string trim(const std::string &s)
+{
+  size_t first = s.find_first_not_of( " \t\r\n" );
+  if ( first == std::string::npos ) {
+      return "";
+  }
+  return s.substr( first, s.find_last_not_of( " \t\r\n" ) - first + 1 );
+}
+
+static bool loadProfile(const char *path, profile &prof)
+{
+  FILE *f = fopen( path, "r" );
+  if ( f == NULL ) {
+      perror( path );
+      return false;
+  }
+
+  bool ok = true;
+  char line[256];
+  for ( int number = 1; fgets( line, sizeof( line ), f ) != NULL; number++ ) {
+      std::string l( line );
+      l = trim( l.substr( 0, l.find( '#' ) ) );
+      if ( l.empty() ) {
+          continue;
+      }
+      size_t eq = l.find( '=' );
+      std::string key = eq == std::string::npos ? l : trim( l.substr( 0, eq ) );
+      std::string value = eq == std::string::npos ? "" : trim( l.substr( eq + 1 ) );
+
+      if ( key == "appeui" && isHex( value, 16 ) ) {
+          prof.appeui = value;
+      } else if ( key == "appkey" && ( value == "random" || isHex( value, 32 ) ) ) {
+          prof.appkey = value;
+      } else if ( key == "deveui" && ( value == "hweui" || isHex( value, 16 ) ) ) {
+          prof.deveui = value;
+      } else if ( key == "plan" && value == "SINGLE_CHANNEL_EU" ) {
+          prof.plan = &rn2xx3_plan_single_channel_eu;
+      } else if ( key == "plan" && value == "TTN_EU" ) {
+          prof.plan = &rn2xx3_plan_ttn_eu;
+      } else if ( key == "plan" && value == "TTN_US" ) {
+          prof.plan = &rn2xx3_plan_ttn_us;
+      } else if ( key == "plan" && value == "DEFAULT_EU" ) {
+          prof.plan = &rn2xx3_plan_default_eu;
+      } else if ( key == "plan" && value == "none" ) {
+          prof.plan = NULL;
+      } else {
+          fprintf( stderr, "%s:%d: invalid setting '%s'\n", path, number, l.c_str() );
+          ok = false;
+      }
+  }
+  fclose( f );
+
+  if ( prof.plan != NULL ) {
+      prof.module = (RN2xx3_t)prof.plan->module;
+  }
+  return ok;
+}
+
+static std::string randomKey()
+{
+  uint8_t key[16];
+  FILE *f = fopen( "/dev/urandom", "r" );
+  if ( f == NULL || fread( key, 1, sizeof( key ), f ) != sizeof( key ) ) {
+      perror( "/dev/urandom" );
+      exit( 1 );
+  }
+  fclose( f );
+
+  std::string hex;
+  char b[3];
+  for ( size_t i = 0; i < sizeof( key ); i++ ) {
+      snprintf( b, sizeof( b ), "%02X", key[i] );
+      hex += b;
+  }
+  return hex;
+}
+
+static void queue(provisioner &p, size_t i, const std::string &command, const std::string &expect = "ok")
+{
+  p.fleet.command( i, command.c_str() );
+  p.units[i].expect.push_back( expect );
+}
+
+static std::string number(const char *fmt, unsigned long a, unsigned long b = 0)
+{
+  char s[64];
+  snprintf( s, sizeof( s ), fmt, a, b );
+  return s;
+}
+
+/*
+ * The same "mac set" commands as rn2xx3::setFrequencyPlan(), followed by
+ * the "mac get" commands that check them. The plans are plain memory on
+ * the host.
+ */
+static void queuePlan(provisioner &p, size_t i, const rn2xx3_plan &plan)
+{
+  std::vector<std::pair<std::string, std::string> > checks;
+
+  if ( plan.rx2Freq != 0 ) {
+      queue( p, i, number( "mac set rx2 %lu %lu", plan.rx2Dr, plan.rx2Freq ) );
+      checks.push_back( std::make_pair( "mac get rx2", number( "%lu %lu", plan.rx2Dr, plan.rx2Freq ) ) );
+  }
+
+  for ( uint8_t c = 0; c < plan.channelCount; c++ ) {
+      const rn2xx3_plan_channel &ch = plan.channels[c];
+      if ( ch.flags & RN2XX3_CH_FREQ ) {
+          queue( p, i, number( "mac set ch freq %lu %lu", ch.channel, ch.freq ) );
+          checks.push_back( std::make_pair( number( "mac get ch freq %lu", ch.channel ),
+                                            number( "%lu", ch.freq ) ) );
+      }
+      if ( ch.flags & RN2XX3_CH_DRRANGE ) {
+          queue( p, i, number( "mac set ch drrange %lu %lu", ch.channel, ch.drrange >> 4 )
+                       + number( " %lu", ch.drrange & 0x0F ) );
+      }
+      if ( ch.flags & RN2XX3_CH_DCYCLE ) {
+          queue( p, i, number( "mac set ch dcycle %lu %lu", ch.channel, ch.dcycle ) );
+      }
+      if ( ch.flags & ( RN2XX3_CH_STATUS_ON | RN2XX3_CH_STATUS_OFF ) ) {
+          const char *status = ( ch.flags & RN2XX3_CH_STATUS_ON ) ? "on" : "off";
+          queue( p, i, number( "mac set ch status %lu ", ch.channel ) + status );
+          checks.push_back( std::make_pair( number( "mac get ch status %lu", ch.channel ), status ) );
+      }
+  }
+
+  if ( plan.subBand != 0 ) {
+      unsigned long first = ( plan.subBand - 1 ) * 8;
+      for ( unsigned long channel = 0; channel < 72; channel++ ) {
+          bool on = channel >= first && channel < first + 8;
+          queue( p, i, number( "mac set ch status %lu ", channel ) + ( on ? "on" : "off" ) );
+      }
+      checks.push_back( std::make_pair( number( "mac get ch status %lu", first ), "on" ) );
+  }
+
+  for ( size_t c = 0; c < checks.size(); c++ ) {
+      queue( p, i, checks[c].first, checks[c].second );
+  }
+}
+
+// Everything after "sys get hweui", which the deveui may depend on
+static void queueProfile(provisioner &p, size_t i)
+{
+  unit &u = p.units[i];
+  const profile &prof = p.prof;
+
+  u.deveui = prof.deveui == "hweui" ? u.hweui : prof.deveui;
+  u.appkey = prof.appkey == "random" ? randomKey() : prof.appkey;
+
+  queue( p, i, prof.module == RN2903 ? "mac reset" : "mac reset 868" );
+  queue( p, i, "mac set deveui " + u.deveui );
+  queue( p, i, "mac set appeui " + prof.appeui );
+  queue( p, i, "mac set appkey " + u.appkey );
+  if ( prof.plan != NULL ) {
+      queuePlan( p, i, *prof.plan );
+  }
+  queue( p, i, "mac save" );
+
+  // The appkey can't be read back, the module answers invalid_param
+  queue( p, i, "mac get deveui", u.deveui );
+  queue( p, i, "mac get appeui", prof.appeui );
+}
+
+static void done(void *context, size_t i, const char *job, TX_RETURN_TYPE result, const char *reply)
+{
+  provisioner &p = *(provisioner *)context;
+  unit &u = p.units[i];
+
+  std::string expect = u.expect.front();
+  u.expect.pop_front();
+
+  if ( u.error.empty() ) {
+      if ( result != TX_SUCCESS ) {
+          u.error = std::string( job ) + ": no reply";
+      } else if ( strcmp( job, "sys get hweui" ) == 0 ) {
+          if ( isHex( reply, 16 ) ) {
+              u.hweui = reply;
+              queueProfile( p, i );
+          } else {
+              u.error = std::string( job ) + ": " + reply;
+          }
+      } else if ( !expect.empty() && expect != reply ) {
+          u.error = std::string( job ) + ": " + reply + ", expected " + expect;
+      }
+      if ( !u.error.empty() ) {
+          // Nothing more for this module, above all no mac save of a
+          // partial configuration
+          p.fleet.cancel( i );
+          u.expect.clear();
+      }
+  }
+
+  if ( u.expect.empty() ) {
+      u.done = ::millis();
+  }
+}
+
+static bool writeManifest(const provisioner &p, const char *path)
+{
+  FILE *f = path == NULL ? stdout : fopen( path, "w" );
+  if ( f == NULL ) {
+      perror( path );
+      return false;
+  }
+
+  size_t length = path == NULL ? 0 : strlen( path );
+  bool json = length >= 5 && strcmp( path + length - 5, ".json" ) == 0;
+
+  if ( json ) {
+      fprintf( f, "[\n" );
+  } else {
+      fprintf( f, "device,hweui,deveui,appeui,appkey,result,ms\n" );
+  }
+  for ( size_t i = 0; i < p.units.size(); i++ ) {
+      const unit &u = p.units[i];
+      const char *result = u.error.empty() ? "ok" : u.error.c_str();
+      unsigned long ms = u.done - u.start;
+      if ( json ) {
+          fprintf( f, "  { \"device\": \"%s\", \"hweui\": \"%s\", \"deveui\": \"%s\", \"appeui\": \"%s\", "
+                      "\"appkey\": \"%s\", \"result\": \"%s\", \"ms\": %lu }%s\n",
+                   u.device.c_str(), u.hweui.c_str(), u.deveui.c_str(), p.prof.appeui.c_str(),
+                   u.appkey.c_str(), result, ms, i + 1 < p.units.size() ? "," : "" );
+      } else {
+          fprintf( f, "%s,%s,%s,%s,%s,%s,%lu\n", u.device.c_str(), u.hweui.c_str(), u.deveui.c_str(),
+                   p.prof.appeui.c_str(), u.appkey.c_str(), result, ms );
+      }
+  }
+  if ( json ) {
+      fprintf( f, "]\n" );
+  }
+
+  return f == stdout || fclose( f ) == 0;
+}
+
+int main(int argc, char **argv)
+{
+  provisioner p;
+  const char *manifest = NULL;
+  const char *profilePath = NULL;
+  int pty = 0;
+  std::vector<const char *> devices;
+
+  for ( int i = 1; i < argc; i++ ) {
+      if ( strcmp( argv[i], "-p" ) == 0 && i + 1 < argc ) {
+          profilePath = argv[++i];
+      } else if ( strcmp( argv[i], "-o" ) == 0 && i + 1 < argc ) {
+          manifest = argv[++i];
+      } else if ( strcmp( argv[i], "--pty" ) == 0 && i + 1 < argc ) {
+          pty = atoi( argv[++i] );
+      } else {
+          devices.push_back( argv[i] );
+      }
+  }
+  if ( devices.empty() == ( pty <= 0 ) ) {
+      fprintf( stderr, "usage: %s [-p <profile>] [-o <manifest>] <device>...|--pty <count>\n", argv[0] );
+      return 2;
+  }
+  if ( profilePath != NULL && !loadProfile( profilePath, p.prof ) ) {
+      return 1;
+  }
+  if ( p.prof.appeui.empty() ) {
+      fprintf( stderr, "no appeui in the profile\n" );
+      return 1;
+  }
+  if ( p.prof.deveui != "hweui" && devices.size() + pty > 1 ) {
+      fprintf( stderr, "a fixed deveui can only go to one module\n" );
+      return 1;
+  }
+
+  rn2xx3_pty_farm farm;
+  for ( int i = 0; i < pty; i++ ) {
+      int fd = farm.add( p.prof.module );
+      if ( fd < 0 || p.fleet.attach( fd ) < 0 ) {
+          perror( "pty" );
+          return 1;
+      }
+      char hweui[24];
+      snprintf( hweui, sizeof( hweui ), "0004A30B00%06X", i );
+      farm.module( i ).setHweui( hweui );
+      devices.push_back( "pty" );
+  }
+  if ( pty > 0 ) {
+      if ( !farm.start() ) {
+          perror( "farm" );
+          return 1;
+      }
+      // Let the power-on banners arrive, so the first command drains them
+      // instead of taking one for its reply
+      delay( 50 );
+  } else {
+      for ( size_t i = 0; i < devices.size(); i++ ) {
+          if ( p.fleet.open( devices[i] ) < 0 ) {
+              perror( devices[i] );
+              return 1;
+          }
+      }
+  }
+
+  p.units.resize( devices.size() );
+  p.fleet.onDone( done, &p );
+  unsigned long start = ::millis();
+  for ( size_t i = 0; i < p.units.size(); i++ ) {
+      p.units[i].device = devices[i];
+      p.units[i].start = start;
+      queue( p, i, "sys get hweui", "" );
+  }
+
+  bool finished = p.fleet.runUntilIdle( 60000 );
+  unsigned long elapsed = ::millis() - start;
+
+  size_t failed = 0;
+  unsigned long sum = 0, slowest = 0;
+  for ( size_t i = 0; i < p.units.size(); i++ ) {
+      unit &u = p.units[i];
+      if ( !u.expect.empty() ) {
+          u.done = ::millis();
+          if ( u.error.empty() ) {
+              u.error = "timeout";
+          }
+      }
+      if ( !u.error.empty() ) {
+          failed++;
+      }
+      unsigned long ms = u.done - u.start;
+      sum += ms;
+      slowest = ms > slowest ? ms : slowest;
+  }
+
+  if ( !writeManifest( p, manifest ) ) {
+      return 1;
+  }
+  fprintf( stderr, "%zu modules in %lu ms, %lu ms per module on average, %lu ms the slowest, %zu failed\n",
+           p.units.size(), elapsed, sum / p.units.size(), slowest, failed );
+  return finished && failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+/*
+ * Emulated RN2xx3 modules behind pseudo-terminals.
+ */
+
+#include "rn2xx3_pty_farm.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pty.h>
+#include <sys/epoll.h>
+#include <termios.h>
+#include <unistd.h>
+
+rn2xx3_pty_farm::rn2xx3_pty_farm()
+  : _epoll(-1), _running(false)
+{
+}
+
+rn2xx3_pty_farm::~rn2xx3_pty_farm()
+{
+  stop();
+  for ( size_t i = 0; i < _modules.size(); i++ ) {
+      close( _modules[i]->master );
+      delete _modules[i]->emulator;
+      delete _modules[i];
+  }
+}
+
+int rn2xx3_pty_farm::add(RN2xx3_t type)
+{
+  if ( _running ) {
+      errno = EBUSY;
+      return -1;
+  }
+
+  int master, slave;
+  if ( openpty( &master, &slave, NULL, NULL, NULL ) < 0 ) {
+      return -1;
+  }
+  // Raw line settings, shared by both sides, so nothing is echoed
+  struct termios tio;
+  tcgetattr( slave, &tio );
+  cfmakeraw( &tio );
+  tcsetattr( slave, TCSANOW, &tio );
+  fcntl( master, F_SETFL, fcntl( master, F_GETFL ) | O_NONBLOCK );
+  fcntl( master, F_SETFD, FD_CLOEXEC );
+
+  entry *e = new entry;
+  e->master = master;
+  e->emulator = new rn2xx3_emulator( type );
+  e->watchOut = false;
+  _modules.push_back( e );
+  return slave;
+}
+
+bool rn2xx3_pty_farm::start()
+{
+  if ( _running ) {
+      return true;
+  }
+  _epoll = epoll_create1( EPOLL_CLOEXEC );
+  if ( _epoll < 0 ) {
+      return false;
+  }
+  for ( size_t i = 0; i < _modules.size(); i++ ) {
+      struct epoll_event ev;
+      ev.events = EPOLLIN;
+      ev.data.ptr = _modules[i];
+      epoll_ctl( _epoll, EPOLL_CTL_ADD, _modules[i]->master, &ev );
+  }
+  _running = true;
+  if ( pthread_create( &_thread, NULL, run, this ) != 0 ) {
+      _running = false;
+      return false;
+  }
+  return true;
+}
+
+void rn2xx3_pty_farm::stop()
+{
+  if ( !_running ) {
+      return;
+  }
+  _running = false;
+  pthread_join( _thread, NULL );
+  close( _epoll );
+  _epoll = -1;
+}
+
+void rn2xx3_pty_farm::serve(entry *e, bool readable)
+{
+  if ( readable ) {
+      uint8_t in[256];
+      ssize_t n;
+      while ( ( n = read( e->master, in, sizeof( in ) ) ) > 0 ) {
+          for ( ssize_t i = 0; i < n; i++ ) {
+              e->emulator->write( in[i] );
+          }
+      }
+  }
+
+  while ( e->unsent.size() < 256 && e->emulator->available() ) {
+      e->unsent += (char)e->emulator->read();
+  }
+  if ( !e->unsent.empty() ) {
+      ssize_t n = write( e->master, e->unsent.data(), e->unsent.size() );
+      if ( n > 0 ) {
+          e->unsent.erase( 0, n );
+      }
+  }
+
+  // Keep what a full pty did not take, and wake up when it has room again
+  bool watchOut = !e->unsent.empty();
+  if ( watchOut != e->watchOut ) {
+      struct epoll_event ev;
+      ev.events = watchOut ? EPOLLIN | EPOLLOUT : EPOLLIN;
+      ev.data.ptr = e;
+      epoll_ctl( _epoll, EPOLL_CTL_MOD, e->master, &ev );
+      e->watchOut = watchOut;
+  }
+}
+
+void *rn2xx3_pty_farm::run(void *arg)
+{
+  rn2xx3_pty_farm *farm = (rn2xx3_pty_farm *)arg;
+  struct epoll_event events[64];
+
+  while ( farm->_running ) {
+      // Sleep until the first emulator has a byte due, at most 10ms
+      uint64_t now = ::micros();
+      uint64_t next = now + 10000;
+      for ( size_t i = 0; i < farm->_modules.size(); i++ ) {
+          uint64_t t = farm->_modules[i]->emulator->nextEvent();
+          if ( t < next ) {
+              next = t;
+          }
+      }
+      int timeout = next > now ? ( next - now + 999 ) / 1000 : 0;
+
+      int n = epoll_wait( farm->_epoll, events, 64, timeout );
+      for ( int i = 0; i < n; i++ ) {
+          farm->serve( (entry *)events[i].data.ptr, events[i].events & EPOLLIN );
+      }
+      for ( size_t i = 0; i < farm->_modules.size(); i++ ) {
+          farm->serve( farm->_modules[i], false );
+      }
+  }
+  return NULL;
+}
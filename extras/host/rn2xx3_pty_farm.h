@@ -0,0 +1,57 @@
+/*
+ * Emulated RN2xx3 modules behind pseudo-terminals.
+ *
+ * Every module is an rn2xx3_emulator on the wall clock, wired to the
+ * master side of an openpty() pair. One background thread serves them
+ * all with epoll, so from the outside each looks like a module plugged
+ * into a USB-UART: the slave side can be opened with rn2xx3_posix_serial.
+ */
+
+#ifndef rn2xx3_pty_farm_h
+#define rn2xx3_pty_farm_h
+
+#include "Arduino.h"
+#include "rn2xx3_emulator.h"
+
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+class rn2xx3_pty_farm
+{
+  public:
+    rn2xx3_pty_farm();
+    ~rn2xx3_pty_farm();
+
+    /*
+     * Add a module. Returns the file descriptor of the slave side, which
+     * the caller owns, or -1 with errno set. Modules can only be added
+     * before start().
+     */
+    int add(RN2xx3_t type = RN2483);
+
+    bool start();
+    void stop();
+
+    size_t size() const { return _modules.size(); }
+    rn2xx3_emulator &module(size_t i) { return *_modules[i]->emulator; }
+
+  private:
+    struct entry {
+      int master;
+      rn2xx3_emulator *emulator;
+      // Output the pty did not take yet, and whether EPOLLOUT is on for it
+      std::string unsent;
+      bool watchOut;
+    };
+
+    std::vector<entry *> _modules;
+    int _epoll;
+    pthread_t _thread;
+    volatile bool _running;
+
+    static void *run(void *farm);
+    void serve(entry *e, bool readable);
+};
+
+#endif
@@ -0,0 +1,22 @@
+/*
+ * Simulated clock for running the rn2xx3 library against emulated modules.
+ */
+
+#include "rn2xx3_sim_clock.h"
+
+// How far time moves when nothing is scheduled, so timeouts still expire
+static const uint64_t IDLE_STEP_MICROS = 1000;
+
+void rn2xx3_sim_clock::idle()
+{
+  uint64_t next = _now + IDLE_STEP_MICROS;
+  for ( size_t i = 0; i < _sources.size(); i++ ) {
+      uint64_t event = _sources[i]->nextEvent();
+      if ( event < next ) {
+          next = event;
+      }
+  }
+  if ( next > _now ) {
+      _now = next;
+  }
+}
@@ -0,0 +1,52 @@
+/*
+ * Simulated clock for running the rn2xx3 library against emulated modules.
+ *
+ * Time only moves when the library delays or idles. While idling it jumps
+ * straight to the next moment one of the registered sources (typically
+ * rn2xx3_emulator instances) has something to deliver, so protocol
+ * timeouts of minutes complete in microseconds of wall time.
+ */
+
+#ifndef rn2xx3_sim_clock_h
+#define rn2xx3_sim_clock_h
+
+#include "Arduino.h"
+#include "rn2xx3_clock.h"
+
+#include <vector>
+
+class rn2xx3_sim_clock : public rn2xx3_clock
+{
+  public:
+    /*
+     * Something that knows when it will next have data for the host.
+     */
+    class source
+    {
+      public:
+        virtual ~source() {}
+
+        // The next event time in microseconds, or UINT64_MAX if none
+        virtual uint64_t nextEvent() = 0;
+    };
+
+    rn2xx3_sim_clock() : _now(0) {}
+
+    unsigned long millis() { return _now / 1000; }
+    unsigned long micros() { return _now; }
+    void delay(unsigned long ms) { _now += (uint64_t)ms * 1000; }
+    void idle();
+
+    void addSource(source *s) { _sources.push_back(s); }
+
+    /*
+     * Move time forward by the given number of microseconds.
+     */
+    void advance(uint64_t us) { _now += us; }
+
+  private:
+    uint64_t _now;
+    std::vector<source *> _sources;
+};
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Talk to an RN2xx3 on a Linux serial port with the rn2xx3 library.
+ *
+ * Usage: rn2xx3_tty [-v] <device> [<AppEUI> <AppKey>]
+ *        rn2xx3_tty [-v] --pty [<AppEUI> <AppKey>]
+ *   -v     show the library's debug output
+ *   --pty  run against an emulated module behind an openpty() pair
+ *          instead of a real device
+ *
+ * Prints the firmware version and the hardware EUI. With keys it also
+ * joins over OTAA and sends one uplink.
+ */
+
+#include "Arduino.h"
+#include "rn2xx3.h"
+#include "rn2xx3_posix_serial.h"
+#include "rn2xx3_pty_farm.h"
+
+int main(int argc, char **argv)
+{
+  bool verbose = false;
+  bool pty = false;
+  const char *device = NULL;
+  const char *keys[2] = { NULL, NULL };
+  int nkeys = 0;
+
+  for ( int i = 1; i < argc; i++ ) {
+      if ( strcmp( argv[i], "-v" ) == 0 ) {
+          verbose = true;
+      } else if ( strcmp( argv[i], "--pty" ) == 0 ) {
+          pty = true;
+      } else if ( device == NULL && !pty ) {
+          device = argv[i];
+      } else if ( nkeys < 2 ) {
+          keys[nkeys++] = argv[i];
+      }
+  }
+  if ( ( device == NULL && !pty ) || nkeys == 1 ) {
+      fprintf( stderr, "usage: %s [-v] <device>|--pty [<AppEUI> <AppKey>]\n", argv[0] );
+      return 2;
+  }
+
+  rn2xx3_posix_serial port;
+  rn2xx3_pty_farm farm;
+
+  if ( pty ) {
+      int slave = farm.add( RN2483 );
+      if ( slave < 0 || !port.attach( slave ) || !farm.start() ) {
+          perror( "pty" );
+          return 1;
+      }
+  } else if ( !port.open( device, 57600 ) ) {
+      perror( device );
+      return 1;
+  }
+
+  rn2xx3_posix_clock clock( port );
+  rn2xx3 lora( &port, &clock );
+  if ( verbose ) {
+      lora.setDebugOutput( &Serial );
+  }
+
+  int rv = 0;
+  unsigned long start = ::millis();
+  if ( !lora.autobaud() ) {
+      fprintf( stderr, "no reply from the module\n" );
+      rv = 1;
+  } else {
+      printf( "autobaud         %lu ms\n", ::millis() - start );
+      printf( "version          %s\n", lora.sysver() );
+      printf( "hweui            %s\n", lora.hweui() );
+
+      if ( nkeys == 2 ) {
+          start = ::millis();
+          bool joined = lora.initOTAA( keys[0], keys[1] );
+          printf( "initOTAA         %s, %lu ms\n", joined ? "joined" : "FAILED", ::millis() - start );
+          if ( joined ) {
+              start = ::millis();
+              TX_RETURN_TYPE tx = lora.txUncnf( "Hello" );
+              printf( "txUncnf          %s, %lu ms\n", tx == TX_FAIL ? "FAILED" : "sent", ::millis() - start );
+              rv = tx == TX_FAIL ? 1 : 0;
+          } else {
+              rv = 1;
+          }
+      }
+  }
+
+  return rv;
+}
@@ -0,0 +1,715 @@
+/*
+ * Throughput and heap use of the Sodaq_UBlox_GPS NMEA parser, and the
+ * cost of a fix over I2C, replaying an NMEA log.
+ *
+ * Usage: sodaq_gps_bench [log [ubx]]
+ *   log  NMEA output of the receiver (default nmea/ublox7.nmea)
+ *   ubx  UBX NAV-DOP and NAV-PVT output of the same epochs (default
+ *        ubx/ublox7.ubx)
+ *
+ * The parser is compared with a copy of the String based one it replaced,
+ * run on a String that allocates like the Arduino core's. Both see the
+ * same sentences and their positions are checked against a double
+ * precision reference.
+ *
+ * Then the log is played back one epoch per second by ublox_ddc on the
+ * Wire stand-in, on simulated time, and scan() is compared with the old
+ * way of reading the DDC stream, one byte per transaction, which also
+ * left all NMEA messages on. The UBX
+ * recording is played back the same way, and its fixes must be the same
+ * as those from NMEA.
+ */
+
+#include "Arduino.h"
+#include "Sodaq_UBlox_GPS.h"
+#include "Wire.h"
+#include "ublox_ddc.h"
+
+#include <math.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <time.h>
+
+/*
+ * Heap accounting, for both malloc() through heapAlloc() and operator new
+ */
+static size_t heapInUse = 0;
+static size_t heapPeak = 0;
+static size_t heapAllocs = 0;
+
+static void *heapAlloc(size_t size)
+{
+  size_t *p = (size_t *)malloc( size + sizeof( size_t ) );
+  if ( p == NULL ) {
+      return NULL;
+  }
+  *p = size;
+  heapInUse += size;
+  heapAllocs++;
+  if ( heapInUse > heapPeak ) {
+      heapPeak = heapInUse;
+  }
+  return p + 1;
+}
+
+// Not inlined, so the compiler does not see ptr - 1 of a std::string
+__attribute__((noinline)) static void heapFree(void *ptr)
+{
+  if ( ptr == NULL ) {
+      return;
+  }
+  size_t *p = (size_t *)ptr - 1;
+  heapInUse -= *p;
+  free( p );
+}
+
+static void *heapRealloc(void *ptr, size_t size)
+{
+  void *p = heapAlloc( size );
+  if ( p != NULL && ptr != NULL ) {
+      size_t old = ((size_t *)ptr)[-1];
+      memcpy( p, ptr, old < size ? old : size );
+      heapFree( ptr );
+  }
+  return p;
+}
+
+void *operator new(size_t size)
+{
+  void *p = heapAlloc( size );
+  if ( p == NULL ) {
+      throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *ptr) noexcept
+{
+  heapFree( ptr );
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+  heapFree( ptr );
+}
+
+static void heapReset()
+{
+  heapPeak = heapInUse;
+  heapAllocs = 0;
+}
+
+/*
+ * The parts of the Arduino core's String the old parser used. Like the
+ * core it keeps an exact size buffer on the heap, and toFloat() is a float.
+ */
+class legacyString
+{
+  public:
+    legacyString(const char *s = "") { copy( s, strlen( s ) ); }
+    legacyString(const legacyString &s) { copy( s._buf, s._len ); }
+    ~legacyString() { heapFree( _buf ); }
+    legacyString &operator=(const legacyString &s)
+    {
+      if ( this != &s ) {
+          copy( s._buf, s._len );
+      }
+      return *this;
+    }
+
+    unsigned int length() const { return _len; }
+    char charAt(unsigned int i) const { return i < _len ? _buf[i] : 0; }
+    bool operator==(const char *s) const { return strcmp( _buf, s ) == 0; }
+    bool operator!=(const char *s) const { return !(*this == s); }
+    bool startsWith(const char *s) const { return strncmp( _buf, s, strlen( s ) ) == 0; }
+    long toInt() const { return atol( _buf ); }
+    float toFloat() const { return float( atof( _buf ) ); }
+
+    legacyString substring(unsigned int from, unsigned int to) const
+    {
+      legacyString out;
+      if ( from < to && to <= _len ) {
+          out.copy( _buf + from, to - from );
+      }
+      return out;
+    }
+
+    void remove(unsigned int index, unsigned int count)
+    {
+      if ( index < _len ) {
+          if ( count > _len - index ) {
+              count = _len - index;
+          }
+          memmove( _buf + index, _buf + index + count, _len - index - count + 1 );
+          _len -= count;
+      }
+    }
+
+  private:
+    void copy(const char *s, size_t len)
+    {
+      if ( _buf == NULL || len > _capacity ) {
+          _buf = (char *)heapRealloc( _buf, len + 1 );
+          _capacity = len;
+      }
+      memcpy( _buf, s, len );
+      _buf[len] = '\0';
+      _len = len;
+    }
+
+    char *_buf = NULL;
+    size_t _len = 0;
+    size_t _capacity = 0;
+};
+
+/*
+ * The old parser, as it was before the switch to fixed point, without
+ * its debug output
+ */
+struct legacyParser
+{
+  double lat = 0, lon = 0, alt = 0, hdop = 0;
+  uint8_t numSatellites = 0;
+  bool seenTime = false;
+  uint8_t hh = 0, mm = 0, ss = 0, dd = 0, MM = 0, yy = 0;
+
+  static legacyString getField(const legacyString &data, int index)
+  {
+    int found = 0;
+    int strIndex[] = { 0, -1 };
+    int maxIndex = data.length() - 1;
+
+    for ( int i = 0; i <= maxIndex && found <= index; i++ ) {
+        if ( data.charAt( i ) == ',' || i == maxIndex ) {
+            found++;
+            strIndex[0] = strIndex[1] + 1;
+            strIndex[1] = (i == maxIndex) ? i + 1 : i;
+        }
+    }
+
+    return found > index ? data.substring( strIndex[0], strIndex[1] ) : "";
+  }
+
+  static double convertDegMinToDecDeg(const legacyString &data)
+  {
+    double degMin = data.toFloat();
+    double min = fmod( (double)degMin, 100.0 );
+    degMin = (int)(degMin / 100);
+    return degMin + (min / 60);
+  }
+
+  void setDateTime(const legacyString &date, const legacyString &time)
+  {
+    if ( time.length() == 9 && date.length() == 6 ) {
+        hh = time.substring( 0, 2 ).toInt();
+        mm = time.substring( 2, 4 ).toInt();
+        ss = time.substring( 4, 6 ).toInt();
+        dd = date.substring( 0, 2 ).toInt();
+        MM = date.substring( 2, 4 ).toInt();
+        yy = date.substring( 4, 6 ).toInt();
+        seenTime = true;
+    }
+  }
+
+  bool parseLine(const char *line)
+  {
+    size_t len = strlen( line );
+    if ( len < 4 || line[0] != '$' || line[len - 3] != '*' ) {
+        return false;
+    }
+    uint8_t crc = 0;
+    for ( size_t i = 1; i < len - 3; ++i ) {
+        crc ^= line[i];
+    }
+    if ( crc != strtoul( line + len - 2, NULL, 16 ) ) {
+        return false;
+    }
+
+    legacyString data = line + 1;
+    data.remove( data.length() - 3, 3 );
+
+    if ( data.startsWith( "GPGGA" ) ) {
+        if ( getField( data, 6 ) != "0" ) {
+            lat = convertDegMinToDecDeg( getField( data, 2 ) );
+            if ( getField( data, 3 ) == "S" ) {
+                lat = -lat;
+            }
+            lon = convertDegMinToDecDeg( getField( data, 4 ) );
+            if ( getField( data, 5 ) == "W" ) {
+                lon = -lon;
+            }
+            hdop = getField( data, 8 ).toFloat();
+            if ( getField( data, 10 ) == "M" ) {
+                alt = getField( data, 9 ).toFloat();
+            }
+        }
+        numSatellites = getField( data, 7 ).toInt();
+        return true;
+    }
+    if ( data.startsWith( "GPRMC" ) ) {
+        if ( getField( data, 2 ) == "A" && getField( data, 12 ) != "N" ) {
+            lat = convertDegMinToDecDeg( getField( data, 3 ) );
+            if ( getField( data, 4 ) == "S" ) {
+                lat = -lat;
+            }
+            lon = convertDegMinToDecDeg( getField( data, 5 ) );
+            if ( getField( data, 6 ) == "W" ) {
+                lon = -lon;
+            }
+        }
+        legacyString time = getField( data, 1 );
+        legacyString date = getField( data, 9 );
+        setDateTime( date, time );
+        return true;
+    }
+    if ( data.startsWith( "GPGSV" ) ) {
+        numSatellites = getField( data, 3 ).toInt();
+        return true;
+    }
+    if ( data.startsWith( "GPTXT" ) ) {
+        getField( data, 4 );
+        return true;
+    }
+    return false;
+  }
+};
+
+/*
+ * dddmm.mmmmm in double precision
+ */
+static double referenceDegrees(const char *s)
+{
+  double degMin = atof( s );
+  int degrees = (int)(degMin / 100);
+  return degrees + (degMin - degrees * 100) / 60;
+}
+
+/*
+ * The position fields of a GGA or RMC sentence, or false for others
+ */
+static bool referencePosition(const char *line, double *lat, double *lon)
+{
+  int latField;
+  if ( strncmp( line, "$GPGGA,", 7 ) == 0 ) {
+      latField = 2;
+  } else if ( strncmp( line, "$GPRMC,", 7 ) == 0 ) {
+      latField = 3;
+  } else {
+      return false;
+  }
+  std::vector<std::string> fields;
+  std::string field;
+  for ( const char *p = line + 1; *p != '\0' && *p != '*'; ++p ) {
+      if ( *p == ',' ) {
+          fields.push_back( field );
+          field.clear();
+      } else {
+          field += *p;
+      }
+  }
+  fields.push_back( field );
+  if ( fields[latField].empty() ) {
+      return false;
+  }
+  *lat = referenceDegrees( fields[latField].c_str() );
+  if ( fields[latField + 1] == "S" ) {
+      *lat = -*lat;
+  }
+  *lon = referenceDegrees( fields[latField + 2].c_str() );
+  if ( fields[latField + 3] == "W" ) {
+      *lon = -*lon;
+  }
+  return true;
+}
+
+static double seconds()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct result
+{
+  double perSecond;
+  size_t peak;
+  double allocsPerSentence;
+};
+
+/*
+ * Parse all lines repeatedly for about half a second. Every line is
+ * copied first, as the new parser splits it in place.
+ */
+template <typename F> static result run(const std::vector<std::string> &lines, F parse)
+{
+  char buffer[128];
+  size_t sentences = 0;
+  heapReset();
+  size_t inUse = heapInUse;
+  double start = seconds();
+  double elapsed;
+  do {
+      for ( size_t i = 0; i < lines.size(); ++i ) {
+          strncpy( buffer, lines[i].c_str(), sizeof( buffer ) - 1 );
+          buffer[sizeof( buffer ) - 1] = '\0';
+          parse( buffer );
+      }
+      sentences += lines.size();
+      elapsed = seconds() - start;
+  } while ( elapsed < 0.5 );
+
+  result r;
+  r.perSecond = sentences / elapsed;
+  r.peak = heapPeak - inUse;
+  r.allocsPerSentence = (double)heapAllocs / sentences;
+  return r;
+}
+
+/*
+ * The DDC stream read as the driver did before, with one transaction
+ * per byte and without the bytes available registers
+ */
+struct legacyReader
+{
+  char buffer[128];
+  bool active = false;
+
+  uint8_t read()
+  {
+    if ( !active ) {
+        Wire.beginTransmission( ublox_ddc::ADDRESS );
+        active = true;
+    }
+    uint8_t b = 0xFF;
+    if ( Wire.requestFrom( ublox_ddc::ADDRESS, 1, false ) == 1 ) {
+        b = Wire.read();
+    }
+    return b;
+  }
+
+  bool readLine(uint32_t timeout = 10000)
+  {
+    uint32_t start = millis();
+    char c = 0;
+    char *ptr = buffer;
+    size_t cnt = 0;
+    *ptr = '\0';
+
+    while ( millis() - start <= timeout ) {
+        c = (char)read();
+        if ( c == '$' ) {
+            break;
+        }
+    }
+    if ( c != '$' ) {
+        return false;
+    }
+    *ptr++ = c;
+    ++cnt;
+
+    c = 0;
+    while ( millis() - start <= timeout ) {
+        c = (char)read();
+        if ( c == '\r' ) {
+            continue;
+        }
+        if ( c == '\n' ) {
+            break;
+        }
+        if ( cnt < sizeof( buffer ) - 1 ) {
+            *ptr++ = c;
+            ++cnt;
+        }
+    }
+    *ptr = '\0';
+    if ( c != '\n' ) {
+        return false;
+    }
+    Wire.endTransmission();
+    active = false;
+    return true;
+  }
+};
+
+/*
+ * Field index of an NMEA sentence, up to the next separator
+ */
+static const char *nmeaField(const char *line, int index)
+{
+  while ( index-- > 0 && (line = strchr( line, ',' )) != NULL ) {
+      line++;
+  }
+  return line != NULL ? line : "";
+}
+
+static bool nmeaFieldIs(const char *line, int index, const char *value)
+{
+  const char *field = nmeaField( line, index );
+  size_t len = strlen( value );
+  return strncmp( field, value, len ) == 0 && (field[len] == ',' || field[len] == '*');
+}
+
+/*
+ * What scan() waits for: a position, the time and the altitude
+ */
+struct fixTracker
+{
+  bool latLon = false, time = false, alt = false;
+
+  void see(const char *line)
+  {
+    if ( strncmp( line, "$GPRMC,", 7 ) == 0 ) {
+        time = true;
+        latLon |= nmeaFieldIs( line, 2, "A" ) && !nmeaFieldIs( line, 12, "N" );
+    } else if ( strncmp( line, "$GPGGA,", 7 ) == 0 && !nmeaFieldIs( line, 6, "0" ) ) {
+        latLon = true;
+        alt |= nmeaFieldIs( line, 10, "M" );
+    }
+  }
+
+  bool complete() const { return latLon && time && alt; }
+};
+
+/*
+ * scan() as it was, on legacyReader
+ */
+static bool legacyScan(Sodaq_UBlox_GPS &gps, legacyReader &reader, uint32_t timeout = 20000)
+{
+  fixTracker fix;
+  uint32_t start = millis();
+  delay( 500 );
+  while ( millis() - start <= timeout ) {
+      if ( !reader.readLine() ) {
+          continue;
+      }
+      fix.see( reader.buffer );
+      gps.parseLine( reader.buffer );
+      if ( fix.complete() ) {
+          return true;
+      }
+  }
+  return false;
+}
+
+static double cpuSeconds()
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+struct ddcResult
+{
+  unsigned long fixes;
+  unsigned long firstFix;       // ms
+  double scanMillis;
+  double bytes;
+  double transactions;
+  double busMillis;
+  double cpuMicros;
+};
+
+/*
+ * Scan for fixes until the recording runs out. The first fix waits for
+ * the receiver, so the averages are over the ones after it.
+ */
+template <typename S> static ddcResult runDdc(const std::vector<std::string> &epochs, S scan)
+{
+  ublox_ddc ddc;
+  Wire.attach( ublox_ddc::ADDRESS, &ddc );
+  ddc.play( epochs );
+
+  ddcResult r = ddcResult();
+  unsigned long start = millis();
+  unsigned long scanMillis = 0, bytes = 0, transactions = 0, busMicros = 0;
+  double cpu = 0;
+  while ( !ddc.done() ) {
+      unsigned long t = millis();
+      unsigned long sent = ddc.sent();
+      unsigned long n = Wire.transactions();
+      unsigned long bus = Wire.busMicros();
+      double c = cpuSeconds();
+      if ( !scan() ) {
+          break;
+      }
+      if ( r.fixes++ == 0 ) {
+          r.firstFix = millis() - start;
+          continue;
+      }
+      scanMillis += millis() - t;
+      bytes += ddc.sent() - sent;
+      transactions += Wire.transactions() - n;
+      busMicros += Wire.busMicros() - bus;
+      cpu += cpuSeconds() - c;
+  }
+  Wire.attach( ublox_ddc::ADDRESS, NULL );
+
+  unsigned long n = r.fixes > 1 ? r.fixes - 1 : 1;
+  r.scanMillis = (double)scanMillis / n;
+  r.bytes = (double)bytes / n;
+  r.transactions = (double)transactions / n;
+  r.busMillis = busMicros / 1000.0 / n;
+  r.cpuMicros = cpu * 1e6 / n;
+  return r;
+}
+
+/*
+ * What a fix gave, to compare NMEA and UBX
+ */
+struct fix
+{
+  int32_t latE7, lonE7;
+  int32_t altCm;
+  int32_t hdop100;
+  uint8_t hh, mm, ss;
+
+  fix(Sodaq_UBlox_GPS &gps)
+    : latE7( gps.getLatE7() ), lonE7( gps.getLonE7() ), altCm( lround( gps.getAlt() * 100 ) ),
+      hdop100( lround( gps.getHDOP() * 100 ) ), hh( gps.getHour() ), mm( gps.getMinute() ), ss( gps.getSecond() )
+  {
+  }
+
+  bool operator==(const fix &f) const
+  {
+    return latE7 == f.latE7 && lonE7 == f.lonE7 && altCm == f.altCm && hdop100 == f.hdop100
+           && hh == f.hh && mm == f.mm && ss == f.ss;
+  }
+};
+
+static std::string readFile(const char *path)
+{
+  std::string data;
+  FILE *f = fopen( path, "rb" );
+  if ( f == NULL ) {
+      perror( path );
+      exit( 1 );
+  }
+  char chunk[4096];
+  size_t size;
+  while ( (size = fread( chunk, 1, sizeof( chunk ), f )) > 0 ) {
+      data.append( chunk, size );
+  }
+  fclose( f );
+  return data;
+}
+
+/*
+ * Bytes per epoch, without the first, which is what came before the
+ * receiver started its epochs
+ */
+static double epochBytes(const std::vector<std::string> &epochs)
+{
+  size_t bytes = 0;
+  for ( size_t i = 1; i < epochs.size(); ++i ) {
+      bytes += epochs[i].size();
+  }
+  return epochs.size() > 1 ? (double)bytes / (epochs.size() - 1) : 0;
+}
+
+static void printDdc(const char *name, const ddcResult &r)
+{
+  printf( "%-16s %5lu %9lu %9.0f %6.0f %12.0f %9.1f %9.0f\n", name, r.fixes, r.firstFix,
+          r.scanMillis, r.bytes, r.transactions, r.busMillis, r.cpuMicros );
+}
+
+int main(int argc, char **argv)
+{
+  const char *path = argc > 1 ? argv[1] : "nmea/ublox7.nmea";
+  const char *ubxPath = argc > 2 ? argv[2] : "ubx/ublox7.ubx";
+  std::string stream = readFile( path );
+
+  std::vector<std::string> lines;
+  size_t begin = 0;
+  while ( begin < stream.size() ) {
+      size_t end = stream.find( '\n', begin );
+      if ( end == std::string::npos ) {
+          end = stream.size();
+      }
+      std::string line = stream.substr( begin, end - begin );
+      line.erase( line.find_last_not_of( "\r" ) + 1 );
+      if ( !line.empty() && line[0] == '$' ) {
+          lines.push_back( line );
+      }
+      begin = end + 1;
+  }
+  printf( "%s: %zu sentences\n", path, lines.size() );
+
+  // Correctness: both parsers against the reference, sentence by sentence
+  Sodaq_UBlox_GPS gps;
+  legacyParser legacy;
+  double maxError = 0, maxLegacyError = 0;
+  size_t positions = 0, mismatches = 0;
+  for ( size_t i = 0; i < lines.size(); ++i ) {
+      char buffer[128];
+      strncpy( buffer, lines[i].c_str(), sizeof( buffer ) - 1 );
+      buffer[sizeof( buffer ) - 1] = '\0';
+      gps.parseLine( buffer );
+      legacy.parseLine( lines[i].c_str() );
+
+      double lat, lon;
+      if ( referencePosition( lines[i].c_str(), &lat, &lon ) ) {
+          positions++;
+          maxError = fmax( maxError, fmax( fabs( gps.getLat() - lat ), fabs( gps.getLon() - lon ) ) );
+          maxLegacyError = fmax( maxLegacyError, fmax( fabs( legacy.lat - lat ), fabs( legacy.lon - lon ) ) );
+      }
+      if ( gps.getNumberOfSatellites() != legacy.numSatellites
+           || gps.getHour() != legacy.hh || gps.getMinute() != legacy.mm || gps.getSecond() != legacy.ss
+           || gps.getDay() != legacy.dd || gps.getMonth() != legacy.MM || gps.getYear() != legacy.yy + 2000
+           || fabs( gps.getAlt() - legacy.alt ) > 0.01 || fabs( gps.getHDOP() - legacy.hdop ) > 0.01 ) {
+          mismatches++;
+      }
+  }
+  // One degree of latitude is about 111 km
+  printf( "%zu positions, largest error: %.2e deg (%.3f m), String parser %.2e deg (%.3f m)\n",
+          positions, maxError, maxError * 111320, maxLegacyError, maxLegacyError * 111320 );
+  printf( "sentences where time, satellites, altitude or HDOP differ: %zu\n", mismatches );
+
+  result r = run( lines, [&]( char *s ) { gps.parseLine( s ); } );
+  result l = run( lines, [&]( char *s ) { legacy.parseLine( s ); } );
+  printf( "%-16s %12s %10s %14s\n", "", "sentences/s", "peak heap", "allocs/sentence" );
+  printf( "%-16s %12.0f %8zu B %14.2f\n", "String parser", l.perSecond, l.peak, l.allocsPerSentence );
+  printf( "%-16s %12.0f %8zu B %14.2f\n", "in place parser", r.perSecond, r.peak, r.allocsPerSentence );
+  printf( "speedup: %.1fx\n", r.perSecond / l.perSecond );
+
+  // Fixes over I2C at 100 kHz, on simulated time
+  std::vector<std::string> epochs = ublox_ddc::splitEpochs( stream );
+  std::vector<std::string> ubxEpochs = ublox_ddc::splitEpochs( readFile( ubxPath ), ublox_ddc::UBX_NAV_DOP );
+  printf( "\n%zu epochs over I2C at 100 kHz, per fix after the first:\n", epochs.size() );
+  setSimulatedTime( true );
+  Sodaq_UBlox_GPS ddcGps;
+  ddcGps.init( 0 );
+  legacyReader reader;
+  std::vector<fix> nmeaFixes, ubxFixes;
+  ddcResult lr = runDdc( epochs, [&]() { return legacyScan( ddcGps, reader ); } );
+  ddcResult nr = runDdc( epochs, [&]() {
+      bool ok = ddcGps.scan( true );
+      if ( ok ) {
+          nmeaFixes.push_back( fix( ddcGps ) );
+      }
+      return ok;
+  } );
+  ddcGps.setUbx( true );
+  ddcResult ur = runDdc( ubxEpochs, [&]() {
+      bool ok = ddcGps.scan( true );
+      if ( ok ) {
+          ubxFixes.push_back( fix( ddcGps ) );
+      }
+      return ok;
+  } );
+  ddcGps.setUbx( false );
+  ddcGps.setNavRate( 250 );
+  ddcResult fr = runDdc( epochs, [&]() { return ddcGps.scan( true ); } );
+  printf( "%-16s %5s %9s %9s %6s %12s %9s %9s\n", "", "fixes", "first ms", "scan ms", "bytes", "transactions",
+          "bus ms", "CPU us" );
+  printDdc( "byte reads", lr );
+  printDdc( "GGA+RMC", nr );
+  printDdc( "GGA+RMC, 4 Hz", fr );
+  printDdc( "UBX NAV-PVT", ur );
+  printf( "bytes per epoch in the recordings: NMEA %.0f, UBX %.0f (%.1fx less)\n", epochBytes( epochs ),
+          epochBytes( ubxEpochs ), epochBytes( epochs ) / epochBytes( ubxEpochs ) );
+  bool same = nmeaFixes == ubxFixes;
+  printf( "UBX fixes the same as NMEA: %s, UBX frames dropped: %u\n", same ? "yes" : "no", ddcGps.getUbxErrors() );
+
+  return mismatches == 0 && maxError < 1e-7 && nr.fixes == lr.fixes && same ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+/*
+ * Decode a UBX capture with the Sodaq_UBlox_GPS driver.
+ *
+ * Usage: sodaq_ubx_dump <capture>
+ *
+ * The capture is the raw output of a u-blox receiver with NAV-PVT (and
+ * NAV-DOP for the HDOP) enabled, e.g. from `cat /dev/ttyACM0 > capture`
+ * on a USB receiver. It is played back over the Wire stand-in by
+ * ublox_ddc, on simulated time, and every fix scan() returns is printed
+ * as CSV.
+ */
+
+#include "Arduino.h"
+#include "Sodaq_UBlox_GPS.h"
+#include "Wire.h"
+#include "ublox_ddc.h"
+
+#include <string>
+
+int main(int argc, char **argv)
+{
+  if ( argc != 2 ) {
+      fprintf( stderr, "Usage: %s <capture>\n", argv[0] );
+      return 2;
+  }
+  FILE *f = fopen( argv[1], "rb" );
+  if ( f == NULL ) {
+      perror( argv[1] );
+      return 1;
+  }
+  std::string capture;
+  char chunk[4096];
+  size_t size;
+  while ( (size = fread( chunk, 1, sizeof( chunk ), f )) > 0 ) {
+      capture.append( chunk, size );
+  }
+  fclose( f );
+
+  setSimulatedTime( true );
+  ublox_ddc ddc;
+  Wire.attach( ublox_ddc::ADDRESS, &ddc );
+  ddc.play( ublox_ddc::splitEpochs( capture, ublox_ddc::UBX_NAV_DOP ) );
+
+  Sodaq_UBlox_GPS gps;
+  gps.init( 0 );
+  gps.setUbx( true );
+
+  unsigned long fixes = 0;
+  printf( "datetime,lat,lon,alt,hdop,sats\n" );
+  while ( !ddc.done() && gps.scan( true ) ) {
+      printf( "%s,%.7f,%.7f,%.2f,%.2f,%u\n", gps.getDateTimeString().c_str(), gps.getLat(), gps.getLon(),
+              gps.getAlt(), gps.getHDOP(), gps.getNumberOfSatellites() );
+      fixes++;
+  }
+  fprintf( stderr, "%s: %zu bytes, %lu fixes, %u frames dropped\n", argv[1], capture.size(), fixes,
+           gps.getUbxErrors() );
+  return 0;
+}
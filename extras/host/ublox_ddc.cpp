@@ -0,0 +1,192 @@
+/*
+ * Host-side stand-in for the DDC (I2C) port of a u-blox receiver.
+ */
+
+#include "ublox_ddc.h"
+
+const char ublox_ddc::UBX_NAV_DOP[] = "\xB5\x62\x01\x04";
+
+// The standard NMEA messages the stand-in filters, by message id
+static const struct {
+  uint8_t id;
+  const char *name;
+} nmea[ublox_ddc::NMEA_MESSAGES] = {
+  { 0x00, "GGA" }, { 0x01, "GLL" }, { 0x02, "GSA" }, { 0x03, "GSV" },
+  { 0x04, "RMC" }, { 0x05, "VTG" }, { 0x41, "TXT" }
+};
+
+void ublox_ddc::play(const std::vector<std::string> &epochs, unsigned long interval)
+{
+  _epochs = epochs;
+  _next = 0;
+  _due = millis();
+  _interval = interval;
+  _output.clear();
+  _read = 0;
+}
+
+std::vector<std::string> ublox_ddc::splitEpochs(const std::string &stream, const char *first)
+{
+  std::vector<std::string> epochs;
+  size_t begin = 0;
+  size_t pos = stream.find( first, 1 );
+  while ( pos != std::string::npos ) {
+      epochs.push_back( stream.substr( begin, pos - begin ) );
+      begin = pos;
+      pos = stream.find( first, pos + 1 );
+  }
+  epochs.push_back( stream.substr( begin ) );
+  return epochs;
+}
+
+bool ublox_ddc::done()
+{
+  update();
+  return _next == _epochs.size() && _read == _output.size();
+}
+
+/*
+ * Move the epochs that are due to the output buffer
+ */
+void ublox_ddc::update()
+{
+  unsigned long now = millis();
+  while ( _next < _epochs.size() && (long)(now - _due) >= 0 ) {
+      _output.erase( 0, _read );
+      _read = 0;
+      _output += filter( _epochs[_next++] );
+      _due += _interval;
+  }
+}
+
+/*
+ * One byte sets the register address. More are a message for the
+ * receiver, written to the stream register.
+ */
+void ublox_ddc::receive(const uint8_t *data, size_t size)
+{
+  if ( size == 1 ) {
+      _register = data[0];
+      return;
+  }
+  _received.append( (const char *)data, size );
+
+  // Acknowledge every complete UBX-CFG frame, if UBX output is on
+  for ( ;; ) {
+      size_t start = _received.find( "\xB5\x62", _parsed );
+      if ( start == std::string::npos || _received.size() - start < 8 ) {
+          break;
+      }
+      const uint8_t *frame = (const uint8_t *)_received.data() + start;
+      size_t length = 8 + (frame[4] | frame[5] << 8);
+      if ( _received.size() - start < length ) {
+          break;
+      }
+      if ( frame[2] == 0x06 ) {
+          configure( frame, length );
+          if ( !( _outProto & 0x01 ) ) {
+              _parsed = start + length;
+              continue;
+          }
+          uint8_t ack[10] = { 0xB5, 0x62, 0x05, 0x01, 2, 0, frame[2], frame[3], 0, 0 };
+          for ( size_t i = 2; i < 8; ++i ) {
+              ack[8] += ack[i];
+              ack[9] += ack[8];
+          }
+          update();
+          _output.append( (const char *)ack, sizeof( ack ) );
+      }
+      _parsed = start + length;
+  }
+}
+
+/*
+ * Reads go on from the current register address and stop at the stream
+ * register 0xFF, which gives 0xFF when there is nothing to read. The
+ * count is latched when its high byte is read.
+ */
+size_t ublox_ddc::request(uint8_t *data, size_t size)
+{
+  update();
+  for ( size_t i = 0; i < size; ++i ) {
+      switch ( _register ) {
+        case 0xFD:
+          _count = _output.size() - _read;
+          data[i] = _count >> 8;
+          break;
+        case 0xFE:
+          data[i] = _count & 0xFF;
+          break;
+        case 0xFF:
+          if ( _read < _output.size() ) {
+              data[i] = _output[_read++];
+              _sent++;
+          } else {
+              data[i] = 0xFF;
+          }
+          break;
+        default:
+          data[i] = 0;
+          break;
+      }
+      if ( _register != 0xFF ) {
+          _register++;
+      }
+  }
+  return size;
+}
+
+/*
+ * Apply what the stand-in models of a UBX-CFG frame
+ */
+void ublox_ddc::configure(const uint8_t *frame, size_t length)
+{
+  const uint8_t *payload = frame + 6;
+  if ( frame[3] == 0x00 && length == 8 + 20 && payload[0] == 0 ) {
+      // CFG-PRT for DDC, the protocols taken from here on
+      _outProto = payload[14];
+  } else if ( frame[3] == 0x01 && length == 8 + 3 && payload[0] == 0xF0 ) {
+      // CFG-MSG, standard NMEA
+      for ( size_t i = 0; i < NMEA_MESSAGES; ++i ) {
+          if ( nmea[i].id == payload[1] ) {
+              _nmeaOff[i] = payload[2] == 0;
+          }
+      }
+  } else if ( frame[3] == 0x08 && length == 8 + 6 ) {
+      // CFG-RATE, after the next epoch
+      _interval = payload[0] | payload[1] << 8;
+  }
+}
+
+/*
+ * An epoch without the NMEA sentences that are switched off, or nothing
+ * if its protocol is off
+ */
+std::string ublox_ddc::filter(const std::string &epoch)
+{
+  if ( epoch.empty() || epoch[0] != '$' ) {
+      return _outProto & 0x01 ? epoch : std::string();
+  }
+  if ( !( _outProto & 0x02 ) ) {
+      return std::string();
+  }
+  std::string out;
+  size_t begin = 0;
+  while ( begin < epoch.size() ) {
+      size_t end = epoch.find( '\n', begin );
+      end = end == std::string::npos ? epoch.size() : end + 1;
+      bool off = false;
+      if ( epoch[begin] == '$' && end - begin > 6 ) {
+          for ( size_t i = 0; i < NMEA_MESSAGES; ++i ) {
+              if ( _nmeaOff[i] && epoch.compare( begin + 3, 3, nmea[i].name ) == 0 ) {
+                  off = true;
+              }
+          }
+      }
+      if ( !off ) {
+          out.append( epoch, begin, end - begin );
+      }
+      begin = end;
+  }
+  return out;
+}
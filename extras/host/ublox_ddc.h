@@ -0,0 +1,78 @@
+/*
+ * Host-side stand-in for the DDC (I2C) port of a u-blox receiver.
+ *
+ * Attach it to the Wire stand-in at address 0x42. It replays a recorded
+ * output stream one navigation epoch at a time and answers reads of the
+ * bytes available registers 0xFD/0xFE and the stream register 0xFF like
+ * the receiver, see section 10.3 of the u-blox 7 Receiver Description.
+ * Whatever the host writes to the stream is kept for inspection, and
+ * UBX-CFG messages in it are acknowledged while UBX output is on. Of
+ * those, UBX-CFG-PRT for the DDC port sets the output protocols, UBX-CFG-MSG
+ * for the standard NMEA messages GGA to VTG and TXT leaves the disabled ones
+ * out of the epochs played from then on, and UBX-CFG-RATE sets the time
+ * between epochs.
+ */
+
+#ifndef ublox_ddc_h
+#define ublox_ddc_h
+
+#include "Wire.h"
+
+#include <string>
+#include <vector>
+
+class ublox_ddc : public TwoWireDevice
+{
+  public:
+    static const uint8_t ADDRESS = 0x42;
+    static const char UBX_NAV_DOP[];
+    static const size_t NMEA_MESSAGES = 7;
+
+    /*
+     * Output epochs[i] at i * interval ms from now, on millis().
+     */
+    void play(const std::vector<std::string> &epochs, unsigned long interval = 1000);
+
+    /*
+     * Split a recording into epochs, each starting with first: the name
+     * of the first NMEA sentence, e.g. "$GPRMC" for u-blox 7, or the
+     * start of the first UBX frame, like UBX_NAV_DOP.
+     */
+    static std::vector<std::string> splitEpochs(const std::string &stream, const char *first = "$GPRMC");
+
+    // Whether all epochs were output and read
+    bool done();
+
+    // What the host wrote to the stream register
+    const std::string &received() const { return _received; }
+
+    // The number of stream bytes the host read
+    unsigned long sent() const { return _sent; }
+
+    // TwoWireDevice
+    void receive(const uint8_t *data, size_t size);
+    size_t request(uint8_t *data, size_t size);
+
+  private:
+    void update();
+    void configure(const uint8_t *frame, size_t length);
+    std::string filter(const std::string &epoch);
+
+    std::vector<std::string> _epochs;
+    size_t _next = 0;
+    unsigned long _due = 0;             // when epoch _next is output
+    unsigned long _interval = 1000;
+
+    std::string _output;
+    size_t _read = 0;
+    uint16_t _count = 0;
+    uint8_t _register = 0xFF;
+    unsigned long _sent = 0;
+    bool _nmeaOff[NMEA_MESSAGES] = {};
+    uint8_t _outProto = 0x03;           // UBX and NMEA, the default
+
+    std::string _received;
+    size_t _parsed = 0;
+};
+
+#endif
@@ -13,72 +13,49 @@
 extern "C" {
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
 }
 
-// private method to read stream with timeout
-int rn2xx3::_timedRead(Stream *stream, unsigned long timeout ) {
-    int c;
-    unsigned long _startMillis = millis();
-    do {
-        c = stream->read();
-        if(c >= 0)
-            return c;
-    } while(millis() - _startMillis < timeout);
-    return -1;     // -1 indicates timeout
-}
-
-const char *rn2xx3::readCharStringUntil( Stream *stream, unsigned long timeout, char terminator, char *outbuf, size_t bufsz ) {
-    
-    if ( outbuf == NULL ) {
-        return NULL;
-    }
-    
-//    Serial.print( F("bufsz: ") );
-//    Serial.println( bufsz );
-    
-    memset( outbuf, 0, bufsz );
-
-    uint8_t count = 0;
-    char *obptr = outbuf;
-
-    int c = _timedRead(stream, timeout);
-//    Serial.print(F("*"));
-//    Serial.print( (char )c );
-//    Serial.println(F("*"));
-    if ( c == terminator ) {
-//        Serial.println( F("found terminator!") );
-    } else {
-        if ( c >= 32 && c <= 127 ) {
-            *obptr = c;
-            obptr++;
-            count++;
-        }
-    }
-    while( c >= 0 && c != terminator ) {
-        c = _timedRead(stream, timeout);
-        if ( c == terminator ) {
-//            Serial.println( F("found terminator!") );
-        }
-//        Serial.print(F("*"));
-//        Serial.print( (char )c );
-//        Serial.println(F("*"));
-        if ( c >= 32 && c <= 127 ) {
-            count++;
-            *obptr = c;
-            if ( count < bufsz - 1 ) {
-                obptr++;
+/**
+ * Wait for the next reply line from the module and return it.
+ * Bytes are taken from the stream as they arrive; between them the clock
+ * idles, which is where a custom rn2xx3_clock can put the CPU to sleep.
+ * The timeout restarts with every received byte. On a timeout the empty
+ * string is returned, not the previous line, and a partial line is
+ * dropped.
+ */
+const char *rn2xx3::_readLine( unsigned long timeout ) {
+    unsigned long startMillis = _clock->millis();
+    RN_RESPONSE response = RN_TIMEOUT;
+    for (;;) {
+        if ( _serial->available() > 0 ) {
+            if ( _reader.poll( _serial ) ) {
+                response = rn2xx3_classify( _reader.line() );
+                break;
+            }
+            startMillis = _clock->millis();
+        } else {
+            if ( _clock->millis() - startMillis >= timeout ) {
+                _reader.reset();
+                break;
             }
+            _clock->idle();
         }
-    } 
-
-    return buf;
+    }
+    _stats.reply( response, _clock->millis() );
+    return _reader.line();
 }
 
+static rn2xx3_clock defaultClock;
+
 /*
   @param serial Needs to be an already opened Stream ({Software/Hardware}Serial) to write to and read from.
+  @param clock Time source for all timeouts and delays, NULL for millis() and delay().
 */
-rn2xx3::rn2xx3(Stream *serial): _serial(serial)
+rn2xx3::rn2xx3(Stream *serial, rn2xx3_clock *clock): _serial(serial), _reader(buf, sizeof(buf))
 {
+  _clock = clock != NULL ? clock : &defaultClock;
+
   _timeout = 2000;
   _serial->setTimeout(_timeout);
 
@@ -89,39 +66,95 @@ rn2xx3::rn2xx3(Stream *serial): _serial(serial)
   memset( _appskey, 0, sizeof( _appskey ) );
 
   _rxMessage[0] = '\0';
+  _rxBuffer = _rxMessage;
+  _rxSize = RN2XX3_MAX_DOWNLINK;
+  memset( _rxHandlers, 0, sizeof( _rxHandlers ) );
 }
 
-//TODO: change to a boolean
 bool rn2xx3::autobaud()
 {
-    buf[0] = '\0';
-
     /** Drain the serial buffer */
     while( _serial->available() ) {
         _serial->read();
     }
+    _reader.reset();
 
-    // Try a maximum of 10 times with a 1 second delay
-    for (uint8_t i=0; i < 10 && strlen(buf) == 0 ; i++) {
-        delay(1000);
+    // The module may have been reset, so forget what we set
+    _shadow.invalidate();
+
+    // Start right away with a short wait for the reply, and back off in
+    // case the module is still booting or waking up
+    unsigned long wait = RN2XX3_AUTOBAUD_WAIT;
+    for (uint8_t i=0; i < RN2XX3_AUTOBAUD_ATTEMPTS; i++) {
         _serial->write((byte)0x00);
-        delay(20);
-        _serial->write(0x55);
-        _serial->println();
-        // we could use sendRawCommand(F("sys get ver")); here
-        _serial->println(F("sys get ver"));
-        readCharStringUntil( _serial, _timeout, '\n', buf, sizeof( buf ) );
-        if ( strlen( buf ) > 0 && strstr( buf, "RN2483") != NULL ) {
-            Serial.print( F("***") );
-            Serial.print( buf );
-            Serial.println( F("***") );
+        _clock->delay(20);
+        if ( _syncBaud( wait ) ) {
             return true;
         }
+        wait = wait * 2 < RN2XX3_AUTOBAUD_MAX_WAIT ? wait * 2 : RN2XX3_AUTOBAUD_MAX_WAIT;
+    }
+
+    return false;
+}
+
+/**
+ * The rest of the autobaud sequence after the break: 0x55 for the module
+ * to measure the rate by, then check that it answers at that rate.
+ */
+bool rn2xx3::_syncBaud( unsigned long wait )
+{
+    _serial->write(0x55);
+    _serial->println();
+    // Drop whatever arrived meanwhile, like the banner the module
+    // sends after a reset, so it is not taken for the reply
+    while( _serial->available() ) {
+        _serial->read();
+    }
+    _reader.reset();
+    // we could use sendRawCommand(F("sys get ver")); here
+    _stats.command( RN_CMD_SYS, _clock->millis() );
+    _serial->println(F("sys get ver"));
+    _readLine( wait );
+    if ( strncmp( buf, "RN2483", 6 ) == 0 ) {
+        _moduleType = RN2483;
+    } else if ( strncmp( buf, "RN2903", 6 ) == 0 ) {
+        _moduleType = RN2903;
+    } else {
+        return false;
+    }
+    RN2XX3_INFO( F(""), buf );
+    return true;
+}
+
+bool rn2xx3::setBaud( unsigned long from, unsigned long to, rn2xx3_baud_setter setHostBaud )
+{
+    while( _serial->available() ) {
+        _serial->read();
+    }
+
+    // The break goes out at the old rate, where it is surely longer than
+    // a character, the 0x55 at the new one
+    _serial->write((byte)0x00);
+    _clock->delay(20);
+    _serial->flush();
+    setHostBaud( to );
+    if ( _syncBaud( RN2XX3_AUTOBAUD_WAIT ) ) {
+        _baud = to;
+        return true;
     }
 
+    RN2XX3_ERROR( F("No reply at the new baud rate") );
+    setHostBaud( from );
+    _baud = from;
+    autobaud();
     return false;
 }
 
+unsigned long rn2xx3::baud()
+{
+    return _baud;
+}
+
 
 char *rn2xx3::sysver()
 {
@@ -132,21 +165,19 @@ char *rn2xx3::sysver()
 RN2xx3_t rn2xx3::configureModuleType()
 {
     const char *version = sysver();
-    Serial.print( F("***") );
-    Serial.print( version );
-    Serial.println( F("***") );
+    RN2XX3_INFO( F(""), version );
     if ( strlen( version ) < 6 ) {
         return RN_NA;
     }
     if ( strncmp( version + 2, "2903", 4 ) == 0 ) {
-        Serial.println( F("Module = RN2903") );
+        RN2XX3_INFO( F("Module = RN2903") );
         _moduleType = RN2903;
     } else {
         if ( strncmp( version + 2, "2483", 4 ) == 0 ) {
-            Serial.println( F("Module = RN2483") );
+            RN2XX3_INFO( F("Module = RN2483") );
             _moduleType = RN2483;
         } else {
-            Serial.println( F("Unknown Module") );
+            RN2XX3_ERROR( F("Unknown Module") );
             _moduleType = RN_NA;
         }
     }
@@ -200,24 +231,13 @@ bool rn2xx3::initOTAA( const char *AppEUI, const char *AppKey, const char *DevEU
 
   // detect which model radio we are using
   configureModuleType();
-
-  // reset the module - this will clear all keys set previously
-  switch (_moduleType)
-  {
-      case RN2903: {
-      sendRawCommand(F("mac reset"));
-      break;
-      }
-      case RN2483: {
-      sendRawCommand(F("mac reset 868"));
-      break;
-      }
-      default: {
+  if ( _moduleType != RN2903 && _moduleType != RN2483 ) {
       // we shouldn't go forward with the init
-          Serial.println( F("Unknown LoRaWAN module type") );
+      RN2XX3_ERROR( F("Unknown LoRaWAN module type") );
       return false;
-      }
   }
+  _dutyCycle.reset( _moduleType );
+  _dataRate = _moduleType == RN2903 ? 0 : 5;
 
   memset( _devAddr, 0, sizeof( _devAddr ) );
   memset( _deveui, 0, sizeof( _deveui ) );
@@ -229,11 +249,7 @@ bool rn2xx3::initOTAA( const char *AppEUI, const char *AppKey, const char *DevEU
   // otherwise use the Hardware EUI.
   if (DevEUI != NULL && strlen(DevEUI) == 16)
   {
-#ifdef ARDUINO
-      Serial.print( F("setting _deveui: ") );
-      Serial.println( DevEUI );
-      Serial.flush();
-#endif
+      RN2XX3_INFO( F("setting _deveui: "), DevEUI );
       strncpy( _deveui, DevEUI, 16 );
   }
   else
@@ -244,20 +260,40 @@ bool rn2xx3::initOTAA( const char *AppEUI, const char *AppKey, const char *DevEU
     }
     // else fall back to the hard coded value in the header file
   }
+  if ( AppEUI != NULL && strlen(AppEUI) == 16 )
+  {
+      strncpy( _appeui, AppEUI, 16 );
+  }
+  if ( AppKey != NULL && strlen(AppKey) == 32 )
+  {
+      strncpy( _appskey, AppKey, 32 ); //reuse the same variable as for ABP
+  }
+
+  // Warm start: carry on with the session of an earlier join
+  if ( _resumeOTAA() ) {
+      return true;
+  }
+
+  // reset the module - this will clear all keys set previously
+  if ( _moduleType == RN2903 ) {
+      sendRawCommand(F("mac reset"));
+  } else {
+      sendRawCommand(F("mac reset 868"));
+  }
+  _shadow.invalidate();
+  _shadow.changed();
 
   sendRawCommand( F("mac set deveui "), _deveui );
 
   // A valid length App EUI was given. Use it.
-  if ( AppEUI != NULL && strlen(AppEUI) == 16 )
+  if ( _appeui[0] != '\0' )
   {
-      strncpy( _appeui, AppEUI, 16 );
       sendRawCommand( F("mac set appeui "), _appeui );
   }
 
   // A valid length App Key was give. Use it.
-  if ( AppKey != NULL && strlen(AppKey) == 32 )
+  if ( _appskey[0] != '\0' )
   {
-    strncpy( _appskey, AppKey, 32 ); //reuse the same variable as for ABP
     sendRawCommand( F("mac set appkey "), _appskey );
   }
 
@@ -269,15 +305,15 @@ bool rn2xx3::initOTAA( const char *AppEUI, const char *AppKey, const char *DevEU
     
   if (_moduleType == RN2903)
   {
-    sendRawCommand(F("mac set pwridx 5"));
+    _macSetNumber( rn2xx3_shadow::PWRIDX, F("mac set pwridx "), 5 );
   }
   else
   {
-    sendRawCommand(F("mac set pwridx 1"));
+    _macSetNumber( rn2xx3_shadow::PWRIDX, F("mac set pwridx "), 1 );
   }
 
   /** Disable ADR for OTAA */
-  sendRawCommand(F("mac set adr off"));
+  _macSetOnOff( rn2xx3_shadow::ADR, F("mac set adr "), false );
 
   // Semtech and TTN both use a non default RX2 window freq and SF.
   // Maybe we should not specify this for other networks.
@@ -287,107 +323,265 @@ bool rn2xx3::initOTAA( const char *AppEUI, const char *AppKey, const char *DevEU
   // }
   // Disabled for now because an OTAA join seems to work fine without.
 
-  _serial->setTimeout(120000);
-  sendRawCommand(F("mac save"));
-
   // Only try twice to join, then return and let the user handle it.
   for(int i=0; i<2 && !joined; i++)
   {
-    sendRawCommand(F("mac join otaa"));
+    if ( rn2xx3_classify( sendRawCommand(F("mac join otaa")) ) == RN_OK ) {
+      _dutyCycle.record( _clock->millis(), _dataRate, _frameAirtime( RN2XX3_JOIN_REQUEST_LENGTH, 1 ) );
+    }
     // Parse 2nd response
-    const char *receivedData = readCharStringUntil(_serial, 30000, '\n', buf, sizeof( buf ) );
-      Serial.print( F("***") );
-      if ( receivedData != NULL ) {
-          Serial.print( receivedData );
-      } else {
-          Serial.println( F("NO DATA") );
-      }
-      Serial.println( F("***") );
-    if(strncmp( receivedData, "accepted", 8 ) == 0 )
+    const char *receivedData = _readLine( 30000 );
+    RN2XX3_INFO( F("join: "), receivedData );
+    if( rn2xx3_classify( receivedData ) == RN_ACCEPTED )
     {
       joined=true;
-      delay(1000);
+      // The join accept may carry a channel list
+      _shadow.invalidate();
+      _clock->delay(1000);
     }
     else
     {
-      delay(1000);
+      _clock->delay(1000);
     }
   }
-  _serial->setTimeout(2000);
+
+  // Keep the keys and the new session for the next boot, and which
+  // AppKey it came from
+  if ( joined && save() && _appskey[0] != '\0' ) {
+      _writeAppKeyTag();
+  }
 
   return joined;
 }
 
+/**
+ * 16 bits of the FNV-1a hash of the AppKey, in upper case
+ */
+static uint16_t appKeyTag( const char *appKey )
+{
+  uint32_t hash = 2166136261UL;
+  while ( *appKey != '\0' ) {
+      hash = ( hash ^ (uint8_t)toupper( *appKey++ ) ) * 16777619UL;
+  }
+  return (uint16_t)( hash ^ ( hash >> 16 ) );
+}
+
+/**
+ * Whether the tag in the module's user EEPROM is the one of our AppKey
+ */
+bool rn2xx3::_appKeyTagMatches()
+{
+  uint16_t tag = appKeyTag( _appskey );
+  for ( uint8_t i = 0; i < 2; i++ ) {
+      char arg[4];
+      sprintf( arg, "%X", RN2XX3_APPKEY_TAG_NVM + i );
+      char *end;
+      unsigned long value = strtoul( sendRawCommand( F("sys get nvm "), arg ), &end, 16 );
+      if ( buf[0] == '\0' || *end != '\0' || value != ( i == 0 ? tag >> 8 : tag & 0xFF ) ) {
+          return false;
+      }
+  }
+  return true;
+}
+
+void rn2xx3::_writeAppKeyTag()
+{
+  uint16_t tag = appKeyTag( _appskey );
+  for ( uint8_t i = 0; i < 2; i++ ) {
+      char arg[7];
+      sprintf( arg, "%X %02X", RN2XX3_APPKEY_TAG_NVM + i, i == 0 ? tag >> 8 : tag & 0xFF );
+      if ( rn2xx3_classify( sendRawCommand( F("sys set nvm "), arg ) ) != RN_OK ) {
+          RN2XX3_ERROR( F("Could not store the AppKey tag") );
+          return;
+      }
+  }
+}
+
+/**
+ * Carry on with the session the module holds from an earlier join with
+ * the same DevEUI and AppEUI. It is either still joined, after a reset of
+ * only the host, or it restored the session from EEPROM at power-on, in
+ * which case "mac join abp" resumes it without going on air.
+ * The AppKey can't be read back, so it is compared by the tag
+ * initOTAA() stored with the session.
+ */
+bool rn2xx3::_resumeOTAA()
+{
+  bool joined = isJoined();
+
+  if ( strcasecmp( sendRawCommand( F("mac get deveui") ), _deveui ) != 0 ) {
+      return false;
+  }
+  if ( _appeui[0] != '\0' && strcasecmp( sendRawCommand( F("mac get appeui") ), _appeui ) != 0 ) {
+      return false;
+  }
+  if ( _appskey[0] != '\0' && !_appKeyTagMatches() ) {
+      RN2XX3_INFO( F("AppKey changed, joining again") );
+      return false;
+  }
+  const char *devaddr = sendRawCommand( F("mac get devaddr") );
+  if ( strlen( devaddr ) != 8 || strcmp( devaddr, "00000000" ) == 0 ) {
+      // Never joined, or the ABP workaround of a cold start that didn't join
+      return false;
+  }
+  strcpy( _devAddr, devaddr );
+  return _resumeSession( joined );
+}
+
+/**
+ * Carry on with the ABP session the module holds for the same DevAddr, as
+ * _resumeOTAA() does. The session keys can't be read back, so new keys
+ * for the same DevAddr need a factoryReset().
+ */
+bool rn2xx3::_resumeABP()
+{
+  bool joined = isJoined();
+
+  if ( strcasecmp( sendRawCommand( F("mac get devaddr") ), _devAddr ) != 0 ) {
+      return false;
+  }
+  return _resumeSession( joined );
+}
+
+/**
+ * The part of a warm start both activations share, once the module is
+ * known to hold our session
+ */
+bool rn2xx3::_resumeSession(bool joined)
+{
+  // The frame counters must have survived too, or the network drops
+  // our uplinks as replays
+  char *end;
+  unsigned long upctr = strtoul( sendRawCommand( F("mac get upctr") ), &end, 10 );
+  if ( buf[0] == '\0' || *end != '\0' ) {
+      return false;
+  }
+  RN2XX3_INFO( F("upctr: "), buf );
+
+  unsigned long dr = strtoul( sendRawCommand( F("mac get dr") ), &end, 10 );
+  if ( buf[0] != '\0' && *end == '\0' && dr <= 15 ) {
+      _dataRate = dr;
+  }
+
+  if ( !joined ) {
+      // After a power cycle the counter is the one of the last mac save,
+      // and up to RN2XX3_UPCTR_MARGIN frames may have gone out since.
+      // Skip past them before sending anything.
+      char arg[11];
+      sprintf( arg, "%lu", upctr + RN2XX3_UPCTR_MARGIN );
+      if ( rn2xx3_classify( sendRawCommand( F("mac set upctr "), arg ) ) != RN_OK ) {
+          return false;
+      }
+      if ( !rejoinABP() ) {
+          return false;
+      }
+  }
+  RN2XX3_INFO( F("resumed session "), _devAddr );
+
+  // What the module runs is what its EEPROM holds, apart from a counter
+  // moved on, which must be saved before the next power cycle restores
+  // the old one again
+  _shadow.invalidate();
+  _shadow.saved();
+  if ( !joined ) {
+      _shadow.changed();
+      save();
+  }
+  return true;
+}
+
+bool rn2xx3::save()
+{
+  if ( !_shadow.dirty() ) {
+      return true;
+  }
+  if ( rn2xx3_classify( sendRawCommand( F("mac save") ) ) != RN_OK ) {
+      return false;
+  }
+  _shadow.saved();
+  return true;
+}
+
 bool rn2xx3::initABP( const char *devAddr, const char *AppSKey, const char *NwkSKey)
 {
-#ifdef PANTS  
   _otaa = false;
-  _devAddr = devAddr;
-  _appskey = AppSKey;
-  _nwkskey = NwkSKey;
-  String receivedData;
+
+  if ( devAddr == NULL || strlen( devAddr ) != 8
+       || AppSKey == NULL || strlen( AppSKey ) != 32
+       || NwkSKey == NULL || strlen( NwkSKey ) != 32 ) {
+      RN2XX3_ERROR( F("Invalid ABP keys") );
+      return false;
+  }
+  memset( _devAddr, 0, sizeof( _devAddr ) );
+  memset( _appskey, 0, sizeof( _appskey ) );
+  memset( _nwkskey, 0, sizeof( _nwkskey ) );
+  strncpy( _devAddr, devAddr, 8 );
+  strncpy( _appskey, AppSKey, 32 );
+  strncpy( _nwkskey, NwkSKey, 32 );
 
   //clear serial buffer
   while(_serial->available())
     _serial->read();
 
   configureModuleType();
+  if ( _moduleType != RN2903 && _moduleType != RN2483 ) {
+      // we shouldn't go forward with the init
+      RN2XX3_ERROR( F("Unknown LoRaWAN module type") );
+      return false;
+  }
+  _dutyCycle.reset( _moduleType );
+  _dataRate = _moduleType == RN2903 ? 0 : 5;
 
-  switch (_moduleType) {
-    case RN2903:
+  // Warm start: the module restored these keys from EEPROM at power-on,
+  // resetting them would also reset the frame counters
+  if ( _resumeABP() ) {
+      return true;
+  }
+
+  if ( _moduleType == RN2903 ) {
       sendRawCommand(F("mac reset"));
-      break;
-    case RN2483:
+  } else {
       sendRawCommand(F("mac reset 868"));
       // sendRawCommand(F("mac set rx2 3 869525000"));
       // In the past we set the downlink channel here,
       // but setFrequencyPlan is a better place to do it.
-      break;
-    default:
-      // we shouldn't go forward with the init
-      return false;
   }
+  _shadow.invalidate();
+  _shadow.changed();
 
-  sendRawCommand(F("mac set nwkskey "), _nwkskey.c_str() );
-  sendRawCommand(F("mac set appskey "), _appskey.c_str() );
-  sendRawCommand(F("mac set devaddr "), _devAddr.c_str() );
-  sendRawCommand(F("mac set adr off"));
+  // Back to back, each command is sent as soon as the previous one is
+  // acknowledged
+  bool ok = rn2xx3_classify( sendRawCommand(F("mac set nwkskey "), _nwkskey ) ) == RN_OK;
+  ok &= rn2xx3_classify( sendRawCommand(F("mac set appskey "), _appskey ) ) == RN_OK;
+  ok &= rn2xx3_classify( sendRawCommand(F("mac set devaddr "), _devAddr ) ) == RN_OK;
+  ok &= _macSetOnOff( rn2xx3_shadow::ADR, F("mac set adr "), false );
 
   // Switch off automatic replies, because this library can not
   // handle more than one mac_rx per tx. See RN2483 datasheet,
   // 2.4.8.14, page 27 and the scenario on page 19.
-  sendRawCommand(F("mac set ar off"));
+  ok &= _macSetOnOff( rn2xx3_shadow::AR, F("mac set ar "), false );
 
   if (_moduleType == RN2903)
   {
-    sendRawCommand("mac set pwridx 5");
+    ok &= _macSetNumber( rn2xx3_shadow::PWRIDX, F("mac set pwridx "), 5 );
   }
   else
   {
-    sendRawCommand(F("mac set pwridx 1"));
+    ok &= _macSetNumber( rn2xx3_shadow::PWRIDX, F("mac set pwridx "), 1 );
+    // SF7, the RN2903 has no such data rate for uplinks
+    ok &= _macSetNumber( rn2xx3_shadow::DR, F("mac set dr "), _dataRate );
   }
-  sendRawCommand(F("mac set dr 5")); //0= min, 7=max
-
-  _serial->setTimeout(60000);
-  sendRawCommand(F("mac save"));
-  sendRawCommand(F("mac join abp"));
-  receivedData = _serial->readStringUntil('\n');
 
-  _serial->setTimeout(2000);
-  delay(1000);
-
-  if(receivedData.startsWith("accepted"))
-  {
-    return true;
-    //with abp we can always join successfully as long as the keys are valid
-  }
-  else
-  {
-    return false;
+  if ( !ok ) {
+      RN2XX3_ERROR( F("ABP setup refused") );
+      return false;
   }
-#endif
 
-  return true;
+  // Keep the keys for rejoinABP() after a power cycle
+  save();
+
+  //with abp we can always join successfully as long as the keys are valid
+  return rejoinABP();
 }
 
 /**
@@ -395,26 +589,20 @@ bool rn2xx3::initABP( const char *devAddr, const char *AppSKey, const char *NwkS
  */
 bool rn2xx3::rejoinABP()
 {
-    
-  _serial->setTimeout(60000);
   const char *receivedData = sendRawCommand(F("mac join abp"));
     if ( receivedData == NULL ) {
         return false;
     }
     
-    Serial.print( F("***") );
-    Serial.print( receivedData );
-    Serial.println( F("***") );
+    RN2XX3_INFO( F("join: "), receivedData );
 
-    if( strncmp( receivedData, "ok", 2 ) == 0 ) {
-        receivedData = readCharStringUntil(_serial, 30000, '\n', buf, sizeof( buf ) );
+    if( rn2xx3_classify( receivedData ) == RN_OK ) {
+        receivedData = _readLine( 30000 );
         if ( receivedData == NULL ) {
             return false;
         }
-        Serial.print( F("***") );
-        Serial.print( receivedData );
-        Serial.println( F("***") );
-        if ( strncmp(receivedData, "accepted", 8) == 0 ) {
+        RN2XX3_INFO( F("join: "), receivedData );
+        if ( rn2xx3_classify( receivedData ) == RN_ACCEPTED ) {
             return true;
             //with abp we can always join successfully as long as the keys are valid
         } else {
@@ -432,414 +620,769 @@ TX_RETURN_TYPE rn2xx3::tx( const char *data)
 
 TX_RETURN_TYPE rn2xx3::txBytes(const byte* data, uint8_t size)
 {
-  char msgBuffer[size*2 + 1];
-
-  char buffer[3];
-  for (unsigned i=0; i<size; i++)
-  {
-    sprintf(buffer, "%02X", data[i]);
-    memcpy(&msgBuffer[i*2], &buffer, sizeof(buffer));
-  }
-  return txCommand("mac tx uncnf 1 ", msgBuffer, false);
+  return txCommand("mac tx uncnf 1 ", data, size, false);
 }
 
 TX_RETURN_TYPE rn2xx3::txCnf(const char *data)
 {
-  return txCommand("mac tx cnf 1 ", data, true);
+  size_t size = strlen(data);
+  if ( size > 255 ) {
+      return TX_FAIL;
+  }
+  return txCommand("mac tx cnf 1 ", (const byte *)data, size, true);
 }
 
 TX_RETURN_TYPE rn2xx3::txUncnf(const char *data)
 {
-  return txCommand("mac tx uncnf 1 ", data, false);
+  size_t size = strlen(data);
+  if ( size > 255 ) {
+      return TX_FAIL;
+  }
+  return txCommand("mac tx uncnf 1 ", (const byte *)data, size, false);
 }
 
 TX_RETURN_TYPE rn2xx3::txCommand(const char *command, const char *data, bool expectDownlink)
 {
-  bool send_success = false;
-  uint16_t busy_count = 0;
-  uint16_t retry_count = 0;
-  uint8_t no_free_ch_count = 0;
+  if ( !txBegin( command, data, expectDownlink ) ) {
+      return TX_FAIL;
+  }
+
+  while ( poll() != TX_DONE ) {
+      // The state machine keeps its own timeouts, so this always ends
+      _clock->idle();
+  }
+
+  return _txResult;
+}
+
+TX_RETURN_TYPE rn2xx3::txCommand(const char *command, const byte *data, uint8_t size, bool expectDownlink)
+{
+  if ( !txBegin( command, data, size, expectDownlink ) ) {
+      return TX_FAIL;
+  }
+
+  while ( poll() != TX_DONE ) {
+      _clock->idle();
+  }
+
+  return _txResult;
+}
+
+bool rn2xx3::txBegin(const char *command, const char *data, bool expectDownlink)
+{
+  if ( _txState != TX_IDLE && _txState != TX_DONE ) {
+      return false;
+  }
+
+  _txData = data;
+  _txPayload = NULL;
+  _txLength = strlen( data ) / 2;
+  _txStart( command, expectDownlink );
+  return true;
+}
+
+bool rn2xx3::txBegin(const char *command, const byte *data, uint8_t size, bool expectDownlink)
+{
+  if ( _txState != TX_IDLE && _txState != TX_DONE ) {
+      return false;
+  }
+
+  _txData = NULL;
+  _txPayload = data;
+  _txLength = size;
+  _txStart( command, expectDownlink );
+  return true;
+}
+
+void rn2xx3::_txStart(const char *command, bool expectDownlink)
+{
+  _txCommand = command;
+  _txExpectDownlink = expectDownlink;
+  _txResult = TX_FAIL;
+  _txRetryCount = 0;
+  _txBusyCount = 0;
+  _txNoFreeChCount = 0;
 
   //clear serial buffer
   while(_serial->available())
     _serial->read();
+  _reader.reset();
+
+  if ( _shadow.has( rn2xx3_shadow::AR, expectDownlink ) ) {
+      _txSend();
+      return;
+  }
 
     // Switch off automatic replies, because this library can not
     // handle more than one mac_rx per tx. See RN2483 datasheet,
     // 2.4.8.14, page 27 and the scenario on page 19.
+      _stats.command( RN_CMD_MAC_SET, _clock->millis() );
       if ( expectDownlink ) {
-          sendRawCommand(F("mac set ar on"));
+          _serial->println(F("mac set ar on"));
       } else {
-          sendRawCommand(F("mac set ar off"));
+          _serial->println(F("mac set ar off"));
       }
-    
-  while(!send_success)
-  {
 
-    if ( no_free_ch_count > 5 ) {
-        /** Exceeded duty cycle....just bail now */
-        return TX_NO_FREE_CH;
-    }
-    //retransmit a maximum of 10 times
-    retry_count++;
-    if(retry_count>10)
-    {
-      return TX_FAIL;
-    }
+  _txWait( TX_WAIT_AR, _timeout );
+}
 
-      Serial.print(command);
-      Serial.print(data);
-    _serial->print(command);
-    // if(shouldEncode)
-    // {
-    //   sendEncoded(data);
-    // }
-    // else
-    // {
-      _serial->print(data);
-    // }
-    _serial->println();
+TX_STATE rn2xx3::poll()
+{
+  switch ( _txState ) {
+    case TX_IDLE:
+    case TX_DONE:
+      return _txState;
+
+    case TX_BACKOFF:
+      if ( _clock->millis() - _txStartMillis >= _txTimeout ) {
+          _txSend();
+      }
+      return _txState;
 
-    const char *receivedData = readCharStringUntil(_serial, 10000, '\n', buf, sizeof( buf ) );
-    if ( receivedData == NULL ) {
-        Serial.println( F("NULL data received") );
-        Serial.flush();
-        return TX_FAIL;
-    }
-    //TODO: Debug print on receivedData
-    Serial.print( ("post-tx received data: ***" ) );
-    Serial.print( receivedData );
-    Serial.println( "***" );
-    Serial.flush();
+    default:
+      break;
+  }
 
-    if(strncmp(receivedData, "ok", 2) == 0)
-    {
-        Serial.println( F("ok received. waiting on post-uplink") );
-        Serial.flush();
-      _serial->setTimeout(30000);
-      receivedData = readCharStringUntil(_serial, 120000, '\n', buf, sizeof( buf ) );
-      _serial->setTimeout(2000);
+  while ( _reader.poll( _serial ) ) {
+      _txHandleLine( _reader.line() );
+      if ( _txState == TX_DONE || _txState == TX_BACKOFF ) {
+          return _txState;
+      }
+  }
 
-        if ( receivedData == NULL ) {
-            Serial.println( F("failed to receive uplink data") );
-            Serial.flush();
-            return NULL;
-        }
+  if ( _clock->millis() - _txStartMillis >= _txTimeout ) {
+      // A timeout is handled the same as an empty reply
+      _reader.reset();
+      _txHandleLine( "" );
+  }
 
-      //TODO: Debug print on receivedData
-      Serial.print( ("post-uplink received data: ***" ) );
-      Serial.print( receivedData );
-      Serial.println( "***" );
-        Serial.flush();
-
-      if(strncmp(receivedData, "mac_tx_ok", 9) == 0 )
-      {
-        //SUCCESS!!
-          if ( expectDownlink ) {
-                Serial.println( F("ok received. waiting on post-downlink") );
-                Serial.flush();
-              _serial->setTimeout(30000);
-              receivedData = readCharStringUntil(_serial, 120000, '\n', buf, sizeof( buf ) );
-              _serial->setTimeout(2000);
-
-                if ( receivedData == NULL ) {
-                    Serial.println( F("failed to receive downlink data") );
-                    Serial.flush();
-                    return NULL;
-                }
-
-              //TODO: Debug print on receivedData
-              Serial.print( ("post-downlink received data: ***" ) );
-              Serial.print( receivedData );
-              Serial.println( "***" );
-                Serial.flush();
-
-              if ( strncmp( receivedData, "mac_rx", 6 ) == 0 ) {
-                  send_success = true;
-                  return TX_SUCCESS;
-              } else {
-                  send_success = false;
-                  return TX_FAIL;
-              }
-          }
-        send_success = true;
-        return TX_SUCCESS;
-      }
+  return _txState;
+}
 
-      else if(strncmp(receivedData, "mac_rx", 6) == 0 )
-      {
-        //example: mac_rx 1 54657374696E6720313233
-//        FIXME_rxMessage = receivedData.substring(receivedData.indexOf(' ', 7)+1);
-        send_success = true;
-        return TX_WITH_RX;
-      }
+TX_STATE rn2xx3::txState()
+{
+  return _txState;
+}
 
-      else if(strncmp(receivedData, "mac_err", 7) == 0 )
-      {
-//        init();
-          return TX_FAIL;
-      }
+TX_RETURN_TYPE rn2xx3::txResult()
+{
+  return _txResult;
+}
 
-      else if(strncmp(receivedData, "invalid_data_len", 16) == 0)
-      {
-        //this should never happen if the prototype worked
-        send_success = true;
-        return TX_FAIL;
-      }
+bool rn2xx3::commandBegin( const char *command )
+{
+  if ( _txState != TX_IDLE && _txState != TX_DONE ) {
+      return false;
+  }
 
-      else if(strncmp(receivedData, "radio_tx_ok", 11) == 0)
-      {
-        //SUCCESS!!
-        send_success = true;
-        return TX_SUCCESS;
-      }
+  if ( rn2xx3_command_class( command ) == RN_CMD_MAC_TX ) {
+      // The same retries, duty cycle booking and timeouts as txBegin(),
+      // with the payload left in the command
+      const char *hex = strrchr( command, ' ' );
+      _txData = "";
+      _txPayload = NULL;
+      _txLength = hex != NULL ? strlen( hex + 1 ) / 2 : 0;
+      _txStart( command, strncmp( command, "mac tx cnf ", 11 ) == 0 );
+      return true;
+  }
 
-      else if(strncmp(receivedData, "radio_err", 9) == 0)
-      {
-        //This should never happen. If it does, something major is wrong.
-        init();
-      }
+  _beginCommand();
+  RN2XX3_DEBUG( F("RAW: "), command );
+  _txCommand = command;
+  _txResult = TX_FAIL;
+  _stats.command( rn2xx3_command_class( command ), _clock->millis() );
+  _serial->println( command );
 
-      else
-      {
-        //unknown response
-        //init();
-      }
-    }
+  _txWait( TX_WAIT_REPLY, _timeout );
+  return true;
+}
 
-    else if(strncmp(receivedData, "invalid_param", 13) == 0)
-    {
-      //should not happen if we typed the commands correctly
-      send_success = true;
-      return TX_FAIL;
-    }
+const char *rn2xx3::reply()
+{
+  return _reader.line();
+}
 
-    else if(strncmp(receivedData, "not_joined", 10) == 0)
-    {
-      init();
-    }
+void rn2xx3::_txSend()
+{
+  if ( _txNoFreeChCount > 5 ) {
+      /** Exceeded duty cycle....just bail now */
+      _txFinish( TX_NO_FREE_CH );
+      return;
+  }
+  //retransmit a maximum of 10 times
+  _txRetryCount++;
+  if ( _txRetryCount > 10 ) {
+      _txFinish( TX_FAIL );
+      return;
+  }
 
-    else if(strncmp(receivedData, "no_free_ch", 10) == 0)
-    {
-      no_free_ch_count++;
-      delay(1000);
-    }
+#if RN2XX3_LOG_LEVEL >= RN2XX3_LOG_DEBUG
+  if ( _debug ) {
+      _debug->print( F("TX: ***") );
+      _debug->print( _txCommand );
+      if ( _txPayload ) {
+          rn2xx3_write_hex( *_debug, _txPayload, _txLength );
+      } else {
+          _debug->print( _txData );
+      }
+      _debug->println( F("***") );
+  }
+#endif
+  _stats.command( RN_CMD_MAC_TX, _clock->millis() );
+  _serial->print(_txCommand);
+  if ( _txPayload ) {
+      rn2xx3_write_hex( *_serial, _txPayload, _txLength );
+  } else {
+      _serial->print(_txData);
+  }
+  _serial->println();
+
+  _txWait( TX_WAIT_OK, 10000 );
+}
+
+void rn2xx3::_txWait( TX_STATE state, unsigned long timeout )
+{
+  _txState = state;
+  _txStartMillis = _clock->millis();
+  _txTimeout = timeout;
+}
+
+void rn2xx3::_txFinish( TX_RETURN_TYPE result )
+{
+  _txResult = result;
+  _txState = TX_DONE;
+}
+
+void rn2xx3::_txHandleLine( const char *receivedData )
+{
+  RN2XX3_DEBUG( F("received data: "), receivedData );
 
-    else if(strncmp(receivedData, "silent", 6) == 0)
+  uint8_t args;
+  RN_RESPONSE response = rn2xx3_classify( receivedData, &args );
+  // poll() passes an empty line on a timeout
+  _stats.reply( receivedData[0] == '\0' ? RN_TIMEOUT : response, _clock->millis() );
+
+  switch ( _txState ) {
+    case TX_WAIT_AR:
     {
-      init();
+      // Whatever the module thinks of "mac set ar", go on with the tx
+      if ( response == RN_OK ) {
+          _shadow.set( rn2xx3_shadow::AR, _txExpectDownlink );
+      } else {
+          _shadow.forget( rn2xx3_shadow::AR );
+      }
+      _txSend();
+      break;
     }
 
-    else if(strncmp(receivedData, "frame_counter_err_rejoin_needed", 31) == 0)
+    case TX_WAIT_OK:
     {
-      init();
+      switch ( response ) {
+        case RN_OK:
+          // The frame counter moved on, so save() has something to keep
+          _shadow.changed();
+          _dutyCycle.record( _clock->millis(), _dataRate,
+                             _frameAirtime( RN2XX3_LORAWAN_OVERHEAD + _txLength, 1 ) );
+          _txWait( TX_WAIT_UPLINK, 120000 );
+          break;
+
+        case RN_INVALID_PARAM:
+          //should not happen if we typed the commands correctly
+          _txFinish( TX_FAIL );
+          break;
+
+        case RN_NO_FREE_CH:
+          _txNoFreeChCount++;
+          _txWait( TX_BACKOFF, 1000 );
+          break;
+
+        case RN_BUSY:
+          _txBusyCount++;
+
+          // Not sure if this is wise. At low data rates with large packets
+          // this can perhaps cause transmissions at more than 1% duty cycle.
+          // Need to calculate the correct constant value.
+          // But it is wise to have this check and re-init in case the
+          // lorawan stack in the RN2xx3 hangs.
+          if(_txBusyCount>=10)
+          {
+            init();
+            _txSend();
+          }
+          else
+          {
+            _txWait( TX_BACKOFF, 1000 );
+          }
+          break;
+
+        case RN_INVALID_DATA_LEN:
+          //should not happen if the prototype worked
+          _txFinish( TX_FAIL );
+          break;
+
+        default:
+          // not_joined, silent, frame_counter_err_rejoin_needed, mac_paused
+          // or an unknown response after mac tx command
+          init();
+          _txSend();
+          break;
+      }
+      break;
     }
 
-    else if(strncmp(receivedData, "busy", 4) == 0)
+    case TX_WAIT_UPLINK:
     {
-      busy_count++;
-
-      // Not sure if this is wise. At low data rates with large packets
-      // this can perhaps cause transmissions at more than 1% duty cycle.
-      // Need to calculate the correct constant value.
-      // But it is wise to have this check and re-init in case the
-      // lorawan stack in the RN2xx3 hangs.
-      if(busy_count>=10)
-      {
-        init();
+      if ( response == RN_MAC_TX_OK || response == RN_MAC_RX ) {
+          // MAC commands in the receive windows come with either
+          _shadow.invalidateNetwork();
       }
-      else
-      {
-        delay(1000);
+      switch ( response ) {
+        case RN_MAC_TX_OK:
+          //SUCCESS!!
+          if ( _txExpectDownlink ) {
+              _txWait( TX_WAIT_DOWNLINK, 120000 );
+          } else {
+              _txFinish( TX_SUCCESS );
+          }
+          break;
+
+        case RN_MAC_RX:
+          //example: mac_rx 1 54657374696E6720313233
+          _rxDecode( receivedData + args );
+          _txFinish( TX_WITH_RX );
+          break;
+
+        case RN_MAC_ERR:
+        case RN_INVALID_DATA_LEN:
+          _txFinish( TX_FAIL );
+          break;
+
+        case RN_RADIO_TX_OK:
+          //SUCCESS!!
+          _txFinish( TX_SUCCESS );
+          break;
+
+        case RN_RADIO_ERR:
+          //This should never happen. If it does, something major is wrong.
+          init();
+          _txSend();
+          break;
+
+        default:
+          //unknown response
+          _txSend();
+          break;
       }
+      break;
     }
 
-    else if(strncmp(receivedData, "mac_paused", 10) == 0)
+    case TX_WAIT_REPLY:
     {
-      init();
+      if ( receivedData[0] == '\0' ) {
+          _txFinish( TX_FAIL );
+          break;
+      }
+      if ( response == RN_OK && rn2xx3_command_class( _txCommand ) == RN_CMD_JOIN ) {
+          // Accepted, the result comes after the airtime
+          _txWait( TX_WAIT_REPLY, 30000 );
+          break;
+      }
+      _lastReplyMillis = _clock->millis();
+      _txFinish( TX_SUCCESS );
+      break;
     }
 
-    else if(strncmp(receivedData, "invalid_data_len", 16) == 0)
+    case TX_WAIT_DOWNLINK:
     {
-      //should not happen if the prototype worked
-      send_success = true;
-      return TX_FAIL;
+      if ( response == RN_MAC_RX ) {
+          _rxDecode( receivedData + args );
+      }
+      _txFinish( response == RN_MAC_RX ? TX_SUCCESS : TX_FAIL );
+      break;
     }
 
-    else
-    {
-      //unknown response after mac tx command
-      init();
-    }
+    default:
+      break;
   }
+}
 
-  return TX_FAIL; //should never reach this
-}
-
-// void rn2xx3::sendEncoded(String input)
-// {
-//   char working;
-//   char buffer[3];
-//   for (unsigned i=0; i<input.length(); i++)
-//   {
-//     working = input.charAt(i);
-//     sprintf(buffer, "%02x", int(working));
-//     _serial->print(buffer);
-//   }
-// }
-
-// String rn2xx3::base16encode(String input)
-// {
-//   char charsOut[input.length()*2+1];
-//   char charsIn[input.length()+1];
-//   input.trim();
-//   input.toCharArray(charsIn, input.length()+1);
-
-//   unsigned i = 0;
-//   for(i = 0; i<input.length()+1; i++)
-//   {
-//     if(charsIn[i] == '\0') break;
-
-//     int value = int(charsIn[i]);
-
-//     char buffer[3];
-//     sprintf(buffer, "%02x", value);
-//     charsOut[2*i] = buffer[0];
-//     charsOut[2*i+1] = buffer[1];
-//   }
-//   charsOut[2*i] = '\0';
-//   String toReturn = String(charsOut);
-//   return toReturn;
-// }
+/**
+ * Decode "<port> <hex>" from a mac_rx line into the receive buffer and
+ * call the handler for the port.
+ */
+void rn2xx3::_rxDecode( const char *args )
+{
+  uint8_t port = 0;
+  while ( *args >= '0' && *args <= '9' ) {
+      port = port * 10 + ( *args++ - '0' );
+  }
+  if ( *args == ' ' ) {
+      args++;
+  }
+
+  if ( _reader.overflowed() ) {
+      // The end of the payload did not fit in the line buffer
+      RN2XX3_ERROR( F("Downlink longer than RN2XX3_MAX_DOWNLINK") );
+      _rxPort = port;
+      _rxLength = 0;
+      _rxMessage[0] = '\0';
+      return;
+  }
+
+  int16_t length = rn2xx3_read_hex( args, _rxBuffer, _rxSize );
+  _rxPort = port;
+  _rxLength = length < 0 ? 0 : length;
+  if ( _rxBuffer == _rxMessage ) {
+      // _rxMessage has a byte past RN2XX3_MAX_DOWNLINK for this
+      _rxMessage[_rxLength] = '\0';
+  } else if ( _rxLength < _rxSize ) {
+      _rxBuffer[_rxLength] = '\0';
+  }
+  if ( length < 0 ) {
+      return;
+  }
+
+  rn2xx3_rx_handler handler = NULL;
+  for ( uint8_t i = 0; i < RN2XX3_RX_HANDLERS; i++ ) {
+      if ( _rxHandlers[i].handler == NULL ) {
+          continue;
+      }
+      if ( _rxHandlers[i].port == port ) {
+          handler = _rxHandlers[i].handler;
+          break;
+      }
+      if ( _rxHandlers[i].port == 0 ) {
+          handler = _rxHandlers[i].handler;
+      }
+  }
+  if ( handler != NULL ) {
+      handler( port, _rxBuffer, _rxLength );
+  }
+}
 
 char *rn2xx3::getRx() {
-  return _rxMessage;
+  if ( _rxBuffer != _rxMessage ) {
+      // Not necessarily NUL terminated
+      return (char *)"";
+  }
+  return (char *)_rxMessage;
+}
+
+const byte *rn2xx3::getRxBytes()
+{
+  return _rxBuffer;
+}
+
+uint8_t rn2xx3::getRxLength()
+{
+  return _rxLength;
+}
+
+uint8_t rn2xx3::getRxPort()
+{
+  return _rxPort;
+}
+
+void rn2xx3::setRxBuffer( byte *buffer, uint8_t size )
+{
+  if ( buffer == NULL ) {
+      buffer = _rxMessage;
+      size = RN2XX3_MAX_DOWNLINK;
+  }
+  // The reply line holds no more
+  if ( size > RN2XX3_MAX_DOWNLINK ) {
+      size = RN2XX3_MAX_DOWNLINK;
+  }
+  _rxBuffer = buffer;
+  _rxSize = size;
+  _rxLength = 0;
+  _rxMessage[0] = '\0';
+}
+
+bool rn2xx3::onReceive( uint8_t port, rn2xx3_rx_handler handler )
+{
+  int8_t slot = -1;
+  for ( uint8_t i = 0; i < RN2XX3_RX_HANDLERS; i++ ) {
+      if ( _rxHandlers[i].handler != NULL && _rxHandlers[i].port == port ) {
+          slot = i;
+          break;
+      }
+      if ( _rxHandlers[i].handler == NULL && slot < 0 ) {
+          slot = i;
+      }
+  }
+  if ( slot < 0 ) {
+      return handler == NULL;
+  }
+  _rxHandlers[slot].port = port;
+  _rxHandlers[slot].handler = handler;
+  return true;
 }
 
 int rn2xx3::getSNR()
 {
-  String snr = sendRawCommand(F("radio get snr"));
-  snr.trim();
-  return snr.toInt();
-}
-
-// String rn2xx3::base16decode(String input)
-// {
-//   char charsIn[input.length()+1];
-//   char charsOut[input.length()/2+1];
-//   input.trim();
-//   input.toCharArray(charsIn, input.length()+1);
-
-//   unsigned i = 0;
-//   for(i = 0; i<input.length()/2+1; i++)
-//   {
-//     if(charsIn[i*2] == '\0') break;
-//     if(charsIn[i*2+1] == '\0') break;
-
-//     char toDo[2];
-//     toDo[0] = charsIn[i*2];
-//     toDo[1] = charsIn[i*2+1];
-//     int out = strtoul(toDo, 0, 16);
-
-//     if(out<128)
-//     {
-//       charsOut[i] = char(out);
-//     }
-//   }
-//   charsOut[i] = '\0';
-//   return charsOut;
-// }
+  return atoi( sendRawCommand(F("radio get snr")) );
+}
 
 void rn2xx3::setDR(int dr)
 {
   if(dr>=0 && dr<=5)
   {
-    delay(100);
-    while(_serial->available())
-      _serial->read();
-    _serial->print("mac set dr ");
-    _serial->println(dr);
-    _serial->readStringUntil('\n');
+    if ( _macSetNumber( rn2xx3_shadow::DR, F("mac set dr "), dr ) ) {
+      _dataRate = dr;
+    }
+  }
+}
+
+uint32_t rn2xx3::_frameAirtime( uint8_t phyLength, uint8_t codingRate )
+{
+  uint8_t sf;
+  uint16_t bandwidth;
+  if ( !rn2xx3_dr_modulation( _moduleType, _dataRate, sf, bandwidth ) ) {
+      return 0;
+  }
+  return rn2xx3_airtime_us( sf, bandwidth, phyLength, codingRate );
+}
+
+uint32_t rn2xx3::airtime( uint8_t length, uint8_t codingRate )
+{
+  return _frameAirtime( RN2XX3_LORAWAN_OVERHEAD + length, codingRate );
+}
+
+unsigned long rn2xx3::nextTxAllowedAt()
+{
+  return _dutyCycle.nextFree( _clock->millis(), _dataRate );
+}
+
+void rn2xx3::setDebugOutput( Print *output )
+{
+  _debug = output;
+}
+
+#if RN2XX3_LOG_LEVEL > RN2XX3_LOG_NONE
+void rn2xx3::_log( const __FlashStringHelper *message )
+{
+  if ( _debug ) {
+      _debug->println( message );
+  }
+}
+
+void rn2xx3::_log( const __FlashStringHelper *prefix, const char *text, const char *more )
+{
+  if ( _debug ) {
+      _debug->print( prefix );
+      _debug->print( F("***") );
+      _debug->print( text );
+      if ( more ) {
+          _debug->print( more );
+      }
+      _debug->println( F("***") );
   }
 }
 
+void rn2xx3::_log( const __FlashStringHelper *prefix, const __FlashStringHelper *text, const char *more )
+{
+  if ( _debug ) {
+      _debug->print( prefix );
+      _debug->print( F("***") );
+      _debug->print( text );
+      if ( more ) {
+          _debug->print( more );
+      }
+      _debug->println( F("***") );
+  }
+}
+#endif
+
+const rn2xx3_stats &rn2xx3::stats()
+{
+  return _stats;
+}
+
+void rn2xx3::resetStats()
+{
+  _stats.reset();
+}
+
+void rn2xx3::invalidateCache()
+{
+  _shadow.invalidate();
+  _shadow.changed();
+}
+
+/**
+ * The "mac set" helpers below skip the command if the shadow copy says
+ * the module already has the value, and record the value once the module
+ * acknowledged it. They return true if the value is in effect.
+ */
+bool rn2xx3::_macSetOnOff( rn2xx3_shadow::setting s, const __FlashStringHelper *command, bool on )
+{
+  if ( _shadow.has( s, on ) ) {
+      return true;
+  }
+  if ( rn2xx3_classify( sendRawCommand( command, on ? "on" : "off" ) ) != RN_OK ) {
+      _shadow.forget( s );
+      return false;
+  }
+  _shadow.set( s, on );
+  return true;
+}
+
+bool rn2xx3::_macSetNumber( rn2xx3_shadow::setting s, const __FlashStringHelper *command, uint8_t value )
+{
+  if ( _shadow.has( s, value ) ) {
+      return true;
+  }
+  char arg[4];
+  sprintf( arg, "%u", value );
+  if ( rn2xx3_classify( sendRawCommand( command, arg ) ) != RN_OK ) {
+      _shadow.forget( s );
+      return false;
+  }
+  _shadow.set( s, value );
+  return true;
+}
+
+bool rn2xx3::_macSetRx2( uint8_t dr, uint32_t freq )
+{
+  if ( _shadow.hasRx2( dr, freq ) ) {
+      return true;
+  }
+  char arg[16];
+  sprintf( arg, "%u %lu", dr, (unsigned long)freq );
+  if ( rn2xx3_classify( sendRawCommand( F("mac set rx2 "), arg ) ) != RN_OK ) {
+      _shadow.forget( rn2xx3_shadow::RX2 );
+      return false;
+  }
+  _shadow.setRx2( dr, freq );
+  return true;
+}
+
+bool rn2xx3::_macSetChFreq( uint8_t ch, uint32_t freq )
+{
+  if ( _shadow.hasChFreq( ch, freq ) ) {
+      return true;
+  }
+  char arg[16];
+  sprintf( arg, "%u %lu", ch, (unsigned long)freq );
+  if ( rn2xx3_classify( sendRawCommand( F("mac set ch freq "), arg ) ) != RN_OK ) {
+      return false;
+  }
+  _shadow.setChFreq( ch, freq );
+  return true;
+}
+
+bool rn2xx3::_macSetChDcycle( uint8_t ch, uint16_t dcycle )
+{
+  _dutyCycle.setDcycle( ch, dcycle );
+  if ( _shadow.hasChDcycle( ch, dcycle ) ) {
+      return true;
+  }
+  char arg[12];
+  sprintf( arg, "%u %u", ch, dcycle );
+  if ( rn2xx3_classify( sendRawCommand( F("mac set ch dcycle "), arg ) ) != RN_OK ) {
+      return false;
+  }
+  _shadow.setChDcycle( ch, dcycle );
+  return true;
+}
+
+bool rn2xx3::_macSetChDrrange( uint8_t ch, uint8_t minDr, uint8_t maxDr )
+{
+  _dutyCycle.setDrrange( ch, minDr, maxDr );
+  if ( _shadow.hasChDrrange( ch, minDr, maxDr ) ) {
+      return true;
+  }
+  char arg[12];
+  sprintf( arg, "%u %u %u", ch, minDr, maxDr );
+  if ( rn2xx3_classify( sendRawCommand( F("mac set ch drrange "), arg ) ) != RN_OK ) {
+      return false;
+  }
+  _shadow.setChDrrange( ch, minDr, maxDr );
+  return true;
+}
+
+bool rn2xx3::_macSetChStatus( uint8_t ch, bool on )
+{
+  _dutyCycle.setStatus( ch, on );
+  if ( _shadow.hasChStatus( ch, on ) ) {
+      return true;
+  }
+  char arg[8];
+  sprintf( arg, "%u %s", ch, on ? "on" : "off" );
+  if ( rn2xx3_classify( sendRawCommand( F("mac set ch status "), arg ) ) != RN_OK ) {
+      return false;
+  }
+  _shadow.setChStatus( ch, on );
+  return true;
+}
+
 void rn2xx3::sleep(long msec)
 {
   _serial->print("sys sleep ");
   _serial->println(msec);
 }
 
-char *rn2xx3::sendRawCommand( const __FlashStringHelper *command ) {
-    delay(100);
-#ifdef ARDUINO
-  Serial.print( F("RAW: ***") );
-  Serial.print( command );
-  Serial.println( F("***") );
-#endif
-    while( _serial->available() ) {
-        _serial->read();
-    }
-    _serial->println( command );
-    //String ret = _serial->readStringUntil('\n');
-    readCharStringUntil( _serial, _timeout, '\n', buf, sizeof( buf ) );
-#ifdef ARDUINO
-    Serial.print( F("***") );
-    Serial.print( buf );
-    Serial.println( F("***") );
-#endif
-    //ret.trim();
+void rn2xx3::setCommandGap( unsigned long msec )
+{
+  _commandGap = msec;
+}
 
-    //TODO: Add debug print
+/**
+ * Called before every raw command. Waits out what is left of the
+ * inter-command gap, if one is configured, and drains stale bytes.
+ */
+void rn2xx3::_beginCommand()
+{
+  if ( _commandGap > 0 ) {
+      unsigned long elapsed = _clock->millis() - _lastReplyMillis;
+      if ( elapsed < _commandGap ) {
+          _clock->delay( _commandGap - elapsed );
+      }
+  }
+  while( _serial->available() ) {
+      _serial->read();
+  }
+  _reader.reset();
+}
 
-    return buf;
+/**
+ * Wait for the reply line of the command that was just sent.
+ * Returns as soon as the line is complete.
+ */
+char *rn2xx3::_readReply()
+{
+  _readLine( _timeout );
+  _lastReplyMillis = _clock->millis();
+  RN2XX3_DEBUG( F(""), buf );
+
+  return buf;
+}
+
+char *rn2xx3::sendRawCommand( const __FlashStringHelper *command ) {
+  _beginCommand();
+  RN2XX3_DEBUG( F("RAW: "), command );
+  _stats.command( rn2xx3_command_class( command ), _clock->millis() );
+  _serial->println( command );
+  return _readReply();
 }
 
 /** Command should have a space at the end... */
 char *rn2xx3::sendRawCommand( const __FlashStringHelper *command, const char *arg ) {
-  delay(100);
-#ifdef ARDUINO
-  Serial.print( F("RAW: ***") );
-  Serial.print( command );
-  Serial.print( arg );
-  Serial.println( F("***") );
-#endif
-  while(_serial->available())
-    _serial->read();
+  _beginCommand();
+  RN2XX3_DEBUG( F("RAW: "), command, arg );
+  _stats.command( rn2xx3_command_class( command ), _clock->millis() );
   _serial->print(command);
   _serial->println(arg);
-  //String ret = _serial->readStringUntil('\n');
-  readCharStringUntil( _serial, _timeout, '\n', buf, sizeof( buf ) );
-#ifdef ARDUINO
-    Serial.print( F("***") );
-    Serial.print( buf );
-    Serial.println( F("***") );
-#endif
-  //ret.trim();
-
-  //TODO: Add debug print
-
-  return buf;
+  return _readReply();
 }
 
 char *rn2xx3::sendRawCommand( char *command ) {
-  delay(100);
-#ifdef ARDUINO
-  Serial.print( F("RAW: ***") );
-  Serial.print( command );
-  Serial.println( F("***") );
-#endif
-  while(_serial->available())
-    _serial->read();
+  _beginCommand();
+  RN2XX3_DEBUG( F("RAW: "), command );
+  _stats.command( rn2xx3_command_class( command ), _clock->millis() );
   _serial->println(command);
-  readCharStringUntil( _serial, _timeout, '\n', buf, sizeof( buf ) );
-#ifdef ARDUINO
-    Serial.print( F("***") );
-    Serial.print( buf );
-    Serial.println( F("***") );
-#endif
-  //ret.trim();
-
-  return buf;
+  return _readReply();
 }
 
 RN2xx3_t rn2xx3::moduleType()
@@ -849,197 +1392,89 @@ RN2xx3_t rn2xx3::moduleType()
 
 bool rn2xx3::setFrequencyPlan(FREQ_PLAN fp)
 {
-  bool returnValue;
-
   switch (fp)
   {
     case SINGLE_CHANNEL_EU:
-    {
-      if(_moduleType == RN2483)
-      {
-        //mac set rx2 <dataRate> <frequency>
-        //sendRawCommand(F("mac set rx2 5 868100000")); //use this for "strict" one channel gateways
-        sendRawCommand(F("mac set rx2 3 869525000")); //use for "non-strict" one channel gateways
-        sendRawCommand(F("mac set ch dcycle 0 99")); //1% duty cycle for this channel
-        sendRawCommand(F("mac set ch dcycle 1 65535")); //almost never use this channel
-        sendRawCommand(F("mac set ch dcycle 2 65535")); //almost never use this channel
-
-        returnValue = true;
-      }
-      else
-      {
-        returnValue = false;
-      }
-      break;
-    }
-
+      return setFrequencyPlan(&rn2xx3_plan_single_channel_eu);
     case TTN_EU:
-    {
-      if(_moduleType == RN2483)
-      {
-      /*
-       * The <dutyCycle> value that needs to be configured can be
-       * obtained from the actual duty cycle X (in percentage)
-       * using the following formula: <dutyCycle> = (100/X) – 1
-       *
-       *  10% -> 9
-       *  1% -> 99
-       *  0.33% -> 299
-       *  8 channels, total of 1% duty cycle:
-       *  0.125% per channel -> 799
-       *
-       * Most of the TTN_EU frequency plan was copied from:
-       * https://github.com/TheThingsNetwork/arduino-device-lib
-       */
-
-        //RX window 2
-        sendRawCommand(F("mac set rx2 3 869525000"));
-
-        //channel 0
-        sendRawCommand(F("mac set ch dcycle 0 799"));
-
-        //channel 1
-        sendRawCommand(F("mac set ch drrange 1 0 6"));
-        sendRawCommand(F("mac set ch dcycle 1 799"));
-
-        //channel 2
-        sendRawCommand(F("mac set ch dcycle 2 799"));
-
-        //channel 3
-        sendRawCommand(F("mac set ch freq 3 867100000"));
-        sendRawCommand(F("mac set ch drrange 3 0 5"));
-        sendRawCommand(F("mac set ch dcycle 3 799"));
-        sendRawCommand(F("mac set ch status 3 on"));
-
-        //channel 4
-        sendRawCommand(F("mac set ch freq 4 867300000"));
-        sendRawCommand(F("mac set ch drrange 4 0 5"));
-        sendRawCommand(F("mac set ch dcycle 4 799"));
-        sendRawCommand(F("mac set ch status 4 on"));
-
-        //channel 5
-        sendRawCommand(F("mac set ch freq 5 867500000"));
-        sendRawCommand(F("mac set ch drrange 5 0 5"));
-        sendRawCommand(F("mac set ch dcycle 5 799"));
-        sendRawCommand(F("mac set ch status 5 on"));
-
-        //channel 6
-        sendRawCommand(F("mac set ch freq 6 867700000"));
-        sendRawCommand(F("mac set ch drrange 6 0 5"));
-        sendRawCommand(F("mac set ch dcycle 6 799"));
-        sendRawCommand(F("mac set ch status 6 on"));
-
-        //channel 7
-        sendRawCommand(F("mac set ch freq 7 867900000"));
-        sendRawCommand(F("mac set ch drrange 7 0 5"));
-        sendRawCommand(F("mac set ch dcycle 7 799"));
-        sendRawCommand(F("mac set ch status 7 on"));
-
-        returnValue = true;
-      }
-      else
-      {
-        returnValue = false;
-      }
+      return setFrequencyPlan(&rn2xx3_plan_ttn_eu);
+    case TTN_US:
+      return setFrequencyPlan(&rn2xx3_plan_ttn_us);
+    case DEFAULT_EU:
+      return setFrequencyPlan(&rn2xx3_plan_default_eu);
+    default:
+      //set default channels 868.1, 868.3 and 868.5?
+      return false; //well we didn't do anything, so yes, false
+  }
+}
 
-      break;
-    }
+bool rn2xx3::setFrequencyPlan(const rn2xx3_plan *planP)
+{
+  rn2xx3_plan plan;
+  memcpy_P( &plan, planP, sizeof( plan ) );
 
-    case TTN_US:
-    {
-    /*
-     * Most of the TTN_US frequency plan was copied from:
-     * https://github.com/TheThingsNetwork/arduino-device-lib
-     */
-      if(_moduleType == RN2903)
-      {
-        for(int channel=0; channel<72; channel++)
-        {
-          // Build command string. First init, then add int.
-#ifdef PANTS
-          String command = F("mac set ch status ");
-          command += channel;
-
-          if(channel>=8 && channel<16)
-          {
-            sendRawCommand(command+F(" on"));
-          }
-          else
-          {
-            sendRawCommand(command+F(" off"));
-          }
-#endif
-        }
-        returnValue = true;
+  if ( plan.module != _moduleType ) {
+      return false;
+  }
+
+  bool ok = true;
+
+  if ( plan.rx2Freq != 0 ) {
+      //RX window 2
+      ok &= _macSetRx2( plan.rx2Dr, plan.rx2Freq );
+  }
+
+  for ( uint8_t i = 0; i < plan.channelCount; i++ ) {
+      rn2xx3_plan_channel ch;
+      memcpy_P( &ch, &plan.channels[i], sizeof( ch ) );
+
+      if ( ch.flags & RN2XX3_CH_FREQ ) {
+          ok &= _macSetChFreq( ch.channel, ch.freq );
       }
-      else
-      {
-        returnValue = false;
+      if ( ch.flags & RN2XX3_CH_DRRANGE ) {
+          ok &= _macSetChDrrange( ch.channel, ch.drrange >> 4, ch.drrange & 0x0F );
       }
-      break;
-    }
-
-    case DEFAULT_EU:
-    {
-      if(_moduleType == RN2483)
-      {
-        //fix duty cycle - 1% = 0.33% per channel
-        sendRawCommand(F("mac set ch dcycle 0 799"));
-        sendRawCommand(F("mac set ch dcycle 1 799"));
-        sendRawCommand(F("mac set ch dcycle 2 799"));
-
-        //disable non-default channels
-        sendRawCommand(F("mac set ch status 3 on"));
-        sendRawCommand(F("mac set ch status 4 on"));
-        sendRawCommand(F("mac set ch status 5 on"));
-        sendRawCommand(F("mac set ch status 6 on"));
-        sendRawCommand(F("mac set ch status 7 on"));
-
-        returnValue = true;
+      if ( ch.flags & RN2XX3_CH_DCYCLE ) {
+          ok &= _macSetChDcycle( ch.channel, ch.dcycle );
       }
-      else
-      {
-        returnValue = false;
+      if ( ch.flags & RN2XX3_CH_STATUS_ON ) {
+          ok &= _macSetChStatus( ch.channel, true );
       }
+      if ( ch.flags & RN2XX3_CH_STATUS_OFF ) {
+          ok &= _macSetChStatus( ch.channel, false );
+      }
+  }
 
-      break;
-    }
-    default:
-    {
-      //set default channels 868.1, 868.3 and 868.5?
-      returnValue = false; //well we didn't do anything, so yes, false
-      break;
-    }
+  if ( plan.subBand != 0 ) {
+      // Only the 8 channels of the sub-band, no 500kHz channels
+      uint8_t first = ( plan.subBand - 1 ) * 8;
+      for ( uint8_t channel = 0; channel < 72; channel++ ) {
+          ok &= _macSetChStatus( channel, channel >= first && channel < first + 8 );
+      }
   }
 
-  return returnValue;
+  return ok;
 }
 
 bool rn2xx3::isJoined() {
     sendRawCommand(F("mac get status"));
-//    Serial.print( F("Status: ***") );
-//    Serial.print( rv );
-//    Serial.println( F("***") );
-
-    /** Decode the status packet */
-    /** We're only interested in bit0 */
-    if ( strlen(buf) == 4 ) {
-        /** Up to 1.0.3 RN2483 firmware */
-        uint8_t bval3 = (int)buf[3] - '0';
-        return (bval3 & 0x01) == 0x01;
-    } else {
-        if ( strlen(buf) == 8 ) {
-            /** 1.0.4+ RN2483 firmware */
-            uint8_t bval3 = (int)buf[6] - '0';
-            return (bval3 & 0x01) == 0x01;
-        } else {
-            return false;
-        }
-    }
 
+    /** Decode the status word, 4 hex digits up to 1.0.3 RN2483 firmware */
+    /** and 8 from 1.0.4. We're only interested in bit0 */
+    size_t len = strlen(buf);
+    if ( len != 4 && len != 8 ) {
+        return false;
+    }
+    char *end;
+    unsigned long status = strtoul( buf, &end, 16 );
+    if ( *end != '\0' ) {
+        return false;
+    }
+    return (status & 0x01) == 0x01;
 }
 
 char *rn2xx3::factoryReset() {
+    _shadow.invalidate();
     return sendRawCommand( F("sys factoryRESET") );
 }
 
@@ -11,6 +11,72 @@
 #define rn2xx3_h
 
 #include "Arduino.h"
+#include "rn2xx3_clock.h"
+#include "rn2xx3_line_reader.h"
+#include "rn2xx3_response.h"
+#include "rn2xx3_shadow.h"
+#include "rn2xx3_freqplan.h"
+#include "rn2xx3_airtime.h"
+#include "rn2xx3_hex.h"
+#include "rn2xx3_stats.h"
+#include "rn2xx3_log.h"
+
+// The largest downlink payload in bytes this library can receive. Each byte
+// takes two characters in the reply line buffer, so raise this with care
+// on small AVRs. LoRaWAN allows no more than 242.
+#ifndef RN2XX3_MAX_DOWNLINK
+#define RN2XX3_MAX_DOWNLINK 32
+#endif
+#if RN2XX3_MAX_DOWNLINK > 255
+#error "RN2XX3_MAX_DOWNLINK must fit the uint8_t downlink lengths"
+#endif
+
+// "mac_rx 223 ", the hex payload and the terminating NUL
+#define RN2XX3_LINE_SIZE ( 12 + 2 * RN2XX3_MAX_DOWNLINK )
+
+// autobaud() waits this many milliseconds for the first reply and twice as
+// long after every failed attempt, up to RN2XX3_AUTOBAUD_MAX_WAIT
+#ifndef RN2XX3_AUTOBAUD_WAIT
+#define RN2XX3_AUTOBAUD_WAIT 50
+#endif
+#ifndef RN2XX3_AUTOBAUD_MAX_WAIT
+#define RN2XX3_AUTOBAUD_MAX_WAIT 1000
+#endif
+#ifndef RN2XX3_AUTOBAUD_ATTEMPTS
+#define RN2XX3_AUTOBAUD_ATTEMPTS 10
+#endif
+
+// A session resumed after a power cycle moves the uplink frame counter
+// this far past the one restored from EEPROM. Call save() at least this
+// often in uplinks, or the network drops some as replays.
+#ifndef RN2XX3_UPCTR_MARGIN
+#define RN2XX3_UPCTR_MARGIN 100
+#endif
+
+// initOTAA() keeps two bytes derived from the AppKey of the saved session
+// at this address of the module's user EEPROM (0x300 to 0x3FF), because
+// the module can't read the AppKey back
+#ifndef RN2XX3_APPKEY_TAG_NVM
+#define RN2XX3_APPKEY_TAG_NVM 0x3FE
+#endif
+
+// The number of ports that can have a downlink handler
+#ifndef RN2XX3_RX_HANDLERS
+#define RN2XX3_RX_HANDLERS 4
+#endif
+
+/*
+ * Switches the host's UART to another baud rate, for rn2xx3::setBaud(), e.g.
+ *   void serial1Baud( unsigned long baud ) { Serial1.begin( baud ); }
+ */
+typedef void (*rn2xx3_baud_setter)( unsigned long baud );
+
+/*
+ * Called with the FPort and the decoded payload of every downlink.
+ * data points into the receive buffer and is only valid until the next
+ * downlink. A handler must not start another transmission.
+ */
+typedef void (*rn2xx3_rx_handler)( uint8_t port, const byte *data, uint8_t length );
 
 enum RN2xx3_t {
   RN_NA = 0, // Not set
@@ -38,29 +104,59 @@ enum TX_RETURN_TYPE {
   TX_NO_FREE_CH = 3
 };
 
+enum TX_STATE {
+  TX_IDLE = 0,      // No transmission has been started.
+  TX_WAIT_AR,       // Waiting for the reply to "mac set ar".
+  TX_WAIT_OK,       // The tx command was sent, waiting for the module to accept it.
+  TX_WAIT_UPLINK,   // The module accepted the frame, waiting for mac_tx_ok/mac_rx/mac_err.
+  TX_WAIT_DOWNLINK, // mac_tx_ok received on a confirmed uplink, waiting for the downlink.
+  TX_BACKOFF,       // The module was busy or had no free channel, waiting to retry.
+  TX_WAIT_REPLY,    // A command from commandBegin() was sent, waiting for its reply.
+  TX_DONE           // The transmission finished, the outcome is in txResult().
+};
+
 class rn2xx3
 {
    private:
-       char buf[49];
+       char buf[RN2XX3_LINE_SIZE < 49 ? 49 : RN2XX3_LINE_SIZE];
 
        unsigned long _timeout;
 
-    int _timedRead(Stream *stream, unsigned long timeout );
-    
   public:
 
     /*
      * A simplified constructor taking only a Stream ({Software/Hardware}Serial) object.
      * The serial port should already be initialised when initialising this library.
+     * An optional clock replaces millis() and delay() for all timing.
      */
-    rn2xx3(Stream *serial);
+    rn2xx3(Stream *serial, rn2xx3_clock *clock = NULL);
 
     /*
      * Transmit the correct sequence to the rn2xx3 to trigger its autobauding feature.
      * After this operation the rn2xx3 should communicate at the same baud rate than us.
+     * Accepts an RN2483 or RN2903, and sets moduleType() to it. The sequence
+     * is repeated with a growing wait for the reply, see RN2XX3_AUTOBAUD_WAIT.
+     * Returns false if no module answered.
      */
     bool autobaud();
 
+    /*
+     * Move the host and the module from the UART rate they run at, e.g.
+     * 57600 or the 9600 of a SoftwareSerial, to another one, e.g. 115200,
+     * to cut the time spent sending commands and hex payloads. setHostBaud
+     * switches the host's UART; the module follows with its autobaud
+     * feature. If the module does not answer at the new rate, both go
+     * back to from and false is returned.
+     * A module reset puts the module back at 57600; autobaud() then
+     * brings it to the host's rate again.
+     */
+    bool setBaud( unsigned long from, unsigned long to, rn2xx3_baud_setter setHostBaud );
+
+    /*
+     * The rate setBaud() left the UART at, 57600 before.
+     */
+    unsigned long baud();
+
     /*
      * Get the hardware EUI of the radio, so that we can register it on The Things Network
      * and obtain the correct AppKey.
@@ -112,9 +208,22 @@ class rn2xx3
      *          Example "8D7FFEF938589D95AAD928C2E2E7E48F"
      * NwkSKey: Network Session Key as a HEX string.
      *          Example "AE17E567AECC8787F749A62F5541D522"
+     * Returns false if a key has the wrong length, the module refuses a
+     * setting or the join is not accepted. The keys are saved to the
+     * module's EEPROM.
+     *
+     * If the module already holds a session for addr, e.g. after a
+     * reboot, it is resumed as in initOTAA(), without the mac reset and
+     * mac save, and the frame counters carry on. The session keys can't
+     * be read back, so call factoryReset() first to change the keys of
+     * an address.
      */
     bool initABP( const char *addr, const char *AppSKey, const char *NwkSKey);
 
+    /*
+     * Join again with the ABP keys and session in the module's EEPROM,
+     * e.g. after a power cycle.
+     */
     bool rejoinABP();
     
     /*
@@ -131,10 +240,27 @@ class rn2xx3
      * will be configured. If the module is already configured with some keys
      * they will be used. Otherwise the join will fail and this function
      * will return false.
+     *
+     * A successful join is saved to the module's EEPROM. On the next call,
+     * e.g. after a reboot, that session is picked up again in a few
+     * commands if the module still has it for the same DevEUI, AppEUI and
+     * AppKey, instead of joining from scratch. A new AppKey is recognised
+     * by a 16-bit tag at RN2XX3_APPKEY_TAG_NVM; call factoryReset() first
+     * to force a new join in any case. After a power cycle the
+     * uplink counter is moved RN2XX3_UPCTR_MARGIN past the saved one and
+     * saved again, so call save() at least every RN2XX3_UPCTR_MARGIN
+     * uplinks.
      */
     bool initOTAA( const char *AppEUI, const char *AppKey );
     bool initOTAA( const char *AppEUI, const char *AppKey, const char *DevEUI );
 
+    /*
+     * Save the MAC settings and session to the module's EEPROM with
+     * "mac save", if anything was written or sent since the last save.
+     * Returns false if the module refused.
+     */
+    bool save();
+
     /*
      * Transmit the provided data. The data is hex-encoded by this library,
      * so plain text can be provided.
@@ -170,11 +296,64 @@ class rn2xx3
      *
      * String - the tx command to send
                 can only be one of "mac tx cnf 1 " or "mac tx uncnf 1 "
-     * String - an ascii text string if bool is true. A HEX string if bool is false.
-     * bool - should the data string be hex encoded or not
+     * String - the payload as a HEX string, sent as is.
+     * bool - should a downlink be expected (confirmed uplink) or not
      */
     TX_RETURN_TYPE txCommand( const char *, const char *, bool);
 
+    /*
+     * As above, but the payload is a byte array that is hex encoded
+     * on the fly while it is written to the module.
+     */
+    TX_RETURN_TYPE txCommand( const char *, const byte *, uint8_t, bool);
+
+    /*
+     * Start a transmission without waiting for it to complete.
+     * Takes the same parameters as txCommand(). The command and the payload
+     * must stay valid until txState() returns TX_DONE, as they are resent
+     * on retries.
+     * Returns false if another transmission is still in progress.
+     */
+    bool txBegin( const char *, const char *, bool);
+    bool txBegin( const char *, const byte *, uint8_t, bool);
+
+    /*
+     * Advance a transmission started with txBegin(), using only the bytes
+     * that are already waiting in the serial buffer. Never blocks.
+     * Call this often from loop(). Returns the new state.
+     */
+    TX_STATE poll();
+
+    /*
+     * The state of the current (or last) non-blocking transmission.
+     */
+    TX_STATE txState();
+
+    /*
+     * The outcome of the last transmission once txState() is TX_DONE.
+     * These are the same values txCommand() returns.
+     */
+    TX_RETURN_TYPE txResult();
+
+    /*
+     * Send a raw command without waiting for the reply, and advance it
+     * with poll() like a transmission. Once txState() is TX_DONE,
+     * txResult() is TX_SUCCESS and reply() holds the reply, or TX_FAIL if
+     * none came. A mac join is done at its final reply, not at the "ok".
+     * A "mac tx" goes the way of txBegin(), with its retries, timeouts
+     * and duty cycle booking, and ends with the same results; reply() then
+     * holds the last line, e.g. mac_tx_ok or the mac_rx. The command must
+     * stay valid until then.
+     * Returns false if a transmission or command is still in progress.
+     */
+    bool commandBegin( const char *command );
+
+    /*
+     * The reply to the command from commandBegin(), valid until the next
+     * command.
+     */
+    const char *reply();
+
     /*
      * Change the datarate at which the RN2xx3 transmits.
      * A value of between 0 and 5 can be specified,
@@ -184,6 +363,46 @@ class rn2xx3
      */
     void setDR(int dr);
 
+    /*
+     * The library remembers the MAC settings it has written and does not
+     * send them again while they are unchanged. Call this after changing
+     * settings behind its back: raw "mac set", "mac reset" or "sys reset"
+     * commands sent with sendRawCommand(), or a module reset. The next
+     * save() then writes the EEPROM. What the network can change, the data
+     * rate, power, channels and RX2, is forgotten after every uplink.
+     */
+    void invalidateCache();
+
+    /*
+     * Where to print the library's tracing, e.g. &Serial. NULL, the
+     * default, prints nothing. Which messages exist at all is decided at
+     * compile time by RN2XX3_LOG_LEVEL, see rn2xx3_log.h.
+     */
+    void setDebugOutput( Print *output );
+
+    /*
+     * Counters and latency histograms per command class and reply code,
+     * see rn2xx3_stats.h. They count from construction or resetStats().
+     */
+    const rn2xx3_stats &stats();
+    void resetStats();
+
+    /*
+     * Time-on-air in microseconds of an uplink with the given application
+     * payload length at the current data rate. codingRate is 1-4 for 4/5
+     * to 4/8; the RN2xx3 uses 4/5 unless told otherwise.
+     */
+    uint32_t airtime( uint8_t length, uint8_t codingRate = 1 );
+
+    /*
+     * The clock millis() at which the module will have a channel free of
+     * its duty cycle off-time again, so a transmission will not be refused
+     * with no_free_ch. Returns the current time if one is free now.
+     * This follows the frames sent and the channel settings made through
+     * this library since initOTAA().
+     */
+    unsigned long nextTxAllowedAt();
+
     /*
      * Put the RN2xx3 to sleep for a specified timeframe.
      * The RN2xx3 accepts values from 100 to 4294967296.
@@ -200,6 +419,14 @@ class rn2xx3
     char *sendRawCommand( const __FlashStringHelper *command );
     char *sendRawCommand( const __FlashStringHelper *command, const char *arg );
 
+    /*
+     * Minimum time in milliseconds between the reply to one raw command and
+     * sending the next one. The default of 0 sends the next command as soon
+     * as the previous reply line arrives. Older versions of this library
+     * always waited 100ms.
+     */
+    void setCommandGap( unsigned long msec );
+
     /*
      * Returns the module type either RN2903 or RN2483, or NA.
      */
@@ -207,16 +434,51 @@ class rn2xx3
 
     /*
      * Set the active channels to use.
-     * Returns true if setting the channels is possible.
-     * Returns false if you are trying to use the wrong channels on the wrong module type.
+     * Returns true if all the channels were set.
+     * Returns false if you are trying to use the wrong channels on the wrong module type,
+     * or if the module refused a setting.
      */
     bool setFrequencyPlan(FREQ_PLAN);
 
     /*
-     * Returns the last downlink message HEX string.
+     * Apply a frequency plan table stored in flash, see rn2xx3_freqplan.h.
+     */
+    bool setFrequencyPlan(const rn2xx3_plan *plan);
+
+    /*
+     * Returns the payload of the last downlink, decoded from HEX and NUL
+     * terminated, so a text message can be printed as is.
+     * Returns an empty string if nothing was received yet, or the downlink
+     * did not fit in the receive buffer.
      */
     char *getRx();
 
+    /*
+     * The decoded payload, its length and the FPort of the last downlink.
+     */
+    const byte *getRxBytes();
+    uint8_t getRxLength();
+    uint8_t getRxPort();
+
+    /*
+     * Decode downlinks into a buffer of your own instead of the internal one
+     * of RN2XX3_MAX_DOWNLINK bytes. Pass NULL to go back to the internal one.
+     * The payload is NUL terminated only if it is shorter than size.
+     * RN2XX3_MAX_DOWNLINK is still the longest downlink, because the reply
+     * line is sized for it, so a larger size is cut down to it. A longer
+     * downlink is dropped: getRxLength() is 0 and no handler is called.
+     */
+    void setRxBuffer( byte *buffer, uint8_t size );
+
+    /*
+     * Call handler for every downlink on the given port, or on any port
+     * without a handler of its own if port is 0. It is called from
+     * txCommand() or poll() as soon as the mac_rx line is read.
+     * A NULL handler removes the one for the port.
+     * Returns false if all RN2XX3_RX_HANDLERS slots are in use.
+     */
+    bool onReceive( uint8_t port, rn2xx3_rx_handler handler );
+
     /*
      * Get the RN2xx3's SNR of the last received packet. Helpful to debug link quality.
      */
@@ -238,23 +500,15 @@ class rn2xx3
     char *getRadioPower();
     bool setRadioPower( int pwr );
 
-    /*
-     * Encode an ASCII string to a HEX string as needed when passed
-     * to the RN2xx3 module.
-     */
-    // String base16encode(String);
-
-    /*
-     * Decode a HEX string to an ASCII string. Useful to decode a
-     * string received from the RN2xx3.
-     */
-    // String base16decode(String);
-
   private:
     Stream *_serial;
+    rn2xx3_clock *_clock;
 
     RN2xx3_t _moduleType = RN_NA;
 
+    unsigned long _baud = 57600;
+    bool _syncBaud( unsigned long wait );
+
     //Flags to switch code paths. Default is to use OTAA.
     bool _otaa = true;
 
@@ -275,20 +529,91 @@ class rn2xx3
     //the appskey/appkey to use for LoRa WAN
     char _appskey[33];
 
-    // The downlink messenge
-    char _rxMessage[33];
+    // The last downlink, decoded into _rxBuffer
+    byte _rxMessage[RN2XX3_MAX_DOWNLINK + 1];
+    byte *_rxBuffer;
+    uint8_t _rxSize;
+    uint8_t _rxLength = 0;
+    uint8_t _rxPort = 0;
+
+    struct {
+      uint8_t port;
+      rn2xx3_rx_handler handler;
+    } _rxHandlers[RN2XX3_RX_HANDLERS];
+
+    void _rxDecode( const char *args );
 
     /*
      * Auto configure for either RN2903 or RN2483 module
      */
     RN2xx3_t configureModuleType();
 
-    // void sendEncoded(String);
+    bool _resumeOTAA();
+    bool _appKeyTagMatches();
+    void _writeAppKeyTag();
+    bool _resumeABP();
+    bool _resumeSession(bool joined);
+
+    // The MAC settings known to be in effect
+    rn2xx3_shadow _shadow;
+
+    bool _macSetOnOff( rn2xx3_shadow::setting s, const __FlashStringHelper *command, bool on );
+    bool _macSetNumber( rn2xx3_shadow::setting s, const __FlashStringHelper *command, uint8_t value );
+    bool _macSetRx2( uint8_t dr, uint32_t freq );
+    bool _macSetChFreq( uint8_t ch, uint32_t freq );
+    bool _macSetChDcycle( uint8_t ch, uint16_t dcycle );
+    bool _macSetChDrrange( uint8_t ch, uint8_t minDr, uint8_t maxDr );
+    bool _macSetChStatus( uint8_t ch, bool on );
+
+    rn2xx3_stats _stats;
+
+    Print *_debug = NULL;
+#if RN2XX3_LOG_LEVEL > RN2XX3_LOG_NONE
+    void _log( const __FlashStringHelper *message );
+    void _log( const __FlashStringHelper *prefix, const char *text, const char *more = NULL );
+    void _log( const __FlashStringHelper *prefix, const __FlashStringHelper *text, const char *more = NULL );
+#endif
+
+    // Duty cycle bookkeeping
+    rn2xx3_dutycycle _dutyCycle;
+    uint8_t _dataRate = 5;
+
+    uint32_t _frameAirtime( uint8_t phyLength, uint8_t codingRate );
+
+    // Pacing of raw commands, see setCommandGap()
+    unsigned long _commandGap = 0;
+    unsigned long _lastReplyMillis = 0;
+
+    void _beginCommand();
+    char *_readReply();
+
+    // State of the non-blocking transmission driven by poll()
+    TX_STATE _txState = TX_IDLE;
+    TX_RETURN_TYPE _txResult = TX_FAIL;
+    const char *_txCommand = NULL;
+    const char *_txData = NULL;
+    const byte *_txPayload = NULL;
+    uint8_t _txLength = 0;
+    bool _txExpectDownlink = false;
+    uint8_t _txRetryCount = 0;
+    uint8_t _txBusyCount = 0;
+    uint8_t _txNoFreeChCount = 0;
+    unsigned long _txStartMillis = 0;
+    unsigned long _txTimeout = 0;
+
+    void _txStart( const char *command, bool expectDownlink );
+    void _txSend();
+    void _txWait( TX_STATE state, unsigned long timeout );
+    void _txFinish( TX_RETURN_TYPE result );
+    void _txHandleLine( const char *line );
     
+    // Assembles reply lines into buf, for both the blocking and the poll() paths
+    rn2xx3_line_reader _reader;
+
     /**
      * non-String replacement for Stream.readStringUntil()
      */
-    const char *readCharStringUntil( Stream *stream, unsigned long timeout, char terminator, char *outbuf, size_t bufsz );
+    const char *_readLine( unsigned long timeout );
 };
 
 #endif
@@ -0,0 +1,182 @@
+/*
+ * LoRa time-on-air and the duty cycle bookkeeping of the RN2xx3.
+ */
+
+#include "rn2xx3_airtime.h"
+
+uint32_t rn2xx3_airtime_us( uint8_t sf, uint16_t bandwidth, uint8_t phyLength, uint8_t codingRate )
+{
+  // The symbol time 2^SF / BW is a whole number of microseconds for
+  // 125, 250 and 500kHz
+  uint32_t tsym = ( (uint32_t)1 << sf ) * 1000 / bandwidth;
+
+  // Low data rate optimisation is used for SF11 and SF12 at 125kHz
+  int16_t de = ( bandwidth == 125 && sf >= 11 ) ? 1 : 0;
+  int16_t num = 8 * (int16_t)phyLength - 4 * sf + 28 + 16;
+  int16_t den = 4 * ( sf - 2 * de );
+  uint16_t symbols = 8;
+  if ( num > 0 ) {
+      symbols += ( ( num + den - 1 ) / den ) * ( codingRate + 4 );
+  }
+
+  // 8 programmed preamble symbols plus 4.25 sync symbols
+  return tsym * 49 / 4 + tsym * symbols;
+}
+
+bool rn2xx3_dr_modulation( uint16_t module, uint8_t dr, uint8_t &sf, uint16_t &bandwidth )
+{
+  if ( module == 2903 ) {
+      if ( dr <= 3 ) {
+          sf = 10 - dr;
+          bandwidth = 125;
+          return true;
+      }
+      if ( dr == 4 ) {
+          sf = 8;
+          bandwidth = 500;
+          return true;
+      }
+      // DR8-13 are downlink only
+      if ( dr >= 8 && dr <= 13 ) {
+          sf = 20 - dr;
+          bandwidth = 500;
+          return true;
+      }
+      return false;
+  }
+
+  if ( dr <= 5 ) {
+      sf = 12 - dr;
+      bandwidth = 125;
+      return true;
+  }
+  if ( dr == 6 ) {
+      sf = 7;
+      bandwidth = 250;
+      return true;
+  }
+  return false;
+}
+
+uint8_t rn2xx3_max_payload( uint16_t module, uint8_t dr )
+{
+  if ( module == 2903 ) {
+      static const uint8_t maxUs[] PROGMEM = { 11, 53, 125, 242, 242 };
+      return dr <= 4 ? pgm_read_byte( &maxUs[dr] ) : 0;
+  }
+  static const uint8_t maxEu[] PROGMEM = { 51, 51, 51, 115, 222, 222, 222 };
+  return dr <= 6 ? pgm_read_byte( &maxEu[dr] ) : 0;
+}
+
+void rn2xx3_dutycycle::reset( uint16_t module )
+{
+  _limited = module == 2483;
+  _enabled = 0;
+  _blocked = 0;
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+      // 868.1, 868.3 and 868.5 are on at 0.33% each
+      if ( ch < 3 ) {
+          _enabled |= (uint16_t)1 << ch;
+      }
+      _dcycle[ch] = 302;
+      _drrange[ch] = 0x05;
+      _readyAt[ch] = 0;
+  }
+}
+
+void rn2xx3_dutycycle::setDcycle( uint8_t ch, uint16_t dcycle )
+{
+  if ( ch < CHANNELS ) {
+      _dcycle[ch] = dcycle;
+  }
+}
+
+void rn2xx3_dutycycle::setStatus( uint8_t ch, bool on )
+{
+  if ( ch < CHANNELS ) {
+      if ( on ) {
+          _enabled |= (uint16_t)1 << ch;
+      } else {
+          _enabled &= ~( (uint16_t)1 << ch );
+      }
+  }
+}
+
+void rn2xx3_dutycycle::setDrrange( uint8_t ch, uint8_t minDr, uint8_t maxDr )
+{
+  if ( ch < CHANNELS ) {
+      _drrange[ch] = ( minDr << 4 ) | ( maxDr & 0x0F );
+  }
+}
+
+bool rn2xx3_dutycycle::usable( uint8_t ch, uint8_t dr ) const
+{
+  return ( _enabled & ( (uint16_t)1 << ch ) )
+      && dr >= ( _drrange[ch] >> 4 ) && dr <= ( _drrange[ch] & 0x0F );
+}
+
+/**
+ * Release the channels whose off-time is over.
+ */
+void rn2xx3_dutycycle::expire( unsigned long now )
+{
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+      if ( ( _blocked & ( (uint16_t)1 << ch ) ) && (long)( _readyAt[ch] - now ) <= 0 ) {
+          _blocked &= ~( (uint16_t)1 << ch );
+      }
+  }
+}
+
+void rn2xx3_dutycycle::record( unsigned long now, uint8_t dr, uint32_t airtime )
+{
+  if ( !_limited ) {
+      return;
+  }
+  expire( now );
+
+  int8_t best = -1;
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+      if ( !usable( ch, dr ) ) {
+          continue;
+      }
+      if ( !( _blocked & ( (uint16_t)1 << ch ) ) ) {
+          best = ch;
+          break;
+      }
+      if ( best < 0 || (long)( _readyAt[ch] - _readyAt[best] ) < 0 ) {
+          best = ch;
+      }
+  }
+  if ( best < 0 ) {
+      return;
+  }
+
+  // Round the airtime up to whole milliseconds
+  uint32_t ms = ( airtime + 999 ) / 1000;
+  _readyAt[best] = now + ms * ( (uint32_t)_dcycle[best] + 1 );
+  _blocked |= (uint16_t)1 << best;
+}
+
+unsigned long rn2xx3_dutycycle::nextFree( unsigned long now, uint8_t dr )
+{
+  if ( !_limited ) {
+      return now;
+  }
+  expire( now );
+
+  bool found = false;
+  unsigned long next = now;
+  for ( uint8_t ch = 0; ch < CHANNELS; ch++ ) {
+      if ( !usable( ch, dr ) ) {
+          continue;
+      }
+      if ( !( _blocked & ( (uint16_t)1 << ch ) ) ) {
+          return now;
+      }
+      if ( !found || (long)( _readyAt[ch] - next ) < 0 ) {
+          next = _readyAt[ch];
+          found = true;
+      }
+  }
+  return next;
+}
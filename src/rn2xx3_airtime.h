@@ -0,0 +1,90 @@
+/*
+ * LoRa time-on-air and the duty cycle bookkeeping of the RN2xx3.
+ *
+ * All arithmetic is integer only, so it is cheap on an AVR.
+ */
+
+#ifndef rn2xx3_airtime_h
+#define rn2xx3_airtime_h
+
+#include "Arduino.h"
+
+// MHDR, FHDR without options, FPort and MIC of a LoRaWAN data frame
+#define RN2XX3_LORAWAN_OVERHEAD 13
+// A LoRaWAN join request
+#define RN2XX3_JOIN_REQUEST_LENGTH 23
+
+/*
+ * Time-on-air in microseconds of a LoRa frame with an explicit header and
+ * CRC, following Semtech AN1200.13.
+ *
+ * sf: spreading factor 7-12
+ * bandwidth: 125, 250 or 500 (kHz)
+ * phyLength: PHY payload length in bytes
+ * codingRate: 1-4 for 4/5 to 4/8
+ */
+uint32_t rn2xx3_airtime_us( uint8_t sf, uint16_t bandwidth, uint8_t phyLength, uint8_t codingRate = 1 );
+
+/*
+ * The modulation of a LoRaWAN data rate on the given module (2483 = EU868,
+ * 2903 = US915). Returns false for data rates the module does not have.
+ */
+bool rn2xx3_dr_modulation( uint16_t module, uint8_t dr, uint8_t &sf, uint16_t &bandwidth );
+
+/*
+ * The largest application payload the module accepts at a data rate.
+ */
+uint8_t rn2xx3_max_payload( uint16_t module, uint8_t dr );
+
+/*
+ * Tracks when each channel comes out of its duty cycle off-time, the way
+ * the RN2483 does: after a frame of airtime T on a channel with <dutyCycle>
+ * d, that channel is blocked until T * (d + 1) after the start of the frame.
+ *
+ * The module does not report which channel it picked, so every frame is
+ * booked on the enabled channel that became free first. With equal duty
+ * cycles on all channels, as in every built-in plan, this gives the same
+ * answer as the module.
+ */
+class rn2xx3_dutycycle
+{
+  public:
+    rn2xx3_dutycycle() { reset( 0 ); }
+
+    /*
+     * The channel defaults after "mac reset". The RN2903 has no duty cycle
+     * limits, so for any module other than 2483 nothing is ever blocked.
+     */
+    void reset( uint16_t module );
+
+    void setDcycle( uint8_t ch, uint16_t dcycle );
+    void setStatus( uint8_t ch, bool on );
+    void setDrrange( uint8_t ch, uint8_t minDr, uint8_t maxDr );
+
+    /*
+     * Book a frame of airtime us that started at millis now, sent at dr.
+     */
+    void record( unsigned long now, uint8_t dr, uint32_t airtime );
+
+    /*
+     * The millis at which some channel that allows dr is free, or now if
+     * one already is.
+     */
+    unsigned long nextFree( unsigned long now, uint8_t dr );
+
+  private:
+    static const uint8_t CHANNELS = 16;
+
+    bool _limited;
+    uint16_t _enabled;
+    // Channels still in their off-time, so _readyAt is meaningful
+    uint16_t _blocked;
+    uint16_t _dcycle[CHANNELS];
+    uint8_t _drrange[CHANNELS];
+    unsigned long _readyAt[CHANNELS];
+
+    bool usable( uint8_t ch, uint8_t dr ) const;
+    void expire( unsigned long now );
+};
+
+#endif
@@ -0,0 +1,29 @@
+/*
+ * Time source for the rn2xx3 library.
+ *
+ * The library never calls millis() or delay() directly, but goes through
+ * an instance of this class. The default forwards to the Arduino core.
+ * A subclass can replace the time source, for example with a simulated
+ * clock that lets hours of protocol timeouts pass in microseconds.
+ */
+
+#ifndef rn2xx3_clock_h
+#define rn2xx3_clock_h
+
+#include "Arduino.h"
+
+class rn2xx3_clock
+{
+  public:
+    virtual unsigned long millis() { return ::millis(); }
+    virtual unsigned long micros() { return ::micros(); }
+    virtual void delay(unsigned long ms) { ::delay(ms); }
+
+    /*
+     * Called every time the library finds no byte waiting while it is
+     * waiting for the module. A simulated clock advances time here.
+     */
+    virtual void idle() {}
+};
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Frequency plans as compact tables in flash.
+ */
+
+#include "rn2xx3.h"
+#include "rn2xx3_freqplan.h"
+
+/*
+ * Single channel gateways. RX2 at SF9 on 869.525MHz is for "non-strict"
+ * one channel gateways; use { RN2483, 0, 5, 868100000UL, ... } for
+ * "strict" ones.
+ */
+static const rn2xx3_plan_channel single_channel_eu[] PROGMEM = {
+  { 0, RN2XX3_CH_DCYCLE, 0, 99, 0 },     //1% duty cycle for this channel
+  { 1, RN2XX3_CH_DCYCLE, 0, 65535, 0 },  //almost never use this channel
+  { 2, RN2XX3_CH_DCYCLE, 0, 65535, 0 },  //almost never use this channel
+};
+
+const rn2xx3_plan rn2xx3_plan_single_channel_eu PROGMEM = {
+  RN2483, 0, 3, 869525000UL, 3, single_channel_eu
+};
+
+/*
+ * The <dutyCycle> value that needs to be configured can be
+ * obtained from the actual duty cycle X (in percentage)
+ * using the following formula: <dutyCycle> = (100/X) – 1
+ *
+ *  10% -> 9
+ *  1% -> 99
+ *  0.33% -> 299
+ *  8 channels, total of 1% duty cycle:
+ *  0.125% per channel -> 799
+ *
+ * Most of the TTN_EU frequency plan was copied from:
+ * https://github.com/TheThingsNetwork/arduino-device-lib
+ */
+#define TTN_EU_EXTRA ( RN2XX3_CH_FREQ | RN2XX3_CH_DRRANGE | RN2XX3_CH_DCYCLE | RN2XX3_CH_STATUS_ON )
+
+static const rn2xx3_plan_channel ttn_eu[] PROGMEM = {
+  { 0, RN2XX3_CH_DCYCLE, 0, 799, 0 },
+  { 1, RN2XX3_CH_DRRANGE | RN2XX3_CH_DCYCLE, RN2XX3_DRRANGE(0, 6), 799, 0 },
+  { 2, RN2XX3_CH_DCYCLE, 0, 799, 0 },
+  { 3, TTN_EU_EXTRA, RN2XX3_DRRANGE(0, 5), 799, 867100000UL },
+  { 4, TTN_EU_EXTRA, RN2XX3_DRRANGE(0, 5), 799, 867300000UL },
+  { 5, TTN_EU_EXTRA, RN2XX3_DRRANGE(0, 5), 799, 867500000UL },
+  { 6, TTN_EU_EXTRA, RN2XX3_DRRANGE(0, 5), 799, 867700000UL },
+  { 7, TTN_EU_EXTRA, RN2XX3_DRRANGE(0, 5), 799, 867900000UL },
+};
+
+const rn2xx3_plan rn2xx3_plan_ttn_eu PROGMEM = {
+  RN2483, 0, 3, 869525000UL, 8, ttn_eu
+};
+
+/*
+ * TTN uses the second sub-band, channels 8 to 15.
+ * Most of the TTN_US frequency plan was copied from:
+ * https://github.com/TheThingsNetwork/arduino-device-lib
+ */
+const rn2xx3_plan rn2xx3_plan_ttn_us PROGMEM = {
+  RN2903, 2, 0, 0, 0, NULL
+};
+
+/*
+ * fix duty cycle - 1% = 0.33% per channel
+ */
+static const rn2xx3_plan_channel default_eu[] PROGMEM = {
+  { 0, RN2XX3_CH_DCYCLE, 0, 799, 0 },
+  { 1, RN2XX3_CH_DCYCLE, 0, 799, 0 },
+  { 2, RN2XX3_CH_DCYCLE, 0, 799, 0 },
+  { 3, RN2XX3_CH_STATUS_ON, 0, 0, 0 },
+  { 4, RN2XX3_CH_STATUS_ON, 0, 0, 0 },
+  { 5, RN2XX3_CH_STATUS_ON, 0, 0, 0 },
+  { 6, RN2XX3_CH_STATUS_ON, 0, 0, 0 },
+  { 7, RN2XX3_CH_STATUS_ON, 0, 0, 0 },
+};
+
+const rn2xx3_plan rn2xx3_plan_default_eu PROGMEM = {
+  RN2483, 0, 0, 0, 8, default_eu
+};
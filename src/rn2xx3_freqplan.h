@@ -0,0 +1,61 @@
+/*
+ * Frequency plans as compact tables in flash.
+ *
+ * A plan lists only the settings that differ from the module defaults.
+ * rn2xx3::setFrequencyPlan() turns a plan into "mac set" commands, and
+ * skips the ones whose value is already in effect.
+ *
+ * A custom plan is declared the same way as the built-in ones:
+ *
+ *   static const rn2xx3_plan_channel myChannels[] PROGMEM = {
+ *     { 3, RN2XX3_CH_FREQ | RN2XX3_CH_STATUS_ON, 0, 0, 867100000UL },
+ *   };
+ *   static const rn2xx3_plan myPlan PROGMEM = {
+ *     RN2483, 0, 3, 869525000UL, 1, myChannels
+ *   };
+ *
+ *   myLora.setFrequencyPlan(&myPlan);
+ */
+
+#ifndef rn2xx3_freqplan_h
+#define rn2xx3_freqplan_h
+
+#include "Arduino.h"
+
+// Which fields of an rn2xx3_plan_channel to apply
+#define RN2XX3_CH_FREQ       0x01
+#define RN2XX3_CH_DRRANGE    0x02
+#define RN2XX3_CH_DCYCLE     0x04
+#define RN2XX3_CH_STATUS_ON  0x08
+#define RN2XX3_CH_STATUS_OFF 0x10
+
+// Pack a data rate range for rn2xx3_plan_channel::drrange
+#define RN2XX3_DRRANGE(min, max) ( ( (min) << 4 ) | (max) )
+
+struct rn2xx3_plan_channel {
+  uint8_t channel;
+  uint8_t flags;      // RN2XX3_CH_* bits
+  uint8_t drrange;    // RN2XX3_DRRANGE(min, max)
+  uint16_t dcycle;    // <dutyCycle> = (100/X) - 1 for a duty cycle of X percent
+  uint32_t freq;      // Hz
+};
+
+struct rn2xx3_plan {
+  uint16_t module;    // RN2483 or RN2903, the plan is refused on the other
+  uint8_t subBand;    // RN2903: enable only the eight 125kHz channels of
+                      // this sub-band (1-8), 0 leaves the channel status alone
+  uint8_t rx2Dr;
+  uint32_t rx2Freq;   // 0 leaves the second receive window alone
+  uint8_t channelCount;
+  const rn2xx3_plan_channel *channels;
+};
+
+/*
+ * The built-in plans, as selected by the FREQ_PLAN values.
+ */
+extern const rn2xx3_plan rn2xx3_plan_single_channel_eu PROGMEM;
+extern const rn2xx3_plan rn2xx3_plan_ttn_eu PROGMEM;
+extern const rn2xx3_plan rn2xx3_plan_ttn_us PROGMEM;
+extern const rn2xx3_plan rn2xx3_plan_default_eu PROGMEM;
+
+#endif
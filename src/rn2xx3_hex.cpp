@@ -0,0 +1,67 @@
+/*
+ * Hex encoding and decoding of payloads for the RN2xx3.
+ */
+
+#include "rn2xx3_hex.h"
+
+static const char hexDigits[16] PROGMEM = {
+  '0', '1', '2', '3', '4', '5', '6', '7',
+  '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
+// The value of every character from '0' to 'f', 0xFF if not a hex digit
+static const uint8_t hexValues[] PROGMEM = {
+  0, 1, 2, 3, 4, 5, 6, 7, 8, 9,                       // '0' - '9'
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,           // ':' - '@'
+  10, 11, 12, 13, 14, 15,                             // 'A' - 'F'
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,     // 'G' - 'N'
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,     // 'O' - 'V'
+  0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,     // 'W' - '^'
+  0xFF, 0xFF,                                         // '_' - '`'
+  10, 11, 12, 13, 14, 15                              // 'a' - 'f'
+};
+
+static uint8_t hexValue( char c )
+{
+  uint8_t i = (uint8_t)( c - '0' );
+  if ( i >= sizeof( hexValues ) ) {
+      return 0xFF;
+  }
+  return pgm_read_byte( &hexValues[i] );
+}
+
+size_t rn2xx3_write_hex( Print &out, const uint8_t *data, size_t length )
+{
+  char chunk[RN2XX3_HEX_CHUNK];
+  size_t written = 0;
+
+  while ( length > 0 ) {
+      uint8_t n = 0;
+      while ( length > 0 && n < sizeof( chunk ) ) {
+          uint8_t b = *data++;
+          chunk[n++] = pgm_read_byte( &hexDigits[b >> 4] );
+          chunk[n++] = pgm_read_byte( &hexDigits[b & 0x0F] );
+          length--;
+      }
+      written += out.write( (const uint8_t *)chunk, n );
+  }
+
+  return written;
+}
+
+int16_t rn2xx3_read_hex( const char *hex, uint8_t *out, uint8_t size )
+{
+  uint8_t length = 0;
+
+  while ( hex[0] != '\0' ) {
+      uint8_t high = hexValue( hex[0] );
+      uint8_t low = hexValue( hex[1] );
+      if ( ( high | low ) == 0xFF || length == size ) {
+          return -1;
+      }
+      out[length++] = ( high << 4 ) | low;
+      hex += 2;
+  }
+
+  return length;
+}
@@ -0,0 +1,31 @@
+/*
+ * Hex encoding and decoding of payloads for the RN2xx3.
+ *
+ * The module takes uplink payloads as hex strings. The encoder writes
+ * the hex digits straight to the serial port in small chunks, so no
+ * buffer the size of the payload is ever needed. Downlinks arrive as hex
+ * too, and are decoded straight from the reply line.
+ */
+
+#ifndef rn2xx3_hex_h
+#define rn2xx3_hex_h
+
+#include "Arduino.h"
+
+// Hex digits produced per write() to the port
+#define RN2XX3_HEX_CHUNK 32
+
+/*
+ * Write data as upper case hex digits to out.
+ * Returns the number of characters written.
+ */
+size_t rn2xx3_write_hex( Print &out, const uint8_t *data, size_t length );
+
+/*
+ * Decode the hex string up to the terminating NUL into out.
+ * Returns the number of bytes decoded, or -1 if the string has an odd
+ * length, contains anything but hex digits or does not fit in size bytes.
+ */
+int16_t rn2xx3_read_hex( const char *hex, uint8_t *out, uint8_t size );
+
+#endif
@@ -0,0 +1,56 @@
+/*
+ * Incremental line assembler for replies from the RN2xx3.
+ */
+
+#include "rn2xx3_line_reader.h"
+
+rn2xx3_line_reader::rn2xx3_line_reader(char *buf, uint16_t size)
+  : _buf(buf), _size(size)
+{
+  reset();
+}
+
+void rn2xx3_line_reader::reset()
+{
+  _length = 0;
+  _complete = false;
+  _overflow = false;
+  _buf[0] = '\0';
+}
+
+bool rn2xx3_line_reader::feed(char c)
+{
+  if ( _complete ) {
+      reset();
+  }
+
+  if ( c == '\n' ) {
+      _complete = true;
+      return true;
+  }
+
+  if ( c < 32 || c > 126 ) {
+      return false;
+  }
+  if ( _length < _size - 1 ) {
+      _buf[_length++] = c;
+      _buf[_length] = '\0';
+  } else {
+      _overflow = true;
+  }
+  return false;
+}
+
+bool rn2xx3_line_reader::poll(Stream *stream)
+{
+  while ( stream->available() > 0 ) {
+      int c = stream->read();
+      if ( c < 0 ) {
+          break;
+      }
+      if ( feed( c ) ) {
+          return true;
+      }
+  }
+  return false;
+}
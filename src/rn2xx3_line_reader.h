@@ -0,0 +1,59 @@
+/*
+ * Incremental line assembler for replies from the RN2xx3.
+ *
+ * Consumes whatever bytes are waiting in a Stream, without ever waiting
+ * for more, and reports when a complete line has been assembled. The
+ * line is kept NUL terminated at all times, so a partial line can be
+ * inspected after a timeout. Carriage returns and other control
+ * characters are dropped, and characters that do not fit are discarded,
+ * which overflowed() reports.
+ */
+
+#ifndef rn2xx3_line_reader_h
+#define rn2xx3_line_reader_h
+
+#include "Arduino.h"
+
+class rn2xx3_line_reader
+{
+  public:
+    /*
+     * buf: storage for the line, including the terminating NUL.
+     */
+    rn2xx3_line_reader(char *buf, uint16_t size);
+
+    /*
+     * Read bytes from the stream up to and including the next '\n'.
+     * Returns true if that completed a line, false if the stream ran dry
+     * first. In that case the bytes read so far are kept for the next call.
+     */
+    bool poll(Stream *stream);
+
+    /*
+     * Add a single byte. Returns true if it completed a line.
+     */
+    bool feed(char c);
+
+    /*
+     * Discard the line assembled so far.
+     */
+    void reset();
+
+    const char *line() const { return _buf; }
+    uint16_t length() const { return _length; }
+
+    /*
+     * Whether characters of this line were discarded because it did not
+     * fit.
+     */
+    bool overflowed() const { return _overflow; }
+
+  private:
+    char *_buf;
+    uint16_t _size;
+    uint16_t _length;
+    bool _complete;
+    bool _overflow;
+};
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * Compile-time log levels for the tracing of the rn2xx3 library.
+ *
+ * Define RN2XX3_LOG_LEVEL when building the library (e.g. with a -D build
+ * flag) to choose which messages are compiled in at all. The ones that are
+ * go to the Print given to rn2xx3::setDebugOutput(), and nowhere if none
+ * was given.
+ *
+ * The Arduino IDE has no per-sketch build flags. There the level can be set
+ * for all sketches in a platform.local.txt next to the board's platform.txt:
+ *   compiler.cpp.extra_flags=-DRN2XX3_LOG_LEVEL=0
+ * arduino-cli takes the same setting with
+ *   --build-property compiler.cpp.extra_flags=-DRN2XX3_LOG_LEVEL=0
+ * and PlatformIO as build_flags in platformio.ini.
+ */
+
+#ifndef rn2xx3_log_h
+#define rn2xx3_log_h
+
+#define RN2XX3_LOG_NONE  0
+#define RN2XX3_LOG_ERROR 1  // The module could not be identified
+#define RN2XX3_LOG_INFO  2  // Module type, version and join results
+#define RN2XX3_LOG_DEBUG 3  // Every command and reply
+
+#ifndef RN2XX3_LOG_LEVEL
+#define RN2XX3_LOG_LEVEL RN2XX3_LOG_INFO
+#endif
+
+// For use inside rn2xx3 only. The arguments are not evaluated at all when
+// the level is compiled out.
+#if RN2XX3_LOG_LEVEL >= RN2XX3_LOG_ERROR
+#define RN2XX3_ERROR(...) _log( __VA_ARGS__ )
+#else
+#define RN2XX3_ERROR(...) do {} while (0)
+#endif
+
+#if RN2XX3_LOG_LEVEL >= RN2XX3_LOG_INFO
+#define RN2XX3_INFO(...) _log( __VA_ARGS__ )
+#else
+#define RN2XX3_INFO(...) do {} while (0)
+#endif
+
+#if RN2XX3_LOG_LEVEL >= RN2XX3_LOG_DEBUG
+#define RN2XX3_DEBUG(...) _log( __VA_ARGS__ )
+#else
+#define RN2XX3_DEBUG(...) do {} while (0)
+#endif
+
+#endif
@@ -0,0 +1,97 @@
+/*
+ * Classification of the reply lines sent by the RN2xx3.
+ *
+ * A switch on the first character picks the candidates, so at most four
+ * keywords are compared per line. The keywords themselves live in flash.
+ */
+
+#include "rn2xx3_response.h"
+
+/**
+ * Does line start with the whole word keyword (in flash)?
+ */
+static bool matches( const char *line, const char *keyword, uint8_t *args )
+{
+  size_t len = strlen_P( keyword );
+  if ( strncmp_P( line, keyword, len ) != 0 ) {
+      return false;
+  }
+  if ( line[len] == '\0' ) {
+      if ( args != NULL ) {
+          *args = len;
+      }
+      return true;
+  }
+  if ( line[len] == ' ' ) {
+      if ( args != NULL ) {
+          *args = len + 1;
+      }
+      return true;
+  }
+  return false;
+}
+
+RN_RESPONSE rn2xx3_classify( const char *line, uint8_t *args )
+{
+  if ( args != NULL ) {
+      *args = 0;
+  }
+
+  switch ( line[0] ) {
+    case 'o':
+      if ( matches( line, PSTR("ok"), args ) ) return RN_OK;
+      break;
+
+    case 'a':
+      if ( matches( line, PSTR("accepted"), args ) ) return RN_ACCEPTED;
+      break;
+
+    case 'b':
+      if ( matches( line, PSTR("busy"), args ) ) return RN_BUSY;
+      break;
+
+    case 'd':
+      if ( matches( line, PSTR("denied"), args ) ) return RN_DENIED;
+      break;
+
+    case 'f':
+      if ( matches( line, PSTR("frame_counter_err_rejoin_needed"), args ) ) return RN_FRAME_COUNTER_ERR_REJOIN_NEEDED;
+      break;
+
+    case 'i':
+      if ( matches( line, PSTR("invalid_param"), args ) ) return RN_INVALID_PARAM;
+      if ( matches( line, PSTR("invalid_data_len"), args ) ) return RN_INVALID_DATA_LEN;
+      break;
+
+    case 'k':
+      if ( matches( line, PSTR("keys_not_init"), args ) ) return RN_KEYS_NOT_INIT;
+      break;
+
+    case 'm':
+      if ( matches( line, PSTR("mac_tx_ok"), args ) ) return RN_MAC_TX_OK;
+      if ( matches( line, PSTR("mac_rx"), args ) ) return RN_MAC_RX;
+      if ( matches( line, PSTR("mac_err"), args ) ) return RN_MAC_ERR;
+      if ( matches( line, PSTR("mac_paused"), args ) ) return RN_MAC_PAUSED;
+      break;
+
+    case 'n':
+      if ( matches( line, PSTR("not_joined"), args ) ) return RN_NOT_JOINED;
+      if ( matches( line, PSTR("no_free_ch"), args ) ) return RN_NO_FREE_CH;
+      break;
+
+    case 'r':
+      if ( matches( line, PSTR("radio_tx_ok"), args ) ) return RN_RADIO_TX_OK;
+      if ( matches( line, PSTR("radio_rx"), args ) ) return RN_RADIO_RX;
+      if ( matches( line, PSTR("radio_err"), args ) ) return RN_RADIO_ERR;
+      break;
+
+    case 's':
+      if ( matches( line, PSTR("silent"), args ) ) return RN_SILENT;
+      break;
+
+    default:
+      break;
+  }
+
+  return RN_UNKNOWN;
+}
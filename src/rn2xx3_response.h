@@ -0,0 +1,44 @@
+/*
+ * Classification of the reply lines sent by the RN2xx3.
+ */
+
+#ifndef rn2xx3_response_h
+#define rn2xx3_response_h
+
+#include "Arduino.h"
+
+enum RN_RESPONSE {
+  RN_UNKNOWN = 0,   // Empty, or not one of the replies below.
+  RN_OK,
+  RN_ACCEPTED,
+  RN_DENIED,
+  RN_BUSY,
+  RN_INVALID_PARAM,
+  RN_INVALID_DATA_LEN,
+  RN_KEYS_NOT_INIT,
+  RN_NOT_JOINED,
+  RN_NO_FREE_CH,
+  RN_SILENT,
+  RN_FRAME_COUNTER_ERR_REJOIN_NEEDED,
+  RN_MAC_TX_OK,
+  RN_MAC_RX,        // "mac_rx <port> <data>"
+  RN_MAC_ERR,
+  RN_MAC_PAUSED,
+  RN_RADIO_TX_OK,
+  RN_RADIO_RX,      // "radio_rx <data>"
+  RN_RADIO_ERR,
+  RN_TIMEOUT,       // No reply at all. Never returned by rn2xx3_classify().
+  RN_RESPONSE_COUNT
+};
+
+/*
+ * Map a reply line to its RN_RESPONSE code. A keyword only matches as a
+ * whole word, so "ok" does not match "okay".
+ *
+ * If args is not NULL it is set to the offset of the first argument after
+ * the keyword (e.g. the port in "mac_rx 1 AB"), or to the length of the
+ * line if there is none.
+ */
+RN_RESPONSE rn2xx3_classify( const char *line, uint8_t *args = NULL );
+
+#endif
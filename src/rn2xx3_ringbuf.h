@@ -0,0 +1,100 @@
+/*
+ * A Stream whose receive side is a lock-free single-producer /
+ * single-consumer ring buffer.
+ *
+ * The producer is whatever moves bytes off the UART: a serialEvent()
+ * handler or the receive interrupt itself. The consumer is the rn2xx3
+ * library reading replies. Writes are passed straight through to the port.
+ * This lets the CPU sleep between received bytes instead of polling the
+ * UART; see rn2xx3_clock::idle().
+ *
+ *   rn2xx3_ring_stream<64> loraPort(Serial1);
+ *   rn2xx3 myLora(&loraPort);
+ *
+ *   void serialEvent1() {
+ *     while (Serial1.available()) loraPort.push(Serial1.read());
+ *   }
+ *
+ * SIZE must be a power of two no larger than 256. One slot is kept free
+ * to tell a full buffer from an empty one.
+ */
+
+#ifndef rn2xx3_ringbuf_h
+#define rn2xx3_ringbuf_h
+
+#include "Arduino.h"
+
+template <uint16_t SIZE>
+class rn2xx3_ring_stream : public Stream
+{
+  public:
+    rn2xx3_ring_stream(Print &port) : _port(port), _head(0), _tail(0), _overflows(0) {}
+
+    /*
+     * Producer side, safe to call from an interrupt handler.
+     * Returns false and counts an overflow if the buffer is full.
+     */
+    bool push(uint8_t c)
+    {
+      uint8_t head = _head;
+      uint8_t next = ( head + 1 ) & MASK;
+      if ( next == _tail ) {
+          _overflows++;
+          return false;
+      }
+      _buf[head] = c;
+      _head = next;
+      return true;
+    }
+
+    /*
+     * Number of bytes dropped because the consumer fell behind.
+     */
+    uint16_t overflows() const { return _overflows; }
+
+    int available()
+    {
+      return ( _head - _tail ) & MASK;
+    }
+
+    int peek()
+    {
+      uint8_t tail = _tail;
+      if ( tail == _head ) {
+          return -1;
+      }
+      return _buf[tail];
+    }
+
+    int read()
+    {
+      uint8_t tail = _tail;
+      if ( tail == _head ) {
+          return -1;
+      }
+      uint8_t c = _buf[tail];
+      _tail = ( tail + 1 ) & MASK;
+      return c;
+    }
+
+    size_t write(uint8_t c) { return _port.write(c); }
+    size_t write(const uint8_t *buffer, size_t size) { return _port.write(buffer, size); }
+    void flush() { _port.flush(); }
+    using Print::write;
+
+  private:
+    static const uint8_t MASK = SIZE - 1;
+
+    // Only SIZE values that fit the 8 bit indices and mask cleanly
+    typedef char size_must_be_a_power_of_two_up_to_256[( SIZE >= 2 && SIZE <= 256 && ( SIZE & ( SIZE - 1 ) ) == 0 ) ? 1 : -1];
+
+    Print &_port;
+    volatile uint8_t _buf[SIZE];
+    // Written only by the producer
+    volatile uint8_t _head;
+    // Written only by the consumer
+    volatile uint8_t _tail;
+    volatile uint16_t _overflows;
+};
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Shadow copy of the MAC settings the library has written to the RN2xx3.
+ *
+ * A setting is only known once a write of it was acknowledged with "ok".
+ * Anything that may change settings behind the library's back ("mac reset",
+ * "sys reset", raw "mac set" commands) must call invalidate(). An uplink
+ * may bring MAC commands from the network in its receive windows, which
+ * calls for invalidateNetwork().
+ *
+ * Frequency, duty cycle and data rate range are kept for the 16 channels
+ * of the RN2483; the on/off status for all 72 channels of the RN2903.
+ *
+ * Independently of what is known, it tracks whether anything was written
+ * since the last "mac save", so the EEPROM is only written when needed.
+ */
+
+#ifndef rn2xx3_shadow_h
+#define rn2xx3_shadow_h
+
+#include "Arduino.h"
+
+#define RN2XX3_SHADOW_CHANNELS 16
+#define RN2XX3_SHADOW_STATUS_CHANNELS 72
+
+class rn2xx3_shadow
+{
+  public:
+    enum setting {
+      AR = 0x01,
+      ADR = 0x02,
+      DR = 0x04,
+      PWRIDX = 0x08,
+      RX2 = 0x10
+    };
+
+    rn2xx3_shadow() : _dirty(false) { invalidate(); }
+
+    void invalidate()
+    {
+      _valid = 0;
+      _chFreqValid = 0;
+      _chDcycleValid = 0;
+      _chDrrangeValid = 0;
+      memset( _chStatusValid, 0, sizeof( _chStatusValid ) );
+    }
+
+    /*
+     * Forget what the network can change with MAC commands: data rate,
+     * power, the channels and RX2 (LinkADRReq, NewChannelReq,
+     * RXParamSetupReq, DutyCycleReq). Only AR is the library's alone.
+     */
+    void invalidateNetwork()
+    {
+      uint8_t ar = _valid & AR;
+      invalidate();
+      _valid = ar;
+    }
+
+    /*
+     * Is the setting known to hold this value? The set functions record
+     * a value after the module acknowledged it.
+     */
+    bool has(setting s, uint8_t value) const { return ( _valid & s ) && _values[index( s )] == value; }
+    void set(setting s, uint8_t value) { _valid |= s; _values[index( s )] = value; _dirty = true; }
+    void forget(setting s) { _valid &= ~s; }
+
+    bool hasRx2(uint8_t dr, uint32_t freq) const { return ( _valid & RX2 ) && _rx2Dr == dr && _rx2Freq == freq; }
+    void setRx2(uint8_t dr, uint32_t freq) { _valid |= RX2; _rx2Dr = dr; _rx2Freq = freq; _dirty = true; }
+
+    bool hasChFreq(uint8_t ch, uint32_t freq) const { return ch < RN2XX3_SHADOW_CHANNELS && ( _chFreqValid & bit16( ch ) ) && _chFreq[ch] == freq; }
+    void setChFreq(uint8_t ch, uint32_t freq) { if ( ch < RN2XX3_SHADOW_CHANNELS ) { _chFreqValid |= bit16( ch ); _chFreq[ch] = freq; _dirty = true; } }
+
+    bool hasChDcycle(uint8_t ch, uint16_t dcycle) const { return ch < RN2XX3_SHADOW_CHANNELS && ( _chDcycleValid & bit16( ch ) ) && _chDcycle[ch] == dcycle; }
+    void setChDcycle(uint8_t ch, uint16_t dcycle) { if ( ch < RN2XX3_SHADOW_CHANNELS ) { _chDcycleValid |= bit16( ch ); _chDcycle[ch] = dcycle; _dirty = true; } }
+
+    bool hasChDrrange(uint8_t ch, uint8_t minDr, uint8_t maxDr) const { return ch < RN2XX3_SHADOW_CHANNELS && ( _chDrrangeValid & bit16( ch ) ) && _chDrrange[ch] == packDr( minDr, maxDr ); }
+    void setChDrrange(uint8_t ch, uint8_t minDr, uint8_t maxDr) { if ( ch < RN2XX3_SHADOW_CHANNELS ) { _chDrrangeValid |= bit16( ch ); _chDrrange[ch] = packDr( minDr, maxDr ); _dirty = true; } }
+
+    bool hasChStatus(uint8_t ch, bool on) const
+    {
+      return ch < RN2XX3_SHADOW_STATUS_CHANNELS && ( _chStatusValid[ch >> 3] & ( 1 << ( ch & 7 ) ) )
+          && ( ( _chStatus[ch >> 3] >> ( ch & 7 ) ) & 1 ) == on;
+    }
+    void setChStatus(uint8_t ch, bool on)
+    {
+      if ( ch < RN2XX3_SHADOW_STATUS_CHANNELS ) {
+          _chStatusValid[ch >> 3] |= 1 << ( ch & 7 );
+          if ( on ) {
+              _chStatus[ch >> 3] |= 1 << ( ch & 7 );
+          } else {
+              _chStatus[ch >> 3] &= ~( 1 << ( ch & 7 ) );
+          }
+          _dirty = true;
+      }
+    }
+
+    /*
+     * Written since the last "mac save"? changed() is for writes that
+     * bypass the set functions, like keys.
+     */
+    bool dirty() const { return _dirty; }
+    void changed() { _dirty = true; }
+    void saved() { _dirty = false; }
+
+  private:
+    static uint8_t index(setting s) { return s == AR ? 0 : s == ADR ? 1 : s == DR ? 2 : 3; }
+    static uint16_t bit16(uint8_t ch) { return (uint16_t)1 << ch; }
+    static uint8_t packDr(uint8_t minDr, uint8_t maxDr) { return ( minDr << 4 ) | ( maxDr & 0x0F ); }
+
+    uint8_t _valid;
+    uint8_t _values[4];
+    uint8_t _rx2Dr;
+    uint32_t _rx2Freq;
+
+    uint16_t _chFreqValid;
+    uint16_t _chDcycleValid;
+    uint16_t _chDrrangeValid;
+    uint32_t _chFreq[RN2XX3_SHADOW_CHANNELS];
+    uint16_t _chDcycle[RN2XX3_SHADOW_CHANNELS];
+    uint8_t _chDrrange[RN2XX3_SHADOW_CHANNELS];
+
+    uint8_t _chStatusValid[( RN2XX3_SHADOW_STATUS_CHANNELS + 7 ) / 8];
+    uint8_t _chStatus[( RN2XX3_SHADOW_STATUS_CHANNELS + 7 ) / 8];
+
+    bool _dirty;
+};
+
+#endif
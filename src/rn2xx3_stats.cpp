@@ -0,0 +1,103 @@
+/*
+ * Counters and latency histograms of the commands sent to the RN2xx3.
+ */
+
+#include "rn2xx3_stats.h"
+
+static const uint16_t bucketLimits[RN2XX3_LATENCY_BUCKETS - 1] PROGMEM = {
+  10, 30, 100, 300, 1000, 3000, 10000
+};
+
+// Class by the first characters of the command
+static RN_COMMAND_CLASS classOf( const char *start )
+{
+  if ( strncmp_P( start, PSTR("sys "), 4 ) == 0 ) {
+      return RN_CMD_SYS;
+  }
+  if ( strncmp_P( start, PSTR("mac set "), 8 ) == 0 ) {
+      return RN_CMD_MAC_SET;
+  }
+  if ( strncmp_P( start, PSTR("mac tx "), 7 ) == 0 ) {
+      return RN_CMD_MAC_TX;
+  }
+  if ( strncmp_P( start, PSTR("mac join "), 9 ) == 0 ) {
+      return RN_CMD_JOIN;
+  }
+  return RN_CMD_OTHER;
+}
+
+RN_COMMAND_CLASS rn2xx3_command_class( const char *command )
+{
+  return classOf( command );
+}
+
+RN_COMMAND_CLASS rn2xx3_command_class( const __FlashStringHelper *command )
+{
+  // Enough of the command to tell the classes apart
+  char start[10];
+  const char *p = (const char *)command;
+  uint8_t i = 0;
+  while ( i < sizeof( start ) - 1 && ( start[i] = pgm_read_byte( p + i ) ) != '\0' ) {
+      i++;
+  }
+  start[i] = '\0';
+  return classOf( start );
+}
+
+#if RN2XX3_STATS
+void rn2xx3_stats::reset()
+{
+  memset( _commands, 0, sizeof( _commands ) );
+  memset( _replies, 0, sizeof( _replies ) );
+  _pending = RN_CMD_CLASS_COUNT;
+}
+
+void rn2xx3_stats::command( RN_COMMAND_CLASS c, unsigned long now )
+{
+  _pending = c;
+  _pendingSince = now;
+}
+
+void rn2xx3_stats::reply( RN_RESPONSE r, unsigned long now )
+{
+  if ( _replies[r] < 0xFFFF ) {
+      _replies[r]++;
+  }
+
+  if ( _pending == RN_CMD_CLASS_COUNT ) {
+      return;
+  }
+  if ( r == RN_OK && ( _pending == RN_CMD_MAC_TX || _pending == RN_CMD_JOIN ) ) {
+      // Accepted, the result comes later
+      return;
+  }
+
+  rn2xx3_command_stats &s = _commands[_pending];
+  unsigned long elapsed = now - _pendingSince;
+  _pending = RN_CMD_CLASS_COUNT;
+  if ( s.count == 0xFFFF ) {
+      // Full; stop here so the total and the histogram stay consistent
+      return;
+  }
+
+  uint8_t bucket = 0;
+  while ( bucket < RN2XX3_LATENCY_BUCKETS - 1 && elapsed >= pgm_read_word( &bucketLimits[bucket] ) ) {
+      bucket++;
+  }
+
+  s.count++;
+  s.totalMillis += elapsed;
+  if ( elapsed > s.maxMillis ) {
+      s.maxMillis = elapsed;
+  }
+  s.histogram[bucket]++;
+}
+#endif
+
+unsigned long rn2xx3_stats::bucketLimit( uint8_t bucket )
+{
+  if ( bucket >= RN2XX3_LATENCY_BUCKETS - 1 ) {
+      return 0;
+  }
+  return pgm_read_word( &bucketLimits[bucket] );
+}
@@ -0,0 +1,105 @@
+/*
+ * Counters and latency histograms of the commands sent to the RN2xx3.
+ *
+ * Every command is put in a class by its first words. The latency of a
+ * command runs from sending it to its final reply, so for "mac tx" and
+ * "mac join" it includes the airtime and the receive windows, not just
+ * the "ok". Every reply line is counted by its RN_RESPONSE code, with
+ * RN_TIMEOUT for replies that never came.
+ *
+ * Everything lives in fixed arrays; nothing is allocated. That is 175
+ * bytes of RAM in every rn2xx3 on an AVR, so there they are compiled out
+ * unless RN2XX3_STATS is defined as 1 when building the library. Compiled
+ * out, the counters all read 0.
+ */
+
+#ifndef rn2xx3_stats_h
+#define rn2xx3_stats_h
+
+#include "Arduino.h"
+#include "rn2xx3_response.h"
+
+#ifndef RN2XX3_STATS
+#ifdef __AVR__
+#define RN2XX3_STATS 0
+#else
+#define RN2XX3_STATS 1
+#endif
+#endif
+
+enum RN_COMMAND_CLASS {
+  RN_CMD_SYS = 0,   // "sys ..."
+  RN_CMD_MAC_SET,   // "mac set ..."
+  RN_CMD_MAC_TX,    // "mac tx ..." up to mac_tx_ok, mac_rx or an error
+  RN_CMD_JOIN,      // "mac join ..." up to accepted, denied or an error
+  RN_CMD_OTHER,     // "mac get", "mac save", "radio ..." and the rest
+  RN_CMD_CLASS_COUNT
+};
+
+// Upper bounds in milliseconds of the latency histogram buckets. The last
+// bucket holds everything slower.
+#define RN2XX3_LATENCY_BUCKETS 8
+
+struct rn2xx3_command_stats
+{
+  uint16_t count;
+  uint32_t totalMillis;
+  uint32_t maxMillis;
+  uint16_t histogram[RN2XX3_LATENCY_BUCKETS];
+};
+
+RN_COMMAND_CLASS rn2xx3_command_class( const char *command );
+RN_COMMAND_CLASS rn2xx3_command_class( const __FlashStringHelper *command );
+
+class rn2xx3_stats
+{
+  public:
+    rn2xx3_stats() { reset(); }
+
+#if RN2XX3_STATS
+    void reset();
+
+    /*
+     * A command of the given class was sent at now.
+     */
+    void command( RN_COMMAND_CLASS c, unsigned long now );
+
+    /*
+     * A reply arrived at now. The "ok" to a mac tx or mac join is counted,
+     * but the command keeps running until the next reply.
+     */
+    void reply( RN_RESPONSE r, unsigned long now );
+
+    const rn2xx3_command_stats &commands( RN_COMMAND_CLASS c ) const { return _commands[c]; }
+    uint16_t replies( RN_RESPONSE r ) const { return _replies[r]; }
+#else
+    void reset() {}
+    void command( RN_COMMAND_CLASS, unsigned long ) {}
+    void reply( RN_RESPONSE, unsigned long ) {}
+
+    const rn2xx3_command_stats &commands( RN_COMMAND_CLASS ) const
+    {
+      static const rn2xx3_command_stats none = {};
+      return none;
+    }
+    uint16_t replies( RN_RESPONSE ) const { return 0; }
+#endif
+
+    /*
+     * The upper bound of a histogram bucket in milliseconds, 0 for the
+     * last, unbounded one.
+     */
+    static unsigned long bucketLimit( uint8_t bucket );
+
+#if RN2XX3_STATS
+  private:
+    rn2xx3_command_stats _commands[RN_CMD_CLASS_COUNT];
+    uint16_t _replies[RN_RESPONSE_COUNT];
+
+    // The command waiting for its reply, RN_CMD_CLASS_COUNT if none
+    uint8_t _pending;
+    unsigned long _pendingSince;
+#endif
+};
+
+#endif